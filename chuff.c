@@ -6,336 +6,1062 @@ Huffman Coding Algorithm
 - Input text file
 - Count frequency of each ascii character in that text file - store in ascii_counts array.
   The indices of ascii_counts correspond to the ascii value of a given character.
-- Scan through ascii_counts, creating a node struct for each char with non-zero frequency.
-  Insert into a linked list in sorted order.
+- Scan through ascii_counts, creating a leaf HTNode for each char with non-zero frequency.
+  All nodes live in one array (a HTree) and refer to each other by index.
+  Insert their indices into a binary min-heap ordered by frequency.
 - Create Huffman binary tree from bottom up.
-  Take first two nodes LLNode1 & LLNode2 from linked list (these will have the two least frequent chars)
-  and make two HTNodes of form (left_child, right_child, freq, code, char)
-  Then delete LLNode1 & LLNode2 from start of linked list.
-  So HTNode1 = (NULL, NULL, freq1, code1, char1), HTNode2 = (NULL, NULL, freq2, code2, char2)
+  Pop the two least frequent nodes HTNode1 & HTNode2 from the heap.
+  So HTNode1 = (HT_NULL, HT_NULL, freq1, code1, char1), HTNode2 = (HT_NULL, HT_NULL, freq2, code2, char2)
   We assign: code1 = 0 as HTNode1 is left child, code2 = 1 as HTNode2 is right child.
 - Form a parent HTNode for them, HTNode3 = (HTNode1, HTNode2, freq1+freq2, code3, char1char2)
   by concatenating the chars and adding their frequencies.
-- Make LLNode for HTNode3 and insert into linked list (in order of frequency).
+- Push HTNode3 back into the heap.
   That way this new node will be included when building the Huffman tree.
-- Keep taking two LLNodes from start of linked list and making them into HTNodes
-  and inserting them into Huffman Tree, then deleting them from linked list until linked list is empty.
-  Then our Huffman Tree will be complete.
+- Keep popping two nodes and pushing their parent until only one node is left in the heap.
+  Then our Huffman Tree will be complete, with that node as its root.
+  Each push and pop is O(log n), so this stays fast for alphabets far bigger than 256.
+- Reduce the Huffman Tree to the depth of each char's leaf (its code length)
+  and assign canonical codes from the lengths alone.
+  Shorter codes come first and codes of the same length count up in char order,
+  so a decoder only needs the lengths (one byte per char) to rebuild the same codes.
 */
 
 # include <stdio.h>
 # include <stdlib.h>
 # include <stdbool.h>
+# include <stdint.h>
 # include <string.h>
+# include <getopt.h>
+# include <unistd.h>
 
 # include "chuff_shared.h"
-# include "chuff_linked_list.h"
+# include "chuff_heap.h"
 # include "chuff_huffman_tree.h"
+# include "chuff_bitstream.h"
+# include "chuff_decode_table.h"
+# include "chuff_canonical.h"
+# include "chuff_histogram.h"
+# include "chuff_block.h"
+# include "chuff_stream.h"
+# include "chuff_model.h"
+# include "chuff_stats.h"
+# include "chuff_batch.h"
+# include "chuff_codegen.h"
 
-
-//# define NUM_ASCII 200
+// Size of the chunks the demo reads the text file in
+# define READ_CHUNK_SIZE (1 << 16)
+// Most --model options decompression will take
+# define MAX_MODELS 16
 
 // Initialise list of ascii character counts to all 0
-int ascii_counts[NUM_ASCII] = {};
-char* huffman_encodings[NUM_ASCII];
+uint64_t ascii_counts[NUM_SYMBOLS] = {};
+int code_lengths[NUM_SYMBOLS] = {};
+HuffCode huffman_codes[NUM_SYMBOLS];
 
-int set_ascii_counts(FILE* fp, int ascii_counts[])
+size_t set_ascii_counts(FILE* fp, uint64_t ascii_counts[])
 {
-    int num_chars = 0;
-    // Get chars in text file one at a time and updates count in ascii_counts
-    char c;
-    while( (c = fgetc(fp)) != EOF )
+    size_t num_chars = 0;
+    // Read the text file a chunk at a time and update the counts in ascii_counts
+    uint8_t* chunk = malloc(READ_CHUNK_SIZE);
+    size_t chunk_size;
+    while( (chunk_size = fread(chunk, 1, READ_CHUNK_SIZE, fp)) > 0 )
     {
-        int index = (int)c;
-        ascii_counts[index] += 1;
-        num_chars++;
+        histogram_count(chunk, chunk_size, ascii_counts);
+        num_chars += chunk_size;
     }
+    free(chunk);
     return num_chars;
 }
 
 void print_ascii_counts()
 {
-    for (int i = 0; i < NUM_ASCII; i++)
+    for (int i = 0; i < NUM_SYMBOLS; i++)
     {
-        printf("%d ", ascii_counts[i]);
+        printf("%llu ", (unsigned long long)ascii_counts[i]);
     }
     printf("\n");
 }
 
-char* set_binary_string(LLNode* visited)
+void print_code(HuffCode code)
 {
-    LLNode* curr = visited;
-    int len_binary_string = 0;
-    while (curr != NULL)
-    {
-        len_binary_string++;
-        curr = curr->next;
-    }
-    // We have an X at the head of each list which we don't want to include
-    // So only need room for the rest of the binary chars
-    char* binary_string = malloc( (len_binary_string) * sizeof(char) );
-    binary_string[len_binary_string-1] = '\0';
-    int i = 0;
-    curr = visited;
-    while (curr != NULL)
-    {
-        if (curr->htnode->code != 'X')
-        {
-            binary_string[i] = curr->htnode->code;
-            i++;
-        }
-        curr = curr->next;
+    for (int i = code.len - 1; i >= 0; i--)
+    {
+        putchar((code.bits >> i) & 1 ? '1' : '0');
     }
-    return binary_string;
+    printf("\n");
 }
 
-LLNode* expand_nodes(LLNode* to_visit, HTNode* node)
+void print_huffman_codes(HuffCode huffman_codes[], uint64_t ascii_counts[])
 {
-    // if node has children, insert them to at head of to_visit (right, then left)
-    if (node->left != NULL && node->right != NULL)
+    for (int i = 0; i < NUM_SYMBOLS; i++)
     {
-        LLNode* llnode_right = llnode_init(node->right);
-        LLNode* llnode_left = llnode_init(node->left);
-        to_visit = ll_insert_start(to_visit, llnode_right);
-        to_visit = ll_insert_start(to_visit, llnode_left);
-        return to_visit;
+        if (huffman_codes[i].len > 0)
+        {
+            unsigned long long freq = ascii_counts[i];
+            if (i == 9 || i == 11)
+                printf("Char: TAB      Frequency: %llu      Encoding: ", freq);
+            else if (i == 10 || i == 13)
+                printf("Char: NEW LINE Frequency: %llu      Encoding: ", freq);
+            else if (i == 32)
+                printf("Char: SPACE    Frequency: %llu      Encoding: ", freq);
+            else if (i < 32 || i > 126)
+                printf("Char: 0x%02x     Frequency: %llu      Encoding: ", i, freq);
+            else
+                printf("Char: %c        Frequency: %llu      Encoding: ", i, freq);
+            print_code(huffman_codes[i]);
+        }
     }
-    else
+}
+
+uint64_t get_num_encoded_bits(HuffCode huffman_codes[], uint64_t ascii_counts[])
+{
+    // Total size of the encoded text is known up front from the counts and code lengths
+    uint64_t num_bits = 0;
+    for (int i = 0; i < NUM_SYMBOLS; i++)
     {
-        return to_visit;
+        num_bits += ascii_counts[i] * huffman_codes[i].len;
     }
+    return num_bits;
 }
 
-LLNode* check_reached_leaf(LLNode* visited, HTNode* node)
+uint8_t* encode(FILE* fp, HuffCode huffman_codes[], uint64_t num_bits, size_t* num_bytes)
 {
-    if (node->left == NULL && node->right == NULL)
+    // Read the text file a chunk at a time and pack the code for each char into encoded_text
+    uint8_t* encoded_text = malloc( bw_bytes_needed(num_bits) );
+    BitWriter bw;
+    bw_init(&bw, encoded_text);
+    uint8_t* chunk = malloc(READ_CHUNK_SIZE);
+    size_t chunk_size;
+    while( (chunk_size = fread(chunk, 1, READ_CHUNK_SIZE, fp)) > 0 )
     {
-        char* binary_string = set_binary_string(visited);
-        int index = node->cs;
-        huffman_encodings[index] = binary_string;
-        visited = ll_pop_end(visited);
-        return visited;
+        for (size_t i = 0; i < chunk_size; i++)
+        {
+            bw_put_code(&bw, huffman_codes[chunk[i]]);
+        }
     }
-    return visited;
+    free(chunk);
+    *num_bytes = bw_finish(&bw);
+    return encoded_text;
 }
 
-bool children_visited(LLNode* visited)
+void print_encoded_text(uint8_t* encoded_text, uint64_t num_bits)
 {
-    LLNode* visited_end = ll_get_end(visited);
-    HTNode* ht_node = visited_end->htnode;
-    if (ht_node->left->visited == true && ht_node->right->visited == true)
+    BitReader br;
+    br_init(&br, encoded_text, bw_bytes_needed(num_bits));
+    for (uint64_t i = 0; i < num_bits; i++)
     {
-        return true;
+        putchar(br_get_bit(&br) ? '1' : '0');
     }
-    return false;
+    printf("\n");
+}
+
+char* decode(uint8_t* encoded_text, size_t num_bytes, size_t num_chars, DecodeTable* decode_table)
+{
+    char* decoded_text = malloc( (num_chars + 1) * sizeof(char) );
+    BitReader br;
+    br_init(&br, encoded_text, num_bytes);
+    // The last byte may be padded with 0s, so stop once every char has been decoded
+    block_decode_run(decode_table, &br, (uint8_t*)decoded_text, num_chars);
+    decoded_text[num_chars] = '\0';
+    return decoded_text;
 }
 
-void dfs(LLNode* visited, LLNode* to_visit)
+int run_demo(char* filename)
 {
-    // When we add a node to visited we check to see if it has children
-    // If it does, we add them to start of to_visit (right first, then left)
-    to_visit = expand_nodes(to_visit, visited->htnode);
-    visited = check_reached_leaf(visited, visited->htnode);
-    if (to_visit->htnode->freq == -1 && to_visit->htnode->cs == -1 && to_visit->htnode->code == 'X')
+    // Open file
+    FILE* fp = fopen(filename, "rb");
+
+    // Check if file exists
+    if (fp == NULL)
     {
-        return;
+        printf("Could no open file.\n");
+        return 1;
     }
-    LLNode* ll_node;
-    while (to_visit->htnode->freq != -1 && to_visit->htnode->cs != -1 && to_visit->htnode->code != 'X')
+
+    // Check if file is empty
+    if (fp != NULL)
     {
-        ll_node = ll_get_min(to_visit);
-        to_visit = ll_pop_start(to_visit);
-        while (children_visited(visited) == true)
+        fseek(fp, 0, SEEK_END);
+        if (ftell(fp) == 0)
         {
-            visited = ll_pop_end(visited);
+            printf("File is empty.\n");
+            return 1;
         }
-        visited = ll_insert_end(visited, ll_node);
-        ll_node->htnode->visited = true;
-        to_visit = expand_nodes(to_visit, ll_node->htnode);
-        visited = check_reached_leaf(visited, ll_node->htnode);
     }
-    return;
+
+    // Get the frequency counts of each character in text file
+    fseek(fp, 0, SEEK_SET);
+    size_t num_chars = set_ascii_counts(fp, ascii_counts);
+    //print_ascii_counts();
+    //printf("\n");
+
+    // Build Huffman Tree from a heap of HTNode indices ordered by character frequency
+    HTree ht;
+    ht_init(&ht);
+    ht_build(&ht, ascii_counts, NUM_SYMBOLS);
+    //ht_print(&ht);
+    //printf("\n");
+
+    // Reduce the tree to code lengths and assign canonical codes from them
+    ht_get_code_lengths(&ht, code_lengths);
+    ht_free(&ht);
+    if (canonical_assign_codes(code_lengths, huffman_codes, NUM_SYMBOLS) != 0)
+    {
+        printf("Could not assign canonical codes.\n");
+        return 1;
+    }
+    printf("Huffman encodings:\n");
+    print_huffman_codes(huffman_codes, ascii_counts);
+
+    // The code lengths are all a decoder needs to rebuild the codes
+    uint8_t* header = malloc( canonical_header_size(code_lengths, NUM_SYMBOLS) );
+    size_t header_size = canonical_write_lengths(code_lengths, NUM_SYMBOLS, header);
+
+    // Set file pointer back to start of file
+    fseek(fp, 0, SEEK_SET);
+    uint64_t num_bits = get_num_encoded_bits(huffman_codes, ascii_counts);
+
+    // Encode text file
+    size_t num_bytes;
+    uint8_t* encoded_text = encode(fp, huffman_codes, num_bits, &num_bytes);
+    printf("\nEncoded text: \n");
+    print_encoded_text(encoded_text, num_bits);
+    printf("\nEncoded size: %zu bytes + %zu byte header (original %zu bytes)\n", num_bytes, header_size, num_chars);
+
+    // Rebuild the codes from the header alone, then build a lookup table
+    // mapping the next few bits of encoded text to a char and its code length
+    int decoded_lengths[NUM_SYMBOLS];
+    HuffCode decoded_codes[NUM_SYMBOLS];
+    DecodeTable decode_table;
+    dt_init(&decode_table);
+    if (canonical_read_lengths(header, header_size, decoded_lengths, NUM_SYMBOLS) < 0
+        || canonical_assign_codes(decoded_lengths, decoded_codes, NUM_SYMBOLS) != 0
+        || dt_build(&decode_table, decoded_codes, NUM_SYMBOLS) != 0)
+    {
+        printf("Could not build decode table.\n");
+        return 1;
+    }
+
+    // Decode text file
+    char* decoded_text = decode(encoded_text, num_bytes, num_chars, &decode_table);
+    printf("\nDecoded text: \n%s\n", decoded_text);
+    
+    // Close file
+    fseek(fp, 0, SEEK_SET);
+    fclose(fp);
+    return 0;
+}
+
+FILE* open_stream(char* filename, char* mode)
+{
+    // "-" stands for stdin or stdout so chuff can sit in a pipeline
+    if (strcmp(filename, "-") == 0)
+    {
+        return mode[0] == 'r' ? stdin : stdout;
+    }
+    return fopen(filename, mode);
+}
+
+size_t parse_block_size(char* arg)
+{
+    // Accepts a number of bytes with an optional K or M suffix, e.g. 128K or 4M
+    char* end;
+    unsigned long size = strtoul(arg, &end, 10);
+    if (*end == 'K' || *end == 'k')
+    {
+        size <<= 10;
+        end++;
+    }
+    else if (*end == 'M' || *end == 'm')
+    {
+        size <<= 20;
+        end++;
+    }
+    if (end == arg || *end != '\0' || size < MIN_BLOCK_SIZE || size > MAX_BLOCK_SIZE)
+    {
+        return 0;
+    }
+    return size;
+}
+
+void print_usage()
+{
+    printf("Usage:\n");
+    printf("  chuff [my_text_file.txt]                       Print Huffman codes, encoded and decoded text\n");
+    printf("  chuff -c [-b block_size] [-T threads] [--max-code-len L] [input] [-o output]\n");
+    printf("                                                          Compress input (stdin/stdout if left out or -)\n");
+    printf("  chuff -c --order 1 <input> <output>                     Compress with a code table per previous byte\n");
+    printf("  chuff -c --streams N <input> <output>                   Split each block into N bitstreams (default %d)\n", DEFAULT_NUM_STREAMS);
+    printf("  chuff -c --no-checksums <input> <output>                Leave out the CRC-32 at the end of each block\n");
+    printf("  chuff -c --words <input> <output>                       Code text a word at a time instead of a byte\n");
+    printf("  chuff -c --coder=ans <input> <output>                   Code bytes with tANS instead of Huffman codes\n");
+    printf("  chuff -c --adaptive <input> <output>                    Compress in one pass with adaptive codes\n");
+    printf("  chuff -c --append <file.chuff> [input]                  Compress input onto the end of a chuff file\n");
+    printf("  chuff -d [-T threads] [input] [-o output]               Decompress input (stdin/stdout if left out or -)\n");
+    printf("  chuff -d --range <offset>:<length> <input> <output>     Decompress only part of a chuff file\n");
+    printf("  chuff -c --batch[=list] [-r] [files...] [-o dir]        Compress each file to file.chuff in one run\n");
+    printf("                                                          (names from list or stdin if none are given)\n");
+    printf("  chuff -c --batch --shared-model <model> [files...]      Train one code table on the batch and use it for every file\n");
+    printf("  chuff -d --batch[=list] [-r] [files...] [-o dir]        Decompress each file.chuff to file\n");
+    printf("  chuff train [--max-code-len L] <corpus...> -o <model>   Build a model from sample files\n");
+    printf("  chuff gen-codec --model <model> [--prefix name] [-o codec.h]\n");
+    printf("                                                          Write C source for a codec with the model built in\n");
+    printf("  chuff -c --model <model> <input> <output>               Compress one record with a model\n");
+    printf("  chuff -d --model <model> [--model ...] <input> <output> Decompress a record with the model it names\n");
+}
+
+int parse_range(char* arg, uint64_t* offset, uint64_t* length)
+{
+    char* end;
+    *offset = strtoull(arg, &end, 10);
+    if (end == arg || *end != ':')
+    {
+        return -1;
+    }
+    char* length_arg = end + 1;
+    *length = strtoull(length_arg, &end, 10);
+    if (end == length_arg || *end != '\0')
+    {
+        return -1;
+    }
+    return 0;
+}
+
+int run_range(char* input_name, char* output_name, uint64_t offset, uint64_t length)
+{
+    // Random access needs to seek, so the input has to be a file rather than stdin
+    FILE* in = fopen(input_name, "rb");
+    if (in == NULL)
+    {
+        fprintf(stderr, "Could not open %s.\n", input_name);
+        return 1;
+    }
+    FILE* out = open_stream(output_name, "wb");
+    if (out == NULL)
+    {
+        fprintf(stderr, "Could not open %s.\n", output_name);
+        return 1;
+    }
+    int result = stream_decompress_range(in, out, offset, length);
+    fclose(in);
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+    return result == 0 ? 0 : 1;
 }
 
-void set_huffman_encodings(HTNode* ht)
+void print_code_len_limit_report(StreamOptions* options, StreamStats* stats)
 {
-    // Create head of linked list storing visited nodes, make root of ht the head
-    LLNode* visited = llnode_init(ht);
-    visited->is_head = true;
-    // Create head of linked list storing nodes to visit
-    HTNode* htnull = htnode_init(-1, -1);
-    LLNode* to_visit = llnode_init(htnull);
-    to_visit->is_head = true;
-    dfs(visited, to_visit);
-    return;
+    // How much the code length limit cost compared to plain Huffman codes
+    double loss = 0;
+    if (stats->unlimited_bits > 0)
+    {
+        loss = 100.0 * ((double)stats->payload_bits - (double)stats->unlimited_bits) / (double)stats->unlimited_bits;
+    }
+    fprintf(stderr, "Max code length %d: %llu bytes of codes, %.4f%% more than with unlimited code lengths\n",
+        options->max_code_len, (unsigned long long)((stats->payload_bits + 7) / 8), loss);
 }
 
-void print_huffman_encodings(char* huffman_encodings[], int ascii_counts[])
+uint8_t* read_all(FILE* in, size_t* size)
 {
-    for (int i = 0; i < NUM_ASCII; i++)
+    size_t cap = READ_CHUNK_SIZE;
+    uint8_t* buf = malloc(cap);
+    *size = 0;
+    size_t num_read;
+    while ( (num_read = fread(buf + *size, 1, cap - *size, in)) > 0 )
     {
-        if (huffman_encodings[i] != NULL)
+        *size += num_read;
+        if (*size == cap)
         {
-            if (i == 9 || i == 11)
-                printf("Char: TAB      Frequency: %d      Encoding: %s\n", ascii_counts[i], huffman_encodings[i]);
-            else if (i == 10 || i == 13)
-                printf("Char: NEW LINE Frequency: %d      Encoding: %s\n", ascii_counts[i], huffman_encodings[i]);
-            else if (i == 32)
-                printf("Char: SPACE    Frequency: %d      Encoding: %s\n", ascii_counts[i], huffman_encodings[i]);
-            else
-                printf("Char: %c        Frequency: %d      Encoding: %s\n", i, ascii_counts[i], huffman_encodings[i]);
+            cap *= 2;
+            buf = realloc(buf, cap);
         }
     }
+    return buf;
 }
 
-int get_max_len_binary_string(char* huffman_encodings[])
+int run_train(char* corpus_names[], int num_corpus, char* model_name, int max_code_len)
 {
-    int length = 0;
-    for (int i = 0; i < NUM_ASCII; i++)
+    uint64_t counts[NUM_SYMBOLS] = {0};
+    uint64_t num_bytes = 0;
+    for (int i = 0; i < num_corpus; i++)
     {
-        if (huffman_encodings[i] != NULL)
+        FILE* in = open_stream(corpus_names[i], "rb");
+        if (in == NULL)
+        {
+            fprintf(stderr, "Could not open %s.\n", corpus_names[i]);
+            return 1;
+        }
+        num_bytes += set_ascii_counts(in, counts);
+        if (in != stdin)
         {
-            if (strlen(huffman_encodings[i]) > length)
+            fclose(in);
+        }
+    }
+
+    ChuffModel model;
+    model_init(&model);
+    int result = model_train(&model, counts, max_code_len);
+    FILE* out = result == 0 ? fopen(model_name, "wb") : NULL;
+    if (out == NULL || model_write(&model, out) != 0)
+    {
+        fprintf(stderr, "Could not write %s.\n", model_name);
+        result = -1;
+    }
+    else
+    {
+        fprintf(stderr, "Trained model %08x on %llu bytes\n", model.id, (unsigned long long)num_bytes);
+    }
+    if (out != NULL)
+    {
+        fclose(out);
+    }
+    model_free(&model);
+    return result == 0 ? 0 : 1;
+}
+
+int load_models(char* model_names[], int num_models, ChuffModel models[])
+{
+    for (int i = 0; i < num_models; i++)
+    {
+        model_init(&models[i]);
+        FILE* model_file = fopen(model_names[i], "rb");
+        if (model_file == NULL || model_read(&models[i], model_file) != 0)
+        {
+            fprintf(stderr, "Could not load model %s.\n", model_names[i]);
+            if (model_file != NULL)
+            {
+                fclose(model_file);
+            }
+            for (int j = 0; j <= i; j++)
             {
-                length = strlen(huffman_encodings[i]);
+                model_free(&models[j]);
             }
+            return -1;
         }
+        fclose(model_file);
     }
-    return length;
+    return 0;
 }
 
-char* encode(FILE* fp, char* huffman_encodings[], int num_chars, int max_len_binary_string)
+int run_gen_codec(char* model_name, char* output_name, char* prefix)
 {
-    // Get chars in text file one at a time and concat binary encodings of each to encoded_text string buffer
-    char* encoded_text = malloc( num_chars * max_len_binary_string * sizeof(char) );
-    // Set first position of encoded_text string buffer to null byte
-    // as strncat will overwrite this and set new null byte
-    encoded_text[0] = '\0';
-    char c;
-    while( (c = fgetc(fp)) != EOF )
-    {
-        int index = (int)c;
-        char* binary_string = huffman_encodings[index];
-        encoded_text = strncat(encoded_text, binary_string, strlen(binary_string));
+    if (!codegen_valid_prefix(prefix))
+    {
+        fprintf(stderr, "--prefix must be a C identifier of at most %d chars.\n", CODEGEN_MAX_PREFIX_LEN);
+        return 1;
     }
-    return encoded_text;
+    ChuffModel model;
+    if (load_models(&model_name, 1, &model) != 0)
+    {
+        return 1;
+    }
+    FILE* out = output_name == NULL ? stdout : open_stream(output_name, "w");
+    if (out == NULL)
+    {
+        fprintf(stderr, "Could not open %s.\n", output_name);
+        model_free(&model);
+        return 1;
+    }
+    // The file name goes at the top of the header, as in every other source file
+    char* file_name = output_name == NULL || out == stdout ? "codec.h" : output_name;
+    char* slash = strrchr(file_name, '/');
+    if (slash != NULL)
+    {
+        file_name = slash + 1;
+    }
+    int result = codegen_write(&model, prefix, file_name, out);
+    if (out != stdout && fclose(out) != 0)
+    {
+        result = -1;
+    }
+    if (result != 0)
+    {
+        fprintf(stderr, "Could not write %s.\n", output_name == NULL ? "codec" : output_name);
+    }
+    model_free(&model);
+    return result == 0 ? 0 : 1;
 }
 
-char* decode(char* encoded_text, char* huffman_encodings[], int max_len_binary_string)
+ChuffModel* find_model(ChuffModel models[], int num_models, uint32_t id)
 {
-    char* decoded_text = malloc( strlen(encoded_text) * sizeof(char) );
-    decoded_text[0] = '\0';
-    char* binary_string = calloc( (max_len_binary_string + 1), sizeof(char) );
-    binary_string[0] = '\0';
-    int len_encoded = strlen(encoded_text);
-    for (int i = 0; i < len_encoded; i++)
-    {
-        char bin = encoded_text[i];
-        binary_string = strncat(binary_string, &bin, 1);
-        // MORE EFFICIENT WITH huffman_encodings AS A HASH TABLE? NO NESTED FOR LOOP NECESSARY
-        for (int j = 0; j < NUM_ASCII; j++)
+    for (int i = 0; i < num_models; i++)
+    {
+        if (models[i].id == id)
         {
-            bool char_match = false;
-            //CHECK huffman_encodings[j] is actually a string before using strncmp
-            if (huffman_encodings[j] != NULL)
-            {
-                if (strncmp(binary_string, huffman_encodings[j], strlen(huffman_encodings[j])) == 0)
-                {
-                    char c = (char)j;
-                    decoded_text = strncat(decoded_text, &c, 1);
-                    char* temp = binary_string;
-                    binary_string = calloc( (max_len_binary_string + 1), sizeof(char) );
-                    free(temp);
-                    char_match = true;
-                    if (char_match) break;
-                }
-            }
+            return &models[i];
         }
     }
-    return decoded_text;
+    return NULL;
 }
 
-int main(int argc, char* argv[])
+int code_record(bool compress, uint8_t* src, size_t src_size, FILE* out, ChuffModel models[], int num_models)
 {
+    // Compression uses the first model, decompression the one the record names
+    ChuffModel* model = &models[0];
+    size_t dst_cap;
+    if (compress)
+    {
+        dst_cap = model_compress_bound(model, src_size);
+    }
+    else
+    {
+        uint32_t id;
+        if (model_record_info(src, src_size, &id, &dst_cap) != 0)
+        {
+            fprintf(stderr, "Record is truncated.\n");
+            return -1;
+        }
+        model = find_model(models, num_models, id);
+        if (model == NULL)
+        {
+            fprintf(stderr, "Record was coded with model %08x, which was not given.\n", id);
+            return -1;
+        }
+    }
 
-    // Check if text file name provided
-    if (argc < 2)
+    uint8_t* dst = malloc(dst_cap > 0 ? dst_cap : 1);
+    long dst_size = compress ? model_compress(model, src, src_size, dst, dst_cap) : model_decompress(model, src, src_size, dst, dst_cap);
+    int result = 0;
+    if (dst_size < 0)
     {
-        printf("Please enter a text file name.\n");
-        return 1;
+        fprintf(stderr, compress ? "Input is too big for one record.\n" : "Record is corrupt.\n");
+        result = -1;
+    }
+    else if (fwrite(dst, 1, dst_size, out) != (size_t)dst_size)
+    {
+        fprintf(stderr, "Could not write output.\n");
+        result = -1;
     }
+    free(dst);
+    return result;
+}
 
-    // Check if too many arguments provided
-    if (argc > 2)
+int run_model(bool compress, char* input_name, char* output_name, char* model_names[], int num_models)
+{
+    ChuffModel* models = malloc( num_models * sizeof(ChuffModel) );
+    if (load_models(model_names, num_models, models) != 0)
     {
-        printf("Too many arguments.\n");
+        free(models);
+        return 1;
+    }
+    FILE* in = open_stream(input_name, "rb");
+    if (in == NULL)
+    {
+        fprintf(stderr, "Could not open %s.\n", input_name);
+        return 1;
+    }
+    FILE* out = open_stream(output_name, "wb");
+    if (out == NULL)
+    {
+        fprintf(stderr, "Could not open %s.\n", output_name);
         return 1;
     }
 
-    // Get file name and open file
-    char* filename = argv[1];
-    FILE* fp = fopen(filename, "r");
+    // Records are small, so the whole thing is read in one go
+    size_t src_size;
+    uint8_t* src = read_all(in, &src_size);
+    int result = code_record(compress, src, src_size, out, models, num_models);
+    free(src);
+    if (in != stdin)
+    {
+        fclose(in);
+    }
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+    for (int i = 0; i < num_models; i++)
+    {
+        model_free(&models[i]);
+    }
+    free(models);
+    return result == 0 ? 0 : 1;
+}
 
-    // Check if file exists
-    if (fp == NULL)
+int run_stream(bool compress, char* input_name, char* output_name, StreamOptions* options, int stats_format)
+{
+    FILE* in = open_stream(input_name, "rb");
+    if (in == NULL)
     {
-        printf("Could no open file.\n");
+        fprintf(stderr, "Could not open %s.\n", input_name);
         return 1;
     }
+    FILE* out = open_stream(output_name, "wb");
+    if (out == NULL)
+    {
+        fprintf(stderr, "Could not open %s.\n", output_name);
+        return 1;
+    }
+    uint64_t start = get_time_ns();
+    StreamStats stats;
+    int result = compress ? stream_compress(in, out, options, &stats) : stream_decompress(in, out, options, &stats);
+    if (result == 0 && stats_format != STATS_NONE)
+    {
+        stats_print(&stats, compress, get_time_ns() - start, stats_format);
+    }
+    else if (compress && result == 0 && options->max_code_len > 0)
+    {
+        print_code_len_limit_report(options, &stats);
+    }
+    if (in != stdin)
+    {
+        fclose(in);
+    }
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+    return result == 0 ? 0 : 1;
+}
 
-    // Check if file is empty
-    if (fp != NULL)
+int run_append(char* input_name, char* file_name, StreamOptions* options, int stats_format)
+{
+    FILE* in = open_stream(input_name, "rb");
+    if (in == NULL)
     {
-        fseek(fp, 0, SEEK_END);
-        if (ftell(fp) == 0)
+        fprintf(stderr, "Could not open %s.\n", input_name);
+        return 1;
+    }
+    // The file is read for its header and index, then written from its end marker on
+    FILE* file = fopen(file_name, "r+b");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Could not open %s.\n", file_name);
+        return 1;
+    }
+    uint64_t start = get_time_ns();
+    StreamStats stats;
+    int result = stream_append(in, file, options, &stats);
+    if (result == 0 && stats_format != STATS_NONE)
+    {
+        stats_print(&stats, true, get_time_ns() - start, stats_format);
+    }
+    else if (result == 0 && options->max_code_len > 0)
+    {
+        print_code_len_limit_report(options, &stats);
+    }
+    if (in != stdin)
+    {
+        fclose(in);
+    }
+    if (fclose(file) != 0 && result == 0)
+    {
+        fprintf(stderr, "Could not write %s.\n", file_name);
+        result = -1;
+    }
+    return result == 0 ? 0 : 1;
+}
+
+void print_batch_report(BatchStats* stats, bool compress, uint64_t wall_ns, int format)
+{
+    double wall_s = wall_ns * 1e-9;
+    double files_per_s = wall_s > 0 ? stats->num_files / wall_s : 0;
+    uint64_t bytes_in = compress ? stats->raw_bytes : stats->comp_bytes;
+    uint64_t bytes_out = compress ? stats->comp_bytes : stats->raw_bytes;
+    if (format == STATS_JSON)
+    {
+        fprintf(stderr, "{\"mode\":\"%s\",\"files\":%llu,\"failed\":%llu,\"skipped\":%llu,\"bytes_in\":%llu,\"bytes_out\":%llu,"
+            "\"wall_s\":%.6f,\"files_per_s\":%.1f}\n",
+            compress ? "compress" : "decompress", (unsigned long long)stats->num_files,
+            (unsigned long long)stats->num_failed, (unsigned long long)stats->num_skipped, (unsigned long long)bytes_in,
+            (unsigned long long)bytes_out, wall_s, files_per_s);
+        return;
+    }
+    fprintf(stderr, "Files:        %llu (%llu failed, %llu skipped)\n", (unsigned long long)stats->num_files,
+        (unsigned long long)stats->num_failed, (unsigned long long)stats->num_skipped);
+    fprintf(stderr, "Bytes in:     %llu\n", (unsigned long long)bytes_in);
+    fprintf(stderr, "Bytes out:    %llu\n", (unsigned long long)bytes_out);
+    fprintf(stderr, "Wall time:    %.3f s (%.1f files/s)\n", wall_s, files_per_s);
+}
+
+int run_batch(BatchList* list, BatchOptions* batch_options, char* model_names[], int num_models, int stats_format)
+{
+    ChuffModel* models = NULL;
+    if (num_models > 0)
+    {
+        models = malloc( num_models * sizeof(ChuffModel) );
+        if (load_models(model_names, num_models, models) != 0)
         {
-            printf("File is empty.\n");
+            free(models);
             return 1;
         }
     }
+    batch_options->models = models;
+    batch_options->num_models = num_models;
+    uint64_t start = get_time_ns();
+    BatchStats stats;
+    int result = batch_run(list, batch_options, &stats);
+    if (stats_format != STATS_NONE)
+    {
+        print_batch_report(&stats, batch_options->compress, get_time_ns() - start, stats_format);
+    }
+    for (int i = 0; i < num_models; i++)
+    {
+        model_free(&models[i]);
+    }
+    free(models);
+    return result == 0 ? 0 : 1;
+}
 
-    // Get the frequency counts of each character in text file
-    fseek(fp, 0, SEEK_SET);
-    int num_chars = set_ascii_counts(fp, ascii_counts);
-    //print_ascii_counts();
-    //printf("\n");
+int main(int argc, char* argv[])
+{
+    bool compress = false;
+    bool decompress = false;
+    StreamOptions options;
+    stream_options_init(&options);
+    bool range = false;
+    uint64_t range_offset = 0;
+    uint64_t range_length = 0;
+    char* output_name = NULL;
+    char* model_names[MAX_MODELS];
+    int num_models = 0;
+    int stats_format = STATS_NONE;
+    bool batch = false;
+    char* batch_list_name = NULL;
+    bool recursive = false;
+    char* shared_model_name = NULL;
+    char* codec_prefix = CODEGEN_DEFAULT_PREFIX;
+    char* append_name = NULL;
 
-    // Initialise the head of the linked list
-    HTNode* htnode = htnode_init(-1, -1);
-    LLNode* head = llnode_init(htnode);
-    head->is_head = true;
-    
-    // Build linked list storing HTNode pointers sorted by character frequency, smallest to largest.
-    head = ll_build(head, ascii_counts);
-    //ll_print(head);
-    //printf("\n");
-    
-    // Build Huffman Tree
-    head = ht_build(head);
-    // Get pointer to root of Huffman tree
-    HTNode* ht = head->htnode;
-    //ht_print(ht);
-    //printf("\n");
+    struct option long_options[] =
+    {
+        {"compress", no_argument, NULL, 'c'},
+        {"decompress", no_argument, NULL, 'd'},
+        {"block-size", required_argument, NULL, 'b'},
+        {"threads", required_argument, NULL, 'T'},
+        {"range", required_argument, NULL, 'R'},
+        {"max-code-len", required_argument, NULL, 'L'},
+        {"order", required_argument, NULL, 'O'},
+        {"streams", required_argument, NULL, 'N'},
+        {"no-checksums", no_argument, NULL, 'K'},
+        {"words", no_argument, NULL, 'W'},
+        {"coder", required_argument, NULL, 'C'},
+        {"model", required_argument, NULL, 'm'},
+        {"adaptive", no_argument, NULL, 'a'},
+        {"append", required_argument, NULL, 'A'},
+        {"stats", optional_argument, NULL, 'S'},
+        {"batch", optional_argument, NULL, 'B'},
+        {"recursive", no_argument, NULL, 'r'},
+        {"shared-model", required_argument, NULL, 'M'},
+        {"prefix", required_argument, NULL, 'P'},
+        {"output", required_argument, NULL, 'o'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ( (opt = getopt_long(argc, argv, "cdb:T:o:rh", long_options, NULL)) != -1 )
+    {
+        switch (opt)
+        {
+            case 'c':
+                compress = true;
+                break;
+            case 'd':
+                decompress = true;
+                break;
+            case 'b':
+                options.block_size = parse_block_size(optarg);
+                if (options.block_size == 0)
+                {
+                    fprintf(stderr, "Block size must be between 1K and 64M.\n");
+                    return 1;
+                }
+                break;
+            case 'T':
+                options.num_threads = atoi(optarg);
+                if (options.num_threads < 1 || options.num_threads > MAX_THREADS)
+                {
+                    fprintf(stderr, "Number of threads must be between 1 and %d.\n", MAX_THREADS);
+                    return 1;
+                }
+                break;
+            case 'L':
+                options.max_code_len = atoi(optarg);
+                if (options.max_code_len < MIN_CODE_LEN_LIMIT || options.max_code_len > MAX_CODE_LEN_LIMIT)
+                {
+                    fprintf(stderr, "Max code length must be between %d and %d.\n", MIN_CODE_LEN_LIMIT, MAX_CODE_LEN_LIMIT);
+                    return 1;
+                }
+                break;
+            case 'O':
+                options.order = atoi(optarg);
+                if (options.order < 0 || options.order > BLOCK_MAX_ORDER)
+                {
+                    fprintf(stderr, "Order must be between 0 and %d.\n", BLOCK_MAX_ORDER);
+                    return 1;
+                }
+                break;
+            case 'N':
+                options.num_streams = atoi(optarg);
+                if (options.num_streams < 1 || options.num_streams > BLOCK_MAX_STREAMS)
+                {
+                    fprintf(stderr, "Number of streams must be between 1 and %d.\n", BLOCK_MAX_STREAMS);
+                    return 1;
+                }
+                break;
+            case 'K':
+                options.checksums = false;
+                break;
+            case 'W':
+                options.words = true;
+                break;
+            case 'C':
+                if (strcmp(optarg, "ans") == 0 || strcmp(optarg, "huffman") == 0)
+                {
+                    options.ans = strcmp(optarg, "ans") == 0;
+                }
+                else
+                {
+                    fprintf(stderr, "--coder must be huffman or ans.\n");
+                    return 1;
+                }
+                break;
+            case 'R':
+                if (parse_range(optarg, &range_offset, &range_length) != 0)
+                {
+                    fprintf(stderr, "Range must be <offset>:<length>.\n");
+                    return 1;
+                }
+                range = true;
+                break;
+            case 'm':
+                if (num_models == MAX_MODELS)
+                {
+                    fprintf(stderr, "At most %d models can be given.\n", MAX_MODELS);
+                    return 1;
+                }
+                model_names[num_models] = optarg;
+                num_models++;
+                break;
+            case 'a':
+                options.adaptive = true;
+                break;
+            case 'A':
+                append_name = optarg;
+                break;
+            case 'S':
+                if (optarg == NULL)
+                {
+                    stats_format = STATS_TEXT;
+                }
+                else if (strcmp(optarg, "json") == 0)
+                {
+                    stats_format = STATS_JSON;
+                }
+                else
+                {
+                    fprintf(stderr, "--stats takes no value or =json.\n");
+                    return 1;
+                }
+                break;
+            case 'B':
+                batch = true;
+                batch_list_name = optarg;
+                break;
+            case 'r':
+                batch = true;
+                recursive = true;
+                break;
+            case 'M':
+                shared_model_name = optarg;
+                break;
+            case 'P':
+                codec_prefix = optarg;
+                break;
+            case 'o':
+                output_name = optarg;
+                break;
+            case 'h':
+                print_usage();
+                return 0;
+            default:
+                print_usage();
+                return 1;
+        }
+    }
+    int num_args = argc - optind;
 
-    // Generate the binary string encodings for each character in text file
-    set_huffman_encodings(ht);
-    printf("Huffman encodings:\n");
-    print_huffman_encodings(huffman_encodings, ascii_counts);
+    if (num_args >= 1 && strcmp(argv[optind], "train") == 0)
+    {
+        if (num_args < 2 || output_name == NULL)
+        {
+            fprintf(stderr, "Please enter at least one corpus file and a model file name with -o.\n");
+            return 1;
+        }
+        return run_train(&argv[optind + 1], num_args - 1, output_name, options.max_code_len);
+    }
+    if (num_args >= 1 && strcmp(argv[optind], "gen-codec") == 0)
+    {
+        if (num_args != 1 || num_models != 1)
+        {
+            fprintf(stderr, "Please enter one model with --model (and an output file with -o).\n");
+            return 1;
+        }
+        return run_gen_codec(model_names[0], output_name, codec_prefix);
+    }
 
-    // Set file pointer back to start of file
-    fseek(fp, 0, SEEK_SET);
-    int max_len_binary_string = get_max_len_binary_string(huffman_encodings);
-    
-    // Encode text file
-    char* encoded_text = encode(fp, huffman_encodings, num_chars, max_len_binary_string);
-    printf("\nEncoded text: \n%s\n", encoded_text);
+    if (compress && decompress)
+    {
+        fprintf(stderr, "Choose one of -c and -d.\n");
+        return 1;
+    }
+    if (options.words && (options.order != 0 || options.adaptive))
+    {
+        fprintf(stderr, "--words can't be used with --order 1 or --adaptive.\n");
+        return 1;
+    }
+    if (options.ans && (options.order != 0 || options.adaptive || options.words || options.max_code_len > 0))
+    {
+        fprintf(stderr, "--coder=ans can't be used with --order 1, --adaptive, --words or --max-code-len.\n");
+        return 1;
+    }
+    if (append_name != NULL)
+    {
+        if (!compress || batch || range || options.adaptive || num_models > 0 || shared_model_name != NULL)
+        {
+            fprintf(stderr, "--append only works with -c, and not with --adaptive, --batch, --range or --model.\n");
+            return 1;
+        }
+        if (num_args > 1 || output_name != NULL)
+        {
+            fprintf(stderr, "Please enter at most an input file name: --append gives the output.\n");
+            return 1;
+        }
+        return run_append(num_args == 1 ? argv[optind] : "-", append_name, &options, stats_format);
+    }
+    if ((batch || shared_model_name != NULL) && !compress && !decompress)
+    {
+        fprintf(stderr, "--batch, -r and --shared-model need -c or -d.\n");
+        return 1;
+    }
+    if (batch)
+    {
+        if (range || options.adaptive)
+        {
+            fprintf(stderr, "--range and --adaptive can't be used with --batch.\n");
+            return 1;
+        }
+        if (shared_model_name != NULL && (decompress || num_models > 0))
+        {
+            fprintf(stderr, "--shared-model only works with -c, and not with --model.\n");
+            return 1;
+        }
+        BatchList list;
+        batch_list_init(&list);
+        bool listed = true;
+        for (int i = optind; i < argc; i++)
+        {
+            if (batch_list_add(&list, argv[i], recursive, compress) != 0)
+            {
+                listed = false;
+            }
+        }
+        // With no names on the command line, they are read one per line from stdin
+        if (batch_list_name == NULL && num_args == 0)
+        {
+            batch_list_name = "-";
+        }
+        if (batch_list_name != NULL)
+        {
+            FILE* list_file = open_stream(batch_list_name, "r");
+            if (list_file == NULL)
+            {
+                fprintf(stderr, "Could not open %s.\n", batch_list_name);
+                batch_list_free(&list);
+                return 1;
+            }
+            if (batch_list_read(&list, list_file, recursive, compress) != 0)
+            {
+                listed = false;
+            }
+            if (list_file != stdin)
+            {
+                fclose(list_file);
+            }
+        }
+        BatchOptions batch_options;
+        batch_options.compress = compress;
+        batch_options.stream = options;
+        batch_options.out_dir = output_name;
+        batch_options.shared_model = shared_model_name;
+        int result = run_batch(&list, &batch_options, model_names, num_models, stats_format);
+        batch_list_free(&list);
+        return listed ? result : 1;
+    }
+    if (shared_model_name != NULL)
+    {
+        fprintf(stderr, "--shared-model only works with --batch.\n");
+        return 1;
+    }
+    if (compress || decompress)
+    {
+        // Input and output default to stdin and stdout, so chuff can sit in a pipeline
+        if (num_args > 2 || (num_args == 2 && output_name != NULL))
+        {
+            fprintf(stderr, "Please enter at most an input and an output file name.\n");
+            return 1;
+        }
+        char* input_name = num_args >= 1 ? argv[optind] : "-";
+        if (num_args == 2)
+        {
+            output_name = argv[optind + 1];
+        }
+        else if (output_name == NULL)
+        {
+            output_name = "-";
+        }
+        // Compressed data on a terminal is just noise, and the terminal can't take it back
+        if (compress && strcmp(output_name, "-") == 0 && isatty(STDOUT_FILENO))
+        {
+            fprintf(stderr, "Refusing to write compressed data to a terminal. Use -o or redirect the output.\n");
+            return 1;
+        }
+        if (decompress && strcmp(input_name, "-") == 0 && isatty(STDIN_FILENO))
+        {
+            fprintf(stderr, "Refusing to read compressed data from a terminal. Give an input file or redirect the input.\n");
+            return 1;
+        }
+        if (range)
+        {
+            if (!decompress)
+            {
+                fprintf(stderr, "--range only works with -d.\n");
+                return 1;
+            }
+            return run_range(input_name, output_name, range_offset, range_length);
+        }
+        if (num_models > 0)
+        {
+            if (stats_format != STATS_NONE)
+            {
+                fprintf(stderr, "--stats can't be used with --model.\n");
+                return 1;
+            }
+            return run_model(compress, input_name, output_name, model_names, num_models);
+        }
+        return run_stream(compress, input_name, output_name, &options, stats_format);
+    }
 
-    // Decode text file
-    char* decoded_text = decode(encoded_text, huffman_encodings, max_len_binary_string);
-    printf("\nDecoded text: \n%s\n", decoded_text);
-    
-    // Close file
-    fseek(fp, 0, SEEK_SET);
-    fclose(fp);
-    return 0;
+    // Check if text file name provided
+    if (num_args < 1)
+    {
+        printf("Please enter a text file name.\n");
+        return 1;
+    }
+
+    // Check if too many arguments provided
+    if (num_args > 1)
+    {
+        printf("Too many arguments.\n");
+        return 1;
+    }
+
+    // With --stats, compress the file without printing codes or text and just report on it
+    if (stats_format != STATS_NONE)
+    {
+        return run_stream(true, argv[optind], "/dev/null", &options, stats_format);
+    }
+    return run_demo(argv[optind]);
 }
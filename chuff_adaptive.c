@@ -0,0 +1,292 @@
+// chuff_adaptive.c
+// Ben Crabtree, 2021
+
+# include <errno.h>
+# include <unistd.h>
+
+# include "chuff_adaptive.h"
+
+int adaptive_rebuild(AdaptiveCoder* coder)
+{
+    if (ht_build(&coder->tree, coder->counts, ADAPTIVE_NUM_SYMBOLS) != 0)
+    {
+        return -1;
+    }
+    memset(coder->code_lengths, 0, sizeof(coder->code_lengths));
+    int max_len = ht_get_code_lengths(&coder->tree, coder->code_lengths);
+    if (max_len > ADAPTIVE_MAX_CODE_LEN
+        && package_merge_lengths(coder->counts, ADAPTIVE_NUM_SYMBOLS, ADAPTIVE_MAX_CODE_LEN, coder->code_lengths) != 0)
+    {
+        return -1;
+    }
+    if (canonical_assign_codes(coder->code_lengths, coder->codes, ADAPTIVE_NUM_SYMBOLS) != 0)
+    {
+        return -1;
+    }
+    if (coder->decoding)
+    {
+        return dt_build(&coder->decode_table, coder->codes, ADAPTIVE_NUM_SYMBOLS);
+    }
+    return 0;
+}
+
+int adaptive_coder_init(AdaptiveCoder* coder, bool decoding)
+{
+    for (int i = 0; i < ADAPTIVE_NUM_SYMBOLS; i++)
+    {
+        coder->counts[i] = 1;
+    }
+    dt_init(&coder->decode_table);
+    ht_init(&coder->tree);
+    coder->interval = ADAPTIVE_FIRST_INTERVAL;
+    coder->until_rebuild = ADAPTIVE_FIRST_INTERVAL;
+    coder->decoding = decoding;
+    return adaptive_rebuild(coder);
+}
+
+void adaptive_coder_free(AdaptiveCoder* coder)
+{
+    dt_free(&coder->decode_table);
+    ht_free(&coder->tree);
+}
+
+int adaptive_update(AdaptiveCoder* coder, const uint8_t* src, size_t size)
+{
+    histogram_count(src, size, coder->counts);
+    coder->until_rebuild -= size;
+    if (coder->until_rebuild > 0)
+    {
+        return 0;
+    }
+
+    uint64_t total = 0;
+    for (int i = 0; i < ADAPTIVE_NUM_SYMBOLS; i++)
+    {
+        total += coder->counts[i];
+    }
+    if (total > ADAPTIVE_MAX_TOTAL)
+    {
+        // Rounding up keeps every count above 0, so every symbol keeps a code
+        for (int i = 0; i < ADAPTIVE_NUM_SYMBOLS; i++)
+        {
+            coder->counts[i] = (coder->counts[i] + 1) / 2;
+        }
+    }
+    if (coder->interval < ADAPTIVE_MAX_INTERVAL)
+    {
+        coder->interval *= 2;
+    }
+    coder->until_rebuild = coder->interval;
+    return adaptive_rebuild(coder);
+}
+
+/*
+Reads whatever input has arrived, up to a whole chunk, waiting only if there is none yet
+fread() would wait for the whole chunk, holding back a live feed until 64K of it had come in.
+The FILE must not have been read from through stdio, as anything it has buffered is skipped.
+Takes:
+- A pointer to the input FILE
+- A pointer to the buffer
+- The size of the buffer
+Returns:
+- The number of bytes read, 0 at the end of the input, or -1 on error
+*/
+long adaptive_read(FILE* in, uint8_t* buf, size_t size)
+{
+    int fd = fileno(in);
+    if (fd < 0)
+    {
+        size_t num_read = fread(buf, 1, size, in);
+        return ferror(in) ? -1 : (long)num_read;
+    }
+    while (true)
+    {
+        ssize_t num_read = read(fd, buf, size);
+        if (num_read >= 0)
+        {
+            return num_read;
+        }
+        if (errno != EINTR)
+        {
+            return -1;
+        }
+    }
+}
+
+int adaptive_compress(FILE* in, FILE* out, uint64_t* raw_bytes, uint64_t* comp_bytes)
+{
+    AdaptiveCoder coder;
+    if (adaptive_coder_init(&coder, false) != 0)
+    {
+        fprintf(stderr, "Could not build adaptive codes.\n");
+        return -1;
+    }
+    uint8_t* chunk = malloc(ADAPTIVE_CHUNK_SIZE);
+    // Room for a chunk of the longest codes plus the end of stream code
+    uint8_t* comp = malloc( bw_bytes_needed((uint64_t)(ADAPTIVE_CHUNK_SIZE + 1) * ADAPTIVE_MAX_CODE_LEN) );
+    uint8_t header[ADAPTIVE_HEADER_SIZE];
+    memcpy(header, ADAPTIVE_MAGIC, 4);
+    header[4] = ADAPTIVE_VERSION;
+    fwrite(header, 1, ADAPTIVE_HEADER_SIZE, out);
+    uint64_t num_read = 0;
+    uint64_t num_written = ADAPTIVE_HEADER_SIZE;
+    int result = 0;
+
+    BitWriter bw;
+    bw_init(&bw, comp);
+    long chunk_size;
+    while ( result == 0 && (chunk_size = adaptive_read(in, chunk, ADAPTIVE_CHUNK_SIZE)) > 0 )
+    {
+        size_t pos = 0;
+        while (pos < (size_t)chunk_size)
+        {
+            // Code up to the next rebuild with the current codes
+            size_t run = (size_t)chunk_size - pos < coder.until_rebuild ? (size_t)chunk_size - pos : coder.until_rebuild;
+            for (size_t i = pos; i < pos + run; i++)
+            {
+                bw_put_code(&bw, coder.codes[chunk[i]]);
+            }
+            if (adaptive_update(&coder, chunk + pos, run) != 0)
+            {
+                fprintf(stderr, "Could not rebuild adaptive codes.\n");
+                result = -1;
+                break;
+            }
+            pos += run;
+        }
+        num_read += chunk_size;
+
+        // Write out the whole words so far, keeping the partial word in the writer, and send them
+        // on now rather than when stdio's buffer fills, so a live feed's output keeps up with it
+        fwrite(comp, 1, bw.pos, out);
+        fflush(out);
+        num_written += bw.pos;
+        bw.pos = 0;
+    }
+    if (chunk_size < 0)
+    {
+        fprintf(stderr, "Could not read input.\n");
+        result = -1;
+    }
+    if (result == 0)
+    {
+        bw_put_code(&bw, coder.codes[ADAPTIVE_EOF]);
+        size_t size = bw_finish(&bw);
+        fwrite(comp, 1, size, out);
+        num_written += size;
+    }
+    if (raw_bytes != NULL)
+    {
+        *raw_bytes = num_read;
+    }
+    if (comp_bytes != NULL)
+    {
+        *comp_bytes = num_written;
+    }
+    free(chunk);
+    free(comp);
+    adaptive_coder_free(&coder);
+    return result;
+}
+
+int adaptive_decompress(FILE* in, FILE* out, uint64_t* raw_bytes, uint64_t* comp_bytes)
+{
+    uint64_t num_read = ADAPTIVE_HEADER_SIZE;
+    uint64_t num_written = 0;
+    uint8_t version;
+    if (fread(&version, 1, 1, in) != 1 || version != ADAPTIVE_VERSION)
+    {
+        fprintf(stderr, "Unsupported adaptive chuff stream.\n");
+        return -1;
+    }
+    AdaptiveCoder coder;
+    if (adaptive_coder_init(&coder, true) != 0)
+    {
+        fprintf(stderr, "Could not build adaptive codes.\n");
+        return -1;
+    }
+    uint8_t* comp = malloc(ADAPTIVE_CHUNK_SIZE);
+    uint8_t* chunk = malloc(ADAPTIVE_CHUNK_SIZE);
+    BitReader br;
+    br_init(&br, comp, 0);
+    bool end_of_input = false;
+    bool end_of_stream = false;
+    int result = 0;
+
+    while (!end_of_stream && result == 0)
+    {
+        size_t chunk_size = 0;
+        size_t run_start = 0;
+        while (chunk_size < ADAPTIVE_CHUNK_SIZE)
+        {
+            // Keep at least a word of real input ahead of the reader until the input runs out,
+            // as br_refill() pads with zeros past the end of what it has
+            if (!end_of_input && br.size - br.pos < sizeof(uint64_t))
+            {
+                size_t left = br.size - br.pos;
+                memmove(comp, comp + br.pos, left);
+                size_t chunk_read = fread(comp + left, 1, ADAPTIVE_CHUNK_SIZE - left, in);
+                end_of_input = chunk_read == 0;
+                num_read += chunk_read;
+                br.size = left + chunk_read;
+                br.pos = 0;
+            }
+            if (end_of_input && br.pos >= br.size + sizeof(uint64_t))
+            {
+                fprintf(stderr, "Stream is truncated.\n");
+                result = -1;
+                break;
+            }
+            br_refill(&br);
+            // Decode what the refill holds, stopping at the next rebuild
+            size_t run_end = run_start + coder.until_rebuild < ADAPTIVE_CHUNK_SIZE ? run_start + coder.until_rebuild : ADAPTIVE_CHUNK_SIZE;
+            while (br.count >= coder.decode_table.max_len && chunk_size < run_end)
+            {
+                uint32_t symbol = dt_decode_symbol(&coder.decode_table, &br);
+                if (symbol == ADAPTIVE_EOF)
+                {
+                    end_of_stream = true;
+                    break;
+                }
+                chunk[chunk_size] = (uint8_t)symbol;
+                chunk_size++;
+            }
+            if (end_of_stream)
+            {
+                break;
+            }
+            // Mirror the encoder's rebuilds, which happen after exactly the same bytes
+            if (chunk_size - run_start == coder.until_rebuild)
+            {
+                if (adaptive_update(&coder, chunk + run_start, chunk_size - run_start) != 0)
+                {
+                    result = -1;
+                    break;
+                }
+                run_start = chunk_size;
+            }
+        }
+        if (result == 0 && chunk_size > run_start)
+        {
+            result = adaptive_update(&coder, chunk + run_start, chunk_size - run_start);
+        }
+        if (fwrite(chunk, 1, chunk_size, out) != chunk_size)
+        {
+            fprintf(stderr, "Could not write output.\n");
+            result = -1;
+        }
+        num_written += chunk_size;
+    }
+    if (raw_bytes != NULL)
+    {
+        *raw_bytes = num_written;
+    }
+    if (comp_bytes != NULL)
+    {
+        *comp_bytes = num_read;
+    }
+    free(comp);
+    free(chunk);
+    adaptive_coder_free(&coder);
+    return result;
+}
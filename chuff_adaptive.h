@@ -0,0 +1,115 @@
+// chuff_adaptive.h
+// Ben Crabtree, 2021
+
+# ifndef CHUFF_ADAPTIVE_H
+# define CHUFF_ADAPTIVE_H
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdint.h>
+# include <string.h>
+
+# include "chuff_shared.h"
+# include "chuff_bitstream.h"
+# include "chuff_decode_table.h"
+# include "chuff_canonical.h"
+# include "chuff_histogram.h"
+# include "chuff_package_merge.h"
+# include "chuff_heap.h"
+# include "chuff_huffman_tree.h"
+
+# define ADAPTIVE_MAGIC "CHUA"
+# define ADAPTIVE_VERSION 1
+// Magic and version
+# define ADAPTIVE_HEADER_SIZE 5
+
+// Bytes and an end of stream symbol, which is how the decoder knows where the data stops
+# define ADAPTIVE_NUM_SYMBOLS (NUM_SYMBOLS + 1)
+# define ADAPTIVE_EOF NUM_SYMBOLS
+// Codes are rebuilt after this many bytes at first, then twice as many each time up to the max
+# define ADAPTIVE_FIRST_INTERVAL (1 << 10)
+# define ADAPTIVE_MAX_INTERVAL (1 << 16)
+// Counts are halved when their total goes over this, so the codes follow changes in the data
+# define ADAPTIVE_MAX_TOTAL (1 << 24)
+// Keeps the codes short enough for a small decode table and a bounded output buffer
+# define ADAPTIVE_MAX_CODE_LEN 16
+// Bytes read or written at a time
+# define ADAPTIVE_CHUNK_SIZE (1 << 16)
+
+/*
+Semi-adaptive code table shared by the encoder and decoder
+Both sides start with every symbol at count 1 and rebuild the codes from the counts of the
+bytes coded so far at the same points in the data, so no code table is ever sent
+and the input only has to be read once, from a pipe if need be.
+*/
+struct AdaptiveCoder
+{
+    uint64_t counts[ADAPTIVE_NUM_SYMBOLS];
+    int code_lengths[ADAPTIVE_NUM_SYMBOLS];
+    HuffCode codes[ADAPTIVE_NUM_SYMBOLS];
+    DecodeTable decode_table; // Only built when decoding
+    HTree tree;
+    uint64_t interval; // Bytes between the last rebuild and the next
+    uint64_t until_rebuild; // Bytes left before the next rebuild
+    bool decoding;
+};
+
+typedef struct AdaptiveCoder AdaptiveCoder;
+
+/*
+Initialises an AdaptiveCoder with the starting (flat) codes
+Takes:
+- A pointer to the AdaptiveCoder
+- true if it will be used to decode, so it needs a decode table
+Returns:
+- 0 on success, -1 if memory runs out
+*/
+int adaptive_coder_init(AdaptiveCoder* coder, bool decoding);
+
+/*
+Frees memory held by an AdaptiveCoder (but not the AdaptiveCoder itself)
+Takes:
+- A pointer to the AdaptiveCoder
+Returns:
+- Void
+*/
+void adaptive_coder_free(AdaptiveCoder* coder);
+
+/*
+Adds coded bytes to the counts, rebuilding the codes when the interval is up
+The bytes must not go past the next rebuild (at most until_rebuild bytes).
+Takes:
+- A pointer to the AdaptiveCoder
+- A pointer to the bytes just coded
+- The number of bytes
+Returns:
+- 0 on success, -1 if rebuilding fails
+*/
+int adaptive_update(AdaptiveCoder* coder, const uint8_t* src, size_t size);
+
+/*
+Compresses everything read from in in one pass, writing output as it goes
+Input is coded and flushed to out as soon as it arrives, however little of it there is.
+Takes:
+- A pointer to the input FILE (need not be seekable, and must not have been read from through stdio)
+- A pointer to the output FILE
+- A pointer to where to put the number of bytes read, or NULL
+- A pointer to where to put the number of bytes written, or NULL
+Returns:
+- 0 on success, -1 on error (after printing a message to stderr)
+*/
+int adaptive_compress(FILE* in, FILE* out, uint64_t* raw_bytes, uint64_t* comp_bytes);
+
+/*
+Decompresses an adaptive stream whose ADAPTIVE_MAGIC has already been read from in
+Takes:
+- A pointer to the input FILE, just after the magic
+- A pointer to the output FILE
+- A pointer to where to put the number of bytes written, or NULL
+- A pointer to where to put the number of bytes read (counting the magic), or NULL
+Returns:
+- 0 on success, -1 on error (after printing a message to stderr)
+*/
+int adaptive_decompress(FILE* in, FILE* out, uint64_t* raw_bytes, uint64_t* comp_bytes);
+
+# endif
@@ -0,0 +1,665 @@
+// chuff_ans.c
+// Ben Crabtree, 2021
+
+# include <math.h>
+
+# include "chuff_ans.h"
+
+AnsCoder* ans_coder_new()
+{
+    AnsCoder* ans = malloc( sizeof(AnsCoder) );
+    if (ans == NULL)
+    {
+        return NULL;
+    }
+    memset(ans, 0, sizeof(AnsCoder));
+    return ans;
+}
+
+void ans_coder_free(AnsCoder* ans)
+{
+    free(ans);
+}
+
+/*
+Gets the position of the highest set bit
+Takes:
+- A non-zero value
+Returns:
+- The bit number, 0 for the lowest
+*/
+int ans_high_bit(uint32_t value)
+{
+    return 31 - __builtin_clz(value);
+}
+
+/*
+Picks a table size for a block: big enough to give every symbol in use a state and to
+follow the counts closely, but no bigger than a small block can make use of
+Takes:
+- An array of NUM_SYMBOLS counts
+- The number of bytes counted
+Returns:
+- The table log, ANS_MIN_TABLE_LOG to ANS_MAX_TABLE_LOG
+*/
+int ans_choose_table_log(const uint64_t counts[], size_t total)
+{
+    int num_used = 0;
+    for (int i = 0; i < NUM_SYMBOLS; i++)
+    {
+        num_used += counts[i] > 0;
+    }
+    int table_log = ANS_MAX_TABLE_LOG;
+    // A table much bigger than the block only makes the header and starting states cost more
+    while (table_log > ANS_MIN_TABLE_LOG && ((size_t)1 << (table_log + 2)) > total)
+    {
+        table_log--;
+    }
+    while ((1 << table_log) < num_used)
+    {
+        table_log++;
+    }
+    return table_log;
+}
+
+/*
+Scales counts to normalised counts adding up to 2^table_log, every symbol in use getting at least 1
+Counts are rounded to the nearest, then the total is put right one step at a time, each step
+going to the symbol where it costs (or saves) the most bits for the block.
+Takes:
+- An array of NUM_SYMBOLS counts
+- The number of bytes counted
+- The table log
+- An array of NUM_SYMBOLS normalised counts to fill in
+Returns:
+- Void
+*/
+void ans_normalize(const uint64_t counts[], size_t total, int table_log, uint32_t norm[])
+{
+    uint64_t table_size = (uint64_t)1 << table_log;
+    uint64_t assigned = 0;
+    for (int i = 0; i < NUM_SYMBOLS; i++)
+    {
+        norm[i] = 0;
+        if (counts[i] > 0)
+        {
+            uint64_t scaled = (counts[i] * table_size + total / 2) / total;
+            norm[i] = scaled > 0 ? (uint32_t)scaled : 1;
+            assigned += norm[i];
+        }
+    }
+    // There are at least as many states as symbols, so some symbol always has more than 1 to give up
+    while (assigned > table_size)
+    {
+        int best = -1;
+        double best_cost = 0;
+        for (int i = 0; i < NUM_SYMBOLS; i++)
+        {
+            if (norm[i] > 1)
+            {
+                double cost = counts[i] * log2((double)norm[i] / (double)(norm[i] - 1));
+                if (best < 0 || cost < best_cost)
+                {
+                    best = i;
+                    best_cost = cost;
+                }
+            }
+        }
+        norm[best]--;
+        assigned--;
+    }
+    while (assigned < table_size)
+    {
+        int best = -1;
+        double best_gain = 0;
+        for (int i = 0; i < NUM_SYMBOLS; i++)
+        {
+            if (norm[i] > 0)
+            {
+                double gain = counts[i] * log2((double)(norm[i] + 1) / (double)norm[i]);
+                if (best < 0 || gain > best_gain)
+                {
+                    best = i;
+                    best_gain = gain;
+                }
+            }
+        }
+        norm[best]++;
+        assigned++;
+    }
+}
+
+/*
+Spreads the symbols over the table's states by their normalised counts
+Stepping by a little over half the table (an odd step, so every state is visited once)
+scatters each symbol's states, which keeps the bits each one costs close to its share.
+Takes:
+- A pointer to the AnsCoder with table_log and norm set
+Returns:
+- Void
+*/
+void ans_spread_symbols(AnsCoder* ans)
+{
+    uint32_t table_size = 1u << ans->table_log;
+    uint32_t mask = table_size - 1;
+    uint32_t step = (table_size >> 1) + (table_size >> 3) + 3;
+    uint32_t pos = 0;
+    for (int s = 0; s < NUM_SYMBOLS; s++)
+    {
+        for (uint32_t i = 0; i < ans->norm[s]; i++)
+        {
+            ans->spread[pos] = (uint8_t)s;
+            pos = (pos + step) & mask;
+        }
+    }
+}
+
+/*
+Builds the encoder's state table and per-symbol transforms from the spread symbols
+Takes:
+- A pointer to the AnsCoder with table_log, norm and spread set
+Returns:
+- Void
+*/
+void ans_build_encode_table(AnsCoder* ans)
+{
+    int table_log = ans->table_log;
+    uint32_t table_size = 1u << table_log;
+    uint32_t cumul[NUM_SYMBOLS];
+    uint32_t total = 0;
+    for (int s = 0; s < NUM_SYMBOLS; s++)
+    {
+        cumul[s] = total;
+        total += ans->norm[s];
+    }
+    uint32_t next[NUM_SYMBOLS];
+    memcpy(next, cumul, sizeof(next));
+    for (uint32_t u = 0; u < table_size; u++)
+    {
+        ans->state_table[next[ans->spread[u]]++] = (uint16_t)(table_size + u);
+    }
+    for (int s = 0; s < NUM_SYMBOLS; s++)
+    {
+        uint32_t norm = ans->norm[s];
+        if (norm == 0)
+        {
+            continue;
+        }
+        if (norm == 1)
+        {
+            // Every state writes all table_log bits and lands on the symbol's one state
+            ans->symbols[s].delta_nb_bits = ((uint32_t)table_log << 16) - table_size;
+            ans->symbols[s].delta_find_state = (int32_t)cumul[s] - 1;
+        }
+        else
+        {
+            // States from norm << max_bits_out up write max_bits_out bits, those below one fewer
+            uint32_t max_bits_out = table_log - ans_high_bit(norm - 1);
+            uint32_t min_state_plus = norm << max_bits_out;
+            ans->symbols[s].delta_nb_bits = (max_bits_out << 16) - min_state_plus;
+            ans->symbols[s].delta_find_state = (int32_t)cumul[s] - (int32_t)norm;
+        }
+    }
+}
+
+/*
+Builds the decode table from the spread symbols
+Takes:
+- A pointer to the AnsCoder with table_log, norm and spread set
+Returns:
+- Void
+*/
+void ans_build_decode_table(AnsCoder* ans)
+{
+    int table_log = ans->table_log;
+    uint32_t table_size = 1u << table_log;
+    uint32_t next[NUM_SYMBOLS];
+    memcpy(next, ans->norm, sizeof(next));
+    ans->max_nb_bits = 1;
+    for (uint32_t u = 0; u < table_size; u++)
+    {
+        uint8_t s = ans->spread[u];
+        uint32_t x = next[s]++;
+        int nb_bits = table_log - ans_high_bit(x);
+        ans->max_nb_bits = nb_bits > ans->max_nb_bits ? nb_bits : ans->max_nb_bits;
+        ans->decode_table[u].symbol = s;
+        ans->decode_table[u].nb_bits = (uint8_t)nb_bits;
+        ans->decode_table[u].new_state = (uint16_t)((x << nb_bits) - table_size);
+    }
+}
+
+/*
+Gets the size of the header describing an AnsCoder's normalised counts
+Takes:
+- A pointer to the AnsCoder
+Returns:
+- The header size in bytes
+*/
+size_t ans_header_size(const AnsCoder* ans)
+{
+    int n = NUM_SYMBOLS;
+    while (n > 0 && ans->norm[n - 1] == 0)
+    {
+        n--;
+    }
+    return ANS_HEADER_FIXED_SIZE + 2 * n;
+}
+
+/*
+Writes the table log and normalised counts
+Takes:
+- A pointer to the AnsCoder
+- A pointer to a buffer of at least ans_header_size() bytes
+Returns:
+- The number of bytes written
+*/
+size_t ans_write_header(const AnsCoder* ans, uint8_t* header)
+{
+    size_t header_size = ans_header_size(ans);
+    int n = (header_size - ANS_HEADER_FIXED_SIZE) / 2;
+    header[0] = (uint8_t)ans->table_log;
+    header[1] = (uint8_t)(n >> 8);
+    header[2] = (uint8_t)n;
+    for (int i = 0; i < n; i++)
+    {
+        header[ANS_HEADER_FIXED_SIZE + 2 * i] = (uint8_t)(ans->norm[i] >> 8);
+        header[ANS_HEADER_FIXED_SIZE + 2 * i + 1] = (uint8_t)ans->norm[i];
+    }
+    return header_size;
+}
+
+/*
+Reads the table log and normalised counts written by ans_write_header()
+Takes:
+- A pointer to the AnsCoder to fill in
+- A pointer to the header
+- The number of bytes available
+Returns:
+- The header size in bytes, or -1 if it is truncated or the counts don't add up to the table size
+*/
+long ans_read_header(AnsCoder* ans, const uint8_t* header, size_t size)
+{
+    if (size < ANS_HEADER_FIXED_SIZE)
+    {
+        return -1;
+    }
+    int table_log = header[0];
+    int n = header[1] << 8 | header[2];
+    if (table_log < ANS_MIN_TABLE_LOG || table_log > ANS_MAX_TABLE_LOG || n > NUM_SYMBOLS
+        || size - ANS_HEADER_FIXED_SIZE < (size_t)(2 * n))
+    {
+        return -1;
+    }
+    ans->table_log = table_log;
+    uint32_t total = 0;
+    for (int i = 0; i < NUM_SYMBOLS; i++)
+    {
+        ans->norm[i] = i < n ? (uint32_t)(header[ANS_HEADER_FIXED_SIZE + 2 * i] << 8 | header[ANS_HEADER_FIXED_SIZE + 2 * i + 1]) : 0;
+        total += ans->norm[i];
+    }
+    if (total != 1u << table_log)
+    {
+        return -1;
+    }
+    return ANS_HEADER_FIXED_SIZE + 2 * n;
+}
+
+/*
+Encodes a segment backwards into the space just before end, as one stream
+Bits are collected in a 64-bit accumulator with each symbol's bits above the ones before,
+and written out 4 bytes at a time from end downwards, so the stream reads forwards in the
+order the decoder needs. The final state and a 1 bit marking where the stream starts go last.
+Takes:
+- A pointer to the AnsCoder with its encode table built
+- A pointer to the segment
+- The size of the segment
+- A pointer to the lowest byte the stream may be written to
+- A pointer just after where the stream goes
+Returns:
+- A pointer to the start of the stream, or NULL if it would go below limit
+*/
+uint8_t* ans_encode_segment(const AnsCoder* ans, const uint8_t* src, size_t size, uint8_t* limit, uint8_t* end)
+{
+    const AnsSymbol* symbols = ans->symbols;
+    const uint16_t* state_table = ans->state_table;
+    uint32_t state = 1u << ans->table_log;
+    uint64_t acc = 0;
+    int count = 0;
+    uint8_t* pos = end;
+    for (size_t i = size; i > 0; i--)
+    {
+        AnsSymbol symbol = symbols[src[i - 1]];
+        uint32_t nb_bits = (state + symbol.delta_nb_bits) >> 16;
+        acc |= (uint64_t)(state & ((1u << nb_bits) - 1)) << count;
+        count += nb_bits;
+        state = state_table[(state >> nb_bits) + symbol.delta_find_state];
+        if (count >= 32)
+        {
+            if (pos - limit < 4)
+            {
+                return NULL;
+            }
+            pos -= 4;
+            put_u32(pos, (uint32_t)acc);
+            acc >>= 32;
+            count -= 32;
+        }
+    }
+    // The starting state for the decoder, then the marker bit above it
+    acc |= (uint64_t)(state - (1u << ans->table_log)) << count;
+    count += ans->table_log;
+    acc |= (uint64_t)1 << count;
+    count++;
+    while (count > 0)
+    {
+        if (pos == limit)
+        {
+            return NULL;
+        }
+        pos--;
+        *pos = (uint8_t)acc;
+        acc >>= 8;
+        count -= 8;
+    }
+    return pos;
+}
+
+long ans_compress(BlockCoder* coder, const uint8_t* src, size_t src_size, uint8_t* body, size_t body_cap)
+{
+    AnsCoder* ans = coder->ans_coder;
+    uint64_t start = get_time_ns();
+    memset(coder->counts, 0, sizeof(coder->counts));
+    histogram_count(src, src_size, coder->counts);
+    uint64_t counted = get_time_ns();
+    coder->phase_ns[PHASE_COUNT] += counted - start;
+    ans->table_log = ans_choose_table_log(coder->counts, src_size);
+    ans_normalize(coder->counts, src_size, ans->table_log, ans->norm);
+    ans_spread_symbols(ans);
+    ans_build_encode_table(ans);
+    uint64_t built = get_time_ns();
+    coder->phase_ns[PHASE_CODES] += built - counted;
+
+    int num_streams = coder->num_streams;
+    size_t header_size = ans_header_size(ans);
+    size_t jump_size = (num_streams - 1) * BLOCK_JUMP_ENTRY_SIZE;
+    if (header_size + jump_size > body_cap)
+    {
+        return -1;
+    }
+    ans_write_header(ans, body);
+    uint8_t* payload = body + header_size;
+    uint8_t* end = body + body_cap;
+    size_t segment_size = block_segment_size(src_size, num_streams);
+    size_t payload_size = jump_size;
+    for (int s = 0; s < num_streams; s++)
+    {
+        size_t seg_start = s * segment_size < src_size ? s * segment_size : src_size;
+        size_t seg_end = seg_start + segment_size < src_size ? seg_start + segment_size : src_size;
+        // Each stream is written at the end of the free space, then moved down after the one before
+        uint8_t* stream = ans_encode_segment(ans, src + seg_start, seg_end - seg_start, payload + payload_size, end);
+        if (stream == NULL)
+        {
+            return -1;
+        }
+        size_t stream_size = end - stream;
+        memmove(payload + payload_size, stream, stream_size);
+        if (s < num_streams - 1)
+        {
+            put_u32(payload + s * BLOCK_JUMP_ENTRY_SIZE, (uint32_t)stream_size);
+        }
+        payload_size += stream_size;
+    }
+    // There's no code length limit to lose to, so both sums get the same bits
+    coder->payload_bits += (uint64_t)(payload_size - jump_size) * 8;
+    coder->unlimited_bits += (uint64_t)(payload_size - jump_size) * 8;
+    coder->phase_ns[PHASE_ENCODE] += get_time_ns() - built;
+    return header_size + payload_size;
+}
+
+/*
+Starts decoding a stream: skips the 0 bits up to the marker bit, then reads the starting state
+Takes:
+- A pointer to the BitReader at the start of the stream
+- The table log
+- A pointer to the state to set
+Returns:
+- 0 on success, -1 if the stream is empty or starts with a 0 byte
+*/
+int ans_open_stream(BitReader* br, int table_log, uint32_t* state)
+{
+    if (br->size == 0 || br->buf[0] == 0)
+    {
+        return -1;
+    }
+    br_refill(br);
+    br_consume(br, __builtin_clz((uint32_t)br->buf[0]) - 24 + 1);
+    *state = (uint32_t)br_peek(br, table_log);
+    br_consume(br, table_log);
+    return 0;
+}
+
+/*
+Decodes bytes from one stream
+Takes:
+- A pointer to the AnsCoder with its decode table built
+- A pointer to the BitReader
+- A pointer to the stream's state
+- A pointer to the destination buffer
+- The number of bytes to decode
+Returns:
+- Void
+*/
+void ans_decode_run(const AnsCoder* ans, BitReader* br, uint32_t* state, uint8_t* dst, size_t size)
+{
+    const AnsDecodeEntry* table = ans->decode_table;
+    uint32_t x = *state;
+    // A refill always leaves at least 57 bits, enough for this many states (more when no state reads table_log bits)
+    size_t per_refill = 57 / ans->max_nb_bits;
+    size_t num_decoded = 0;
+    while (size - num_decoded >= per_refill)
+    {
+        br_refill(br);
+        for (size_t k = 0; k < per_refill; k++)
+        {
+            dst[num_decoded] = ans_decode_symbol(table, &x, br);
+            num_decoded++;
+        }
+    }
+    br_refill(br);
+    for ( ; num_decoded < size; num_decoded++)
+    {
+        dst[num_decoded] = ans_decode_symbol(table, &x, br);
+    }
+    *state = x;
+}
+
+/*
+Gets how many times a marked window can be refilled from a buffer before it nears the end
+Each refill moves on at most 7 bytes, and reads 8.
+Takes:
+- A pointer to the next byte to load
+- A pointer to the end of the buffer
+Returns:
+- The number of refills
+*/
+size_t ans_fast_refills(const uint8_t* next, const uint8_t* end)
+{
+    return next + sizeof(uint64_t) <= end ? (size_t)(end - next - sizeof(uint64_t)) / 7 + 1 : 0;
+}
+
+/*
+Turns a BitReader's window into a marked window: its valid bits, then a 1 bit, then 0s
+The marker moves up as bits are consumed, so the number of valid bits is always 63 minus the
+number of trailing 0s, and decoding needn't keep a count in a register for every stream.
+Takes:
+- A pointer to the BitReader (count must be under 64)
+Returns:
+- The marked window
+*/
+uint64_t ans_mark_window(const BitReader* br)
+{
+    uint64_t marker = (uint64_t)1 << (63 - br->count);
+    return (br->acc & ~(marker - 1) & ~marker) | marker;
+}
+
+/*
+Puts a marked window back into a BitReader
+Takes:
+- A pointer to the BitReader
+- The marked window
+- A pointer to the next byte to load
+Returns:
+- Void
+*/
+void ans_unmark_window(BitReader* br, uint64_t window, const uint8_t* next)
+{
+    br->count = 63 - __builtin_ctzll(window);
+    br->acc = window & (window - 1);
+    br->pos = next - br->buf;
+}
+
+/*
+Decodes the same number of bytes from four streams side by side, as block_decode_4() does for Huffman codes
+While every stream has 8 bytes left to load, each keeps a marked window (see ans_mark_window())
+refilled without branches, which leaves few enough values for all four streams to stay in registers.
+Takes:
+- A pointer to the AnsCoder with its decode table built
+- An array of four BitReaders
+- An array of four states
+- An array of four destination pointers
+- The number of bytes to decode from each stream
+Returns:
+- Void
+*/
+void ans_decode_4(const AnsCoder* ans, BitReader readers[], uint32_t states[], uint8_t* outs[], size_t size)
+{
+    const AnsDecodeEntry* table = ans->decode_table;
+    // A marked refill leaves at least 56 bits
+    size_t per_refill = 56 / ans->max_nb_bits;
+    size_t num_rounds = size / per_refill;
+    uint64_t w0 = ans_mark_window(&readers[0]);
+    uint64_t w1 = ans_mark_window(&readers[1]);
+    uint64_t w2 = ans_mark_window(&readers[2]);
+    uint64_t w3 = ans_mark_window(&readers[3]);
+    const uint8_t* next0 = readers[0].buf + readers[0].pos;
+    const uint8_t* next1 = readers[1].buf + readers[1].pos;
+    const uint8_t* next2 = readers[2].buf + readers[2].pos;
+    const uint8_t* next3 = readers[3].buf + readers[3].pos;
+    uint32_t x0 = states[0];
+    uint32_t x1 = states[1];
+    uint32_t x2 = states[2];
+    uint32_t x3 = states[3];
+    uint8_t* out0 = outs[0];
+    uint8_t* out1 = outs[1];
+    uint8_t* out2 = outs[2];
+    uint8_t* out3 = outs[3];
+    const uint8_t* end0 = readers[0].buf + readers[0].size;
+    const uint8_t* end1 = readers[1].buf + readers[1].size;
+    const uint8_t* end2 = readers[2].buf + readers[2].size;
+    const uint8_t* end3 = readers[3].buf + readers[3].size;
+    size_t num_decoded = 0;
+    // Most refills move on far less than 7 bytes, so work out again how many are safe after each run of them
+    while (num_rounds > 0)
+    {
+        size_t safe_rounds = num_rounds;
+        const uint8_t* nexts[4] = {next0, next1, next2, next3};
+        const uint8_t* ends[4] = {end0, end1, end2, end3};
+        for (int s = 0; s < 4; s++)
+        {
+            size_t refills = ans_fast_refills(nexts[s], ends[s]);
+            safe_rounds = refills < safe_rounds ? refills : safe_rounds;
+        }
+        if (safe_rounds == 0)
+        {
+            break;
+        }
+        for (size_t r = 0; r < safe_rounds; r++)
+        {
+            w0 = ans_refill_marked(w0, &next0);
+            w1 = ans_refill_marked(w1, &next1);
+            w2 = ans_refill_marked(w2, &next2);
+            w3 = ans_refill_marked(w3, &next3);
+            for (size_t k = 0; k < per_refill; k++)
+            {
+                out0[num_decoded] = ans_decode_marked(table, &x0, &w0);
+                out1[num_decoded] = ans_decode_marked(table, &x1, &w1);
+                out2[num_decoded] = ans_decode_marked(table, &x2, &w2);
+                out3[num_decoded] = ans_decode_marked(table, &x3, &w3);
+                num_decoded++;
+            }
+        }
+        num_rounds -= safe_rounds;
+    }
+    ans_unmark_window(&readers[0], w0, next0);
+    ans_unmark_window(&readers[1], w1, next1);
+    ans_unmark_window(&readers[2], w2, next2);
+    ans_unmark_window(&readers[3], w3, next3);
+    states[0] = x0;
+    states[1] = x1;
+    states[2] = x2;
+    states[3] = x3;
+    for (int s = 0; s < 4; s++)
+    {
+        ans_decode_run(ans, &readers[s], &states[s], outs[s] + num_decoded, size - num_decoded);
+    }
+}
+
+int ans_decompress(BlockCoder* coder, const uint8_t* body, size_t body_size, uint8_t* dst, size_t raw_size)
+{
+    AnsCoder* ans = coder->ans_coder;
+    uint64_t start = get_time_ns();
+    long header_size = ans_read_header(ans, body, body_size);
+    if (header_size < 0)
+    {
+        return -1;
+    }
+    ans_spread_symbols(ans);
+    ans_build_decode_table(ans);
+    uint64_t built = get_time_ns();
+    coder->phase_ns[PHASE_DECODE_TABLE] += built - start;
+
+    int num_streams = coder->num_streams;
+    BitReader readers[BLOCK_MAX_STREAMS];
+    uint32_t states[BLOCK_MAX_STREAMS];
+    if (block_open_streams(body + header_size, body_size - header_size, num_streams, readers) != 0)
+    {
+        return -1;
+    }
+    for (int s = 0; s < num_streams; s++)
+    {
+        if (ans_open_stream(&readers[s], ans->table_log, &states[s]) != 0)
+        {
+            return -1;
+        }
+    }
+    size_t segment_size = block_segment_size(raw_size, num_streams);
+    // Every segment is at least as long as the last, so all streams can be decoded side by side that far
+    size_t full_size = (num_streams - 1) * segment_size;
+    size_t last_size = raw_size > full_size ? raw_size - full_size : 0;
+    uint8_t* outs[BLOCK_MAX_STREAMS];
+    for (int s = 0; s < num_streams; s++)
+    {
+        outs[s] = dst + s * segment_size;
+    }
+    int s = 0;
+    for ( ; s + 4 <= num_streams; s += 4)
+    {
+        ans_decode_4(ans, &readers[s], &states[s], &outs[s], last_size);
+    }
+    for ( ; s < num_streams; s++)
+    {
+        ans_decode_run(ans, &readers[s], &states[s], outs[s], last_size);
+    }
+    // Then each stream finishes its own segment
+    for (s = 0; s < num_streams; s++)
+    {
+        size_t seg_start = s * segment_size < raw_size ? s * segment_size : raw_size;
+        size_t seg_end = seg_start + segment_size < raw_size ? seg_start + segment_size : raw_size;
+        if (seg_end - seg_start > last_size)
+        {
+            ans_decode_run(ans, &readers[s], &states[s], dst + seg_start + last_size, seg_end - seg_start - last_size);
+        }
+    }
+    coder->phase_ns[PHASE_DECODE] += get_time_ns() - built;
+    return 0;
+}
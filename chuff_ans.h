@@ -0,0 +1,179 @@
+// chuff_ans.h
+// Ben Crabtree, 2021
+
+# ifndef CHUFF_ANS_H
+# define CHUFF_ANS_H
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdint.h>
+# include <string.h>
+
+# include "chuff_shared.h"
+# include "chuff_bitstream.h"
+# include "chuff_block.h"
+
+// Biggest and smallest table a block can have (as the log2 of its number of states)
+# define ANS_MAX_TABLE_LOG 12
+# define ANS_MIN_TABLE_LOG 5
+# define ANS_MAX_TABLE_SIZE (1 << ANS_MAX_TABLE_LOG)
+// Table log byte and number of symbols (2 bytes big endian) at the start of an ANS header
+# define ANS_HEADER_FIXED_SIZE 3
+
+/*
+How to encode one symbol from any state (see ans_encode_segment())
+*/
+struct AnsSymbol
+{
+    int32_t delta_find_state; // Added to the shifted state to find the next state in state_table
+    uint32_t delta_nb_bits; // Added to the state, the top 16 bits are the number of bits to write
+};
+
+typedef struct AnsSymbol AnsSymbol;
+
+/*
+One decoder state: the symbol it gives, and how to get the next state
+*/
+struct AnsDecodeEntry
+{
+    uint16_t new_state; // Next state before the bits read are added
+    uint8_t symbol;
+    uint8_t nb_bits; // Bits to read for the next state
+};
+
+typedef struct AnsDecodeEntry AnsDecodeEntry;
+
+/*
+Table-driven asymmetric numeral system (tANS) coder for order-0 blocks
+The block's counts are scaled to normalised counts adding up to the table size, which are
+spread over the table's states. Each symbol then costs close to log2(table size / its count)
+bits, fractions of a bit included, where a Huffman code has to round every symbol up or down
+to a whole number of bits (a byte that is 90% of the input takes a whole bit with Huffman,
+about 0.15 bits here).
+
+An ANS block body is laid out as:
+- 1 byte table log L (ANS_MIN_TABLE_LOG to ANS_MAX_TABLE_LOG)
+- 2 bytes number of symbols n (big endian): all symbols from n on have a count of 0
+- n normalised counts (2 bytes each, big endian), adding up to 2^L
+- Payload, split into streams as for an order-0 block (see chuff_block.h)
+Symbols are encoded last first, so each stream is written from its end backwards. When read
+forwards it starts with 0 bits up to a 1 bit, then the L-bit starting state, then the bits
+each symbol reads for the next state, so decoding is a table lookup, a shift and an add per
+symbol with no branches.
+*/
+struct AnsCoder
+{
+    int table_log;
+    int max_nb_bits; // Most bits any decoder state reads, at least 1
+    uint32_t norm[NUM_SYMBOLS]; // Normalised counts, adding up to 2^table_log
+    AnsSymbol symbols[NUM_SYMBOLS];
+    uint16_t state_table[ANS_MAX_TABLE_SIZE]; // Encoder states (2^L to 2^(L+1) - 1) grouped by symbol
+    uint8_t spread[ANS_MAX_TABLE_SIZE]; // Symbol each decoder state gives
+    AnsDecodeEntry decode_table[ANS_MAX_TABLE_SIZE];
+};
+
+typedef struct AnsCoder AnsCoder;
+
+/*
+Allocates an AnsCoder
+Takes:
+- Nothing
+Returns:
+- A pointer to the new AnsCoder, or NULL if memory runs out
+*/
+AnsCoder* ans_coder_new();
+
+/*
+Frees an AnsCoder
+Takes:
+- A pointer to the AnsCoder (NULL is allowed)
+Returns:
+- Void
+*/
+void ans_coder_free(AnsCoder* ans);
+
+/*
+Decodes one symbol and moves to the next state
+Call br_refill() first so the bits for the next state are in the window.
+Takes:
+- A pointer to the decode table
+- A pointer to the state
+- A pointer to the BitReader
+Returns:
+- The symbol
+*/
+static inline uint8_t ans_decode_symbol(const AnsDecodeEntry* table, uint32_t* state, BitReader* br)
+{
+    AnsDecodeEntry entry = table[*state];
+    // Shifting by 1 then by 63 - n bits gets the top n bits, and nothing when n is 0
+    *state = entry.new_state + (uint32_t)((br->acc >> 1) >> (63 - entry.nb_bits));
+    br_consume(br, entry.nb_bits);
+    return entry.symbol;
+}
+
+/*
+Tops up a marked window to at least 56 valid bits with one 8-byte load, without checking for the end of the buffer
+Takes:
+- The marked window
+- A pointer to the pointer to the next byte to load, with at least 8 bytes left, moved on past the bytes used
+Returns:
+- The topped up marked window
+*/
+static inline uint64_t ans_refill_marked(uint64_t window, const uint8_t** next)
+{
+    int count = 63 - __builtin_ctzll(window);
+    uint64_t word;
+    memcpy(&word, *next, sizeof(word));
+    *next += (63 - count) >> 3;
+    int new_count = count | 56;
+    window = (window & (window - 1)) | (__builtin_bswap64(word) >> count);
+    // Keep the whole bytes loaded and put the marker just after them
+    return ((window >> (63 - new_count)) | 1) << (63 - new_count);
+}
+
+/*
+Decodes one symbol from a marked window and moves to the next state, as ans_decode_symbol() does for a BitReader
+Takes:
+- A pointer to the decode table
+- A pointer to the state
+- A pointer to the marked window
+Returns:
+- The symbol
+*/
+static inline uint8_t ans_decode_marked(const AnsDecodeEntry* table, uint32_t* state, uint64_t* window)
+{
+    AnsDecodeEntry entry = table[*state];
+    *state = entry.new_state + (uint32_t)((*window >> 1) >> (63 - entry.nb_bits));
+    *window <<= entry.nb_bits;
+    return entry.symbol;
+}
+
+/*
+Compresses one block's body (everything after the block header) with tANS,
+using the BlockCoder's AnsCoder and number of streams and adding to its stats
+block_compress() calls this and writes the block header and checksum around it.
+Takes:
+- A pointer to a BlockCoder with an AnsCoder
+- A pointer to the raw data
+- The size of the raw data (1 to UINT32_MAX bytes)
+- A pointer to where the body goes
+- The room left for the body
+Returns:
+- The body size in bytes, or -1 if there isn't room
+*/
+long ans_compress(BlockCoder* coder, const uint8_t* src, size_t src_size, uint8_t* body, size_t body_cap);
+
+/*
+Decompresses one block body written by ans_compress()
+Takes:
+- A pointer to a BlockCoder with an AnsCoder
+- A pointer to the body, just after the block header
+- The size of the body, not counting any checksum
+- A pointer to the destination buffer
+- The raw size of the block, from its header (dst must have room for it)
+Returns:
+- 0 on success, -1 if the body is malformed
+*/
+int ans_decompress(BlockCoder* coder, const uint8_t* body, size_t body_size, uint8_t* dst, size_t raw_size);
+
+# endif
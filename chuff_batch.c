@@ -0,0 +1,774 @@
+// chuff_batch.c
+// Ben Crabtree, 2021
+
+# include <dirent.h>
+# include <errno.h>
+# include <sys/stat.h>
+# include <sys/types.h>
+
+# include "chuff_batch.h"
+# include "chuff_histogram.h"
+# include "chuff_pool.h"
+# include "chuff_lib.h"
+
+// Size of the reads used to count bytes for a shared model
+# define BATCH_READ_CHUNK_SIZE (1 << 16)
+// Longest reason a worker can give for a file failing
+# define BATCH_ERROR_SIZE 96
+
+// What became of a file handed to a worker
+# define BATCH_DONE 0
+# define BATCH_FAILED 1
+// Too big (or not a regular file) to be coded whole, so left for the block pipeline
+# define BATCH_STREAM 2
+
+// Passes a batch can make over its files
+# define BATCH_COUNT 0
+# define BATCH_COMPRESS 1
+# define BATCH_DECOMPRESS 2
+
+/*
+A worker's own context and buffers, kept from one file to the next
+*/
+struct BatchWorker
+{
+    ChuffCtx* ctx;
+    uint8_t* src;
+    size_t src_cap;
+    uint8_t* dst;
+    size_t dst_cap;
+    uint64_t counts[NUM_SYMBOLS]; // Bytes counted for a shared model
+};
+
+typedef struct BatchWorker BatchWorker;
+
+struct BatchRun;
+
+/*
+A file making its way through the pool
+As in the stream pipeline, slots are reused in the order they were filled,
+so files finish (and are reported) in the order they were given.
+*/
+struct BatchSlot
+{
+    PoolJob job;
+    struct BatchRun* run;
+    const char* input_name;
+    char* output_name;
+    int status;
+    char error[BATCH_ERROR_SIZE]; // Why the file failed, if it did
+    uint64_t raw_size;
+    uint64_t comp_size;
+    bool in_flight;
+};
+
+typedef struct BatchSlot BatchSlot;
+
+struct BatchRun
+{
+    BatchOptions* options;
+    int pass;
+    ChuffModel* models; // The options' models, or the shared model once trained
+    int num_models;
+    ThreadPool* pool;
+    BatchWorker* workers;
+    int num_workers;
+    BatchSlot* slots;
+    int num_slots;
+};
+
+typedef struct BatchRun BatchRun;
+
+void batch_list_init(BatchList* list)
+{
+    list->names = NULL;
+    list->num_names = 0;
+    list->cap = 0;
+}
+
+void batch_list_free(BatchList* list)
+{
+    for (size_t i = 0; i < list->num_names; i++)
+    {
+        free(list->names[i]);
+    }
+    free(list->names);
+    batch_list_init(list);
+}
+
+void batch_list_push(BatchList* list, const char* name)
+{
+    if (list->num_names == list->cap)
+    {
+        list->cap = list->cap > 0 ? 2 * list->cap : 64;
+        list->names = realloc(list->names, list->cap * sizeof(char*));
+    }
+    list->names[list->num_names] = strdup(name);
+    list->num_names++;
+}
+
+/*
+Checks whether a file name ends in BATCH_SUFFIX (and has something before it)
+Takes:
+- The file name
+Returns:
+- True if it does
+*/
+bool batch_has_suffix(const char* name)
+{
+    size_t name_len = strlen(name);
+    size_t suffix_len = strlen(BATCH_SUFFIX);
+    return name_len > suffix_len && strcmp(name + name_len - suffix_len, BATCH_SUFFIX) == 0;
+}
+
+/*
+Adds every regular file under a directory that the batch would code, walking its subdirectories too
+Takes:
+- A pointer to the BatchList
+- The path of the directory
+- Whether the batch compresses (or decompresses)
+Returns:
+- 0 on success, -1 if the directory or any under it can't be read
+*/
+int batch_list_walk(BatchList* list, const char* dir_name, bool compress)
+{
+    DIR* dir = opendir(dir_name);
+    if (dir == NULL)
+    {
+        fprintf(stderr, "Could not read directory %s.\n", dir_name);
+        return -1;
+    }
+    int result = 0;
+    size_t dir_len = strlen(dir_name);
+    bool has_slash = dir_len > 0 && dir_name[dir_len - 1] == '/';
+    struct dirent* entry;
+    while ( (entry = readdir(dir)) != NULL )
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+        size_t path_size = dir_len + 1 + strlen(entry->d_name) + 1;
+        char* path = malloc(path_size);
+        snprintf(path, path_size, has_slash ? "%s%s" : "%s/%s", dir_name, entry->d_name);
+        // lstat() so a link back up the tree can't send the walk round in circles
+        struct stat st;
+        if (lstat(path, &st) != 0)
+        {
+            fprintf(stderr, "Could not read %s.\n", path);
+            result = -1;
+        }
+        else if (S_ISDIR(st.st_mode))
+        {
+            if (batch_list_walk(list, path, compress) != 0)
+            {
+                result = -1;
+            }
+        }
+        else if ((S_ISREG(st.st_mode) || (S_ISLNK(st.st_mode) && stat(path, &st) == 0 && S_ISREG(st.st_mode)))
+                 && batch_has_suffix(path) != compress)
+        {
+            batch_list_push(list, path);
+        }
+        free(path);
+    }
+    closedir(dir);
+    return result;
+}
+
+int batch_list_add(BatchList* list, const char* path, bool recursive, bool compress)
+{
+    struct stat st;
+    // Anything that can't be looked at is added anyway, and reported when it fails to open
+    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode))
+    {
+        if (!recursive)
+        {
+            fprintf(stderr, "%s is a directory (use -r to code the files in it).\n", path);
+            return -1;
+        }
+        return batch_list_walk(list, path, compress);
+    }
+    batch_list_push(list, path);
+    return 0;
+}
+
+int batch_list_read(BatchList* list, FILE* in, bool recursive, bool compress)
+{
+    int result = 0;
+    char* line = NULL;
+    size_t line_cap = 0;
+    ssize_t line_len;
+    while ( (line_len = getline(&line, &line_cap, in)) >= 0 )
+    {
+        while (line_len > 0 && (line[line_len - 1] == '\n' || line[line_len - 1] == '\r'))
+        {
+            line_len--;
+        }
+        line[line_len] = '\0';
+        if (line_len > 0 && batch_list_add(list, line, recursive, compress) != 0)
+        {
+            result = -1;
+        }
+    }
+    free(line);
+    return result;
+}
+
+/*
+Grows a buffer to hold at least size bytes, keeping it if it is already big enough
+Takes:
+- A pointer to the buffer pointer
+- A pointer to the buffer's capacity
+- The size needed
+Returns:
+- 0 on success, -1 if memory runs out
+*/
+int batch_reserve(uint8_t** buf, size_t* cap, size_t size)
+{
+    if (*buf != NULL && size <= *cap)
+    {
+        return 0;
+    }
+    size_t new_cap = size > 2 * *cap ? size : 2 * *cap;
+    uint8_t* new_buf = realloc(*buf, new_cap > 0 ? new_cap : 1);
+    if (new_buf == NULL)
+    {
+        return -1;
+    }
+    *buf = new_buf;
+    *cap = new_cap;
+    return 0;
+}
+
+/*
+Reads a whole file into a worker's src buffer
+Takes:
+- A pointer to the BatchWorker
+- A pointer to the BatchSlot naming the file
+- The biggest file to read
+- A pointer to where to put the file's size
+Returns:
+- BATCH_DONE, BATCH_STREAM if the file is bigger than max_size or not a regular file,
+  or BATCH_FAILED (with the slot's error set)
+*/
+int batch_read_file(BatchWorker* worker, BatchSlot* slot, size_t max_size, size_t* size)
+{
+    FILE* in = fopen(slot->input_name, "rb");
+    if (in == NULL)
+    {
+        snprintf(slot->error, BATCH_ERROR_SIZE, "could not open it");
+        return BATCH_FAILED;
+    }
+    struct stat st;
+    if (fstat(fileno(in), &st) != 0 || !S_ISREG(st.st_mode) || (uint64_t)st.st_size > max_size)
+    {
+        fclose(in);
+        return BATCH_STREAM;
+    }
+    if (batch_reserve(&worker->src, &worker->src_cap, st.st_size) != 0)
+    {
+        fclose(in);
+        snprintf(slot->error, BATCH_ERROR_SIZE, "out of memory");
+        return BATCH_FAILED;
+    }
+    *size = fread(worker->src, 1, st.st_size, in);
+    bool failed = ferror(in);
+    fclose(in);
+    if (failed)
+    {
+        snprintf(slot->error, BATCH_ERROR_SIZE, "could not read it");
+        return BATCH_FAILED;
+    }
+    return BATCH_DONE;
+}
+
+/*
+Writes a worker's output to the slot's output file, removing the file if the write fails
+Takes:
+- A pointer to the BatchSlot
+- A pointer to the bytes
+- The number of bytes
+Returns:
+- BATCH_DONE or BATCH_FAILED (with the slot's error set)
+*/
+int batch_write_file(BatchSlot* slot, const uint8_t* data, size_t size)
+{
+    FILE* out = fopen(slot->output_name, "wb");
+    if (out == NULL)
+    {
+        snprintf(slot->error, BATCH_ERROR_SIZE, "could not open %s", slot->output_name);
+        return BATCH_FAILED;
+    }
+    bool written = fwrite(data, 1, size, out) == size;
+    if (fclose(out) != 0 || !written)
+    {
+        remove(slot->output_name);
+        snprintf(slot->error, BATCH_ERROR_SIZE, "could not write %s", slot->output_name);
+        return BATCH_FAILED;
+    }
+    return BATCH_DONE;
+}
+
+void batch_count_job(void* arg, int worker_index)
+{
+    BatchSlot* slot = arg;
+    BatchWorker* worker = &slot->run->workers[worker_index];
+    // Files of any size are counted in chunks, so nothing is left for the block pipeline
+    FILE* in = fopen(slot->input_name, "rb");
+    if (in == NULL || batch_reserve(&worker->src, &worker->src_cap, BATCH_READ_CHUNK_SIZE) != 0)
+    {
+        if (in != NULL)
+        {
+            fclose(in);
+        }
+        slot->status = BATCH_FAILED;
+        return;
+    }
+    size_t num_read;
+    while ( (num_read = fread(worker->src, 1, worker->src_cap, in)) > 0 )
+    {
+        histogram_count(worker->src, num_read, worker->counts);
+        slot->raw_size += num_read;
+    }
+    slot->status = ferror(in) ? BATCH_FAILED : BATCH_DONE;
+    fclose(in);
+}
+
+void batch_compress_job(void* arg, int worker_index)
+{
+    BatchSlot* slot = arg;
+    BatchWorker* worker = &slot->run->workers[worker_index];
+    // A record has to be coded in one go, so with a model every file is read whole
+    size_t max_size = slot->run->num_models > 0 ? UINT32_MAX : BATCH_MAX_JOB_SIZE;
+    size_t raw_size;
+    slot->status = batch_read_file(worker, slot, max_size, &raw_size);
+    if (slot->status != BATCH_DONE)
+    {
+        return;
+    }
+    size_t bound = chuff_compress_bound(worker->ctx, raw_size);
+    if (batch_reserve(&worker->dst, &worker->dst_cap, bound) != 0)
+    {
+        snprintf(slot->error, BATCH_ERROR_SIZE, "out of memory");
+        slot->status = BATCH_FAILED;
+        return;
+    }
+    long comp_size = chuff_compress(worker->ctx, worker->src, raw_size, worker->dst, bound);
+    if (comp_size < 0)
+    {
+        snprintf(slot->error, BATCH_ERROR_SIZE, "could not compress it");
+        slot->status = BATCH_FAILED;
+        return;
+    }
+    slot->raw_size = raw_size;
+    slot->comp_size = comp_size;
+    slot->status = batch_write_file(slot, worker->dst, comp_size);
+}
+
+void batch_decompress_job(void* arg, int worker_index)
+{
+    BatchSlot* slot = arg;
+    BatchRun* run = slot->run;
+    BatchWorker* worker = &run->workers[worker_index];
+    size_t comp_size;
+    slot->status = batch_read_file(worker, slot, BATCH_MAX_JOB_SIZE, &comp_size);
+    if (slot->status != BATCH_DONE)
+    {
+        return;
+    }
+    // A file is a record if it names one of the models, otherwise it should be a chuff stream
+    ChuffModel* model = NULL;
+    uint32_t id;
+    if (run->num_models > 0 && chuff_record_model_id(worker->src, comp_size, &id) == 0)
+    {
+        for (int i = 0; i < run->num_models; i++)
+        {
+            if (run->models[i].id == id)
+            {
+                model = &run->models[i];
+            }
+        }
+    }
+    chuff_ctx_set_model(worker->ctx, model);
+    long raw_size = chuff_decompressed_size(worker->ctx, worker->src, comp_size);
+    if (raw_size < 0)
+    {
+        // Adaptive streams have no size up front; the block pipeline handles them and explains anything else
+        slot->status = BATCH_STREAM;
+        return;
+    }
+    if (batch_reserve(&worker->dst, &worker->dst_cap, raw_size) != 0)
+    {
+        snprintf(slot->error, BATCH_ERROR_SIZE, "out of memory");
+        slot->status = BATCH_FAILED;
+        return;
+    }
+    if (chuff_decompress(worker->ctx, worker->src, comp_size, worker->dst, raw_size) != raw_size)
+    {
+        snprintf(slot->error, BATCH_ERROR_SIZE, "it is corrupt or fails its checksum");
+        slot->status = BATCH_FAILED;
+        return;
+    }
+    slot->raw_size = raw_size;
+    slot->comp_size = comp_size;
+    slot->status = batch_write_file(slot, worker->dst, raw_size);
+}
+
+/*
+Codes one file through the block pipeline on the calling thread, for files too big to code whole
+Takes:
+- A pointer to the BatchRun
+- A pointer to the BatchSlot naming the file
+Returns:
+- 0 on success, -1 on error (after printing a message to stderr)
+*/
+int batch_stream_file(BatchRun* run, BatchSlot* slot)
+{
+    bool compress = run->pass == BATCH_COMPRESS;
+    FILE* in = fopen(slot->input_name, "rb");
+    if (in == NULL)
+    {
+        fprintf(stderr, "Could not open %s.\n", slot->input_name);
+        return -1;
+    }
+    FILE* out = fopen(slot->output_name, "wb");
+    if (out == NULL)
+    {
+        fprintf(stderr, "Could not open %s.\n", slot->output_name);
+        fclose(in);
+        return -1;
+    }
+    StreamStats stats;
+    StreamOptions* options = &run->options->stream;
+    int result = compress ? stream_compress(in, out, options, &stats) : stream_decompress(in, out, options, &stats);
+    if (fclose(out) != 0 && result == 0)
+    {
+        fprintf(stderr, "Could not write %s.\n", slot->output_name);
+        result = -1;
+    }
+    // The index after a stream's end marker isn't read when decompressing, so go by the file size
+    struct stat st;
+    slot->raw_size = stats.raw_bytes;
+    slot->comp_size = compress || fstat(fileno(in), &st) != 0 ? stats.comp_bytes : (uint64_t)st.st_size;
+    fclose(in);
+    if (result != 0)
+    {
+        remove(slot->output_name);
+    }
+    return result;
+}
+
+/*
+Waits for a slot's file to be done with and reports how it went
+Files left for the block pipeline are coded here and now.
+Takes:
+- A pointer to the BatchRun
+- A pointer to the BatchSlot
+- A pointer to the BatchStats to add to
+Returns:
+- Void
+*/
+void batch_finish_slot(BatchRun* run, BatchSlot* slot, BatchStats* stats)
+{
+    pool_wait_job(run->pool, &slot->job);
+    slot->in_flight = false;
+    if (run->pass == BATCH_COUNT)
+    {
+        // Files that can't be read now will fail again, and be reported, when they are compressed
+        return;
+    }
+    const char* verb = run->pass == BATCH_COMPRESS ? "compress" : "decompress";
+    int result = 0;
+    if (slot->status == BATCH_FAILED)
+    {
+        fprintf(stderr, "Could not %s %s: %s.\n", verb, slot->input_name, slot->error);
+        result = -1;
+    }
+    else if (slot->status == BATCH_STREAM && batch_stream_file(run, slot) != 0)
+    {
+        fprintf(stderr, "Could not %s %s.\n", verb, slot->input_name);
+        result = -1;
+    }
+    if (result == 0)
+    {
+        stats->num_files++;
+        stats->raw_bytes += slot->raw_size;
+        stats->comp_bytes += slot->comp_size;
+    }
+    else
+    {
+        stats->num_failed++;
+    }
+    free(slot->output_name);
+    slot->output_name = NULL;
+}
+
+/*
+Makes every directory leading up to a file, like mkdir -p on its parent
+Takes:
+- The path of the file
+Returns:
+- 0 on success, -1 if a directory can't be made
+*/
+int batch_make_parents(char* path)
+{
+    for (char* slash = strchr(path + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+    {
+        *slash = '\0';
+        int result = mkdir(path, 0777);
+        bool made = result == 0 || errno == EEXIST;
+        *slash = '/';
+        if (!made)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+Works out where a file's output goes: name.chuff when compressing, name without .chuff when decompressing,
+under out_dir if it is set
+Takes:
+- A pointer to the BatchRun
+- The input file name
+Returns:
+- The output file name (to be freed by the caller), or NULL if it has the wrong suffix
+  or its directory can't be made (after printing a message to stderr)
+*/
+char* batch_output_name(BatchRun* run, const char* input_name)
+{
+    size_t suffix_len = strlen(BATCH_SUFFIX);
+    bool has_suffix = batch_has_suffix(input_name);
+    bool compress = run->pass == BATCH_COMPRESS;
+    if (compress && has_suffix)
+    {
+        fprintf(stderr, "%s already ends in %s, skipping it.\n", input_name, BATCH_SUFFIX);
+        return NULL;
+    }
+    if (!compress && !has_suffix)
+    {
+        fprintf(stderr, "%s doesn't end in %s, skipping it.\n", input_name, BATCH_SUFFIX);
+        return NULL;
+    }
+    const char* out_dir = run->options->out_dir;
+    // Under out_dir the input's path is kept, without any leading / or ./ and ../ that would lead out of it
+    const char* rel_name = input_name;
+    while (out_dir != NULL)
+    {
+        if (rel_name[0] == '/')
+        {
+            rel_name++;
+        }
+        else if (strncmp(rel_name, "./", 2) == 0)
+        {
+            rel_name += 2;
+        }
+        else if (strncmp(rel_name, "../", 3) == 0)
+        {
+            rel_name += 3;
+        }
+        else
+        {
+            break;
+        }
+    }
+    size_t base_len = strlen(rel_name) - (compress ? 0 : suffix_len);
+    size_t output_size = (out_dir != NULL ? strlen(out_dir) + 1 : 0) + base_len + suffix_len + 1;
+    char* output_name = malloc(output_size);
+    snprintf(output_name, output_size, "%s%s%.*s%s", out_dir != NULL ? out_dir : "", out_dir != NULL ? "/" : "",
+             (int)base_len, rel_name, compress ? BATCH_SUFFIX : "");
+    if (out_dir != NULL && batch_make_parents(output_name) != 0)
+    {
+        fprintf(stderr, "Could not make the directory for %s.\n", output_name);
+        free(output_name);
+        return NULL;
+    }
+    return output_name;
+}
+
+/*
+Runs every file in the list through the pool once
+Takes:
+- A pointer to the BatchRun, with pass set
+- A pointer to the BatchList
+- A pointer to the BatchStats to add to
+Returns:
+- Void
+*/
+void batch_pass(BatchRun* run, BatchList* list, BatchStats* stats)
+{
+    void (*job_fn)(void*, int) = batch_count_job;
+    if (run->pass == BATCH_COMPRESS)
+    {
+        job_fn = batch_compress_job;
+    }
+    else if (run->pass == BATCH_DECOMPRESS)
+    {
+        job_fn = batch_decompress_job;
+    }
+    int next = 0;
+    for (size_t i = 0; i < list->num_names; i++)
+    {
+        BatchSlot* slot = &run->slots[next];
+        if (slot->in_flight)
+        {
+            batch_finish_slot(run, slot, stats);
+        }
+        slot->input_name = list->names[i];
+        if (run->pass != BATCH_COUNT)
+        {
+            slot->output_name = batch_output_name(run, slot->input_name);
+            if (slot->output_name == NULL)
+            {
+                // A file can only be named with the wrong suffix, it is never picked up that way from a directory
+                if (batch_has_suffix(slot->input_name) == (run->pass == BATCH_COMPRESS))
+                {
+                    stats->num_skipped++;
+                }
+                else
+                {
+                    stats->num_failed++;
+                }
+                continue;
+            }
+        }
+        slot->status = BATCH_DONE;
+        slot->error[0] = '\0';
+        slot->raw_size = 0;
+        slot->comp_size = 0;
+        slot->job.fn = job_fn;
+        slot->in_flight = true;
+        pool_submit(run->pool, &slot->job);
+        next = (next + 1) % run->num_slots;
+    }
+    // Finish the files still in flight, oldest first
+    for (int i = 0; i < run->num_slots; i++)
+    {
+        BatchSlot* slot = &run->slots[(next + i) % run->num_slots];
+        if (slot->in_flight)
+        {
+            batch_finish_slot(run, slot, stats);
+        }
+    }
+}
+
+/*
+Trains a model on every file in the batch and writes it to options->shared_model
+Takes:
+- A pointer to the BatchRun
+- A pointer to the BatchList
+- A pointer to the ChuffModel to train
+Returns:
+- 0 on success, -1 on error (after printing a message to stderr)
+*/
+int batch_train(BatchRun* run, BatchList* list, ChuffModel* model)
+{
+    BatchStats count_stats;
+    memset(&count_stats, 0, sizeof(BatchStats));
+    run->pass = BATCH_COUNT;
+    batch_pass(run, list, &count_stats);
+    uint64_t counts[NUM_SYMBOLS] = {0};
+    uint64_t num_bytes = 0;
+    for (int i = 0; i < run->num_workers; i++)
+    {
+        for (int j = 0; j < NUM_SYMBOLS; j++)
+        {
+            counts[j] += run->workers[i].counts[j];
+            num_bytes += run->workers[i].counts[j];
+        }
+    }
+    const char* model_name = run->options->shared_model;
+    FILE* out = model_train(model, counts, run->options->stream.max_code_len) == 0 ? fopen(model_name, "wb") : NULL;
+    bool written = out != NULL && model_write(model, out) == 0;
+    if (out != NULL && fclose(out) != 0)
+    {
+        written = false;
+    }
+    if (!written)
+    {
+        fprintf(stderr, "Could not write %s.\n", model_name);
+        return -1;
+    }
+    fprintf(stderr, "Trained model %08x on %llu bytes\n", model->id, (unsigned long long)num_bytes);
+    return 0;
+}
+
+int batch_run(BatchList* list, BatchOptions* options, BatchStats* stats)
+{
+    memset(stats, 0, sizeof(BatchStats));
+    BatchRun run;
+    run.options = options;
+    run.models = options->models;
+    run.num_models = options->num_models;
+    run.num_workers = options->stream.num_threads;
+    run.pool = pool_create(run.num_workers);
+    if (run.pool == NULL)
+    {
+        fprintf(stderr, "Could not start %d threads.\n", run.num_workers);
+        return -1;
+    }
+    run.workers = calloc(run.num_workers, sizeof(BatchWorker));
+    int result = 0;
+    for (int i = 0; i < run.num_workers; i++)
+    {
+        ChuffCtx* ctx = chuff_ctx_new();
+        run.workers[i].ctx = ctx;
+        if (ctx == NULL)
+        {
+            fprintf(stderr, "Out of memory.\n");
+            result = -1;
+            break;
+        }
+        chuff_ctx_set_block_size(ctx, options->stream.block_size);
+        chuff_ctx_set_order(ctx, options->stream.order);
+        chuff_ctx_set_streams(ctx, options->stream.num_streams);
+        chuff_ctx_set_max_code_len(ctx, options->stream.max_code_len);
+        chuff_ctx_set_checksums(ctx, options->stream.checksums);
+        chuff_ctx_set_words(ctx, options->stream.words);
+        chuff_ctx_set_coder(ctx, options->stream.ans ? CHUFF_CODER_ANS : CHUFF_CODER_HUFFMAN);
+    }
+    // Two slots per worker so the next file can be opened while every worker is busy
+    run.num_slots = 2 * run.num_workers;
+    run.slots = calloc(run.num_slots, sizeof(BatchSlot));
+    for (int i = 0; i < run.num_slots; i++)
+    {
+        run.slots[i].job.arg = &run.slots[i];
+        run.slots[i].run = &run;
+    }
+
+    ChuffModel shared_model;
+    model_init(&shared_model);
+    if (result == 0 && options->compress && options->shared_model != NULL)
+    {
+        result = batch_train(&run, list, &shared_model);
+        run.models = &shared_model;
+        run.num_models = 1;
+    }
+    if (result == 0)
+    {
+        for (int i = 0; i < run.num_workers; i++)
+        {
+            chuff_ctx_set_model(run.workers[i].ctx, options->compress && run.num_models > 0 ? &run.models[0] : NULL);
+        }
+        run.pass = options->compress ? BATCH_COMPRESS : BATCH_DECOMPRESS;
+        batch_pass(&run, list, stats);
+        if (stats->num_failed > 0)
+        {
+            result = -1;
+        }
+    }
+
+    pool_free(run.pool);
+    for (int i = 0; i < run.num_workers; i++)
+    {
+        chuff_ctx_free(run.workers[i].ctx);
+        free(run.workers[i].src);
+        free(run.workers[i].dst);
+    }
+    free(run.workers);
+    free(run.slots);
+    model_free(&shared_model);
+    return result;
+}
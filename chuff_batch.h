@@ -0,0 +1,126 @@
+// chuff_batch.h
+// Ben Crabtree, 2021
+
+# ifndef CHUFF_BATCH_H
+# define CHUFF_BATCH_H
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdbool.h>
+# include <stdint.h>
+# include <string.h>
+
+# include "chuff_shared.h"
+# include "chuff_stream.h"
+# include "chuff_model.h"
+
+// Added to each compressed file's name, and taken off again by decompression
+# define BATCH_SUFFIX ".chuff"
+// Files up to this size are coded whole by one worker, bigger ones are split into blocks across all of them
+# define BATCH_MAX_JOB_SIZE (4 << 20)
+
+/*
+The names of the files in a batch, in the order they were given
+*/
+struct BatchList
+{
+    char** names;
+    size_t num_names;
+    size_t cap;
+};
+
+typedef struct BatchList BatchList;
+
+/*
+Settings for a batch run
+*/
+struct BatchOptions
+{
+    bool compress; // Compress each file to name.chuff, or decompress name.chuff to name
+    StreamOptions stream; // Block format and number of threads
+    const char* out_dir; // Directory to write to (input paths are kept under it), or NULL to write next to each input
+    ChuffModel* models; // If any are given, files are coded as records: compression uses the first,
+    int num_models; // decompression whichever one each record names
+    const char* shared_model; // If set, a model is trained on the whole batch, written here and used for every file
+};
+
+typedef struct BatchOptions BatchOptions;
+
+/*
+Totals for a batch run
+*/
+struct BatchStats
+{
+    uint64_t num_files; // Files coded successfully
+    uint64_t num_failed;
+    uint64_t num_skipped; // Named files with the wrong suffix for the batch
+    uint64_t raw_bytes;
+    uint64_t comp_bytes;
+};
+
+typedef struct BatchStats BatchStats;
+
+/*
+Initialises an empty BatchList
+Takes:
+- A pointer to the BatchList
+Returns:
+- Void
+*/
+void batch_list_init(BatchList* list);
+
+/*
+Frees the names held by a BatchList (but not the BatchList itself)
+Takes:
+- A pointer to the BatchList
+Returns:
+- Void
+*/
+void batch_list_free(BatchList* list);
+
+/*
+Adds a file to a BatchList, or every file under a directory if recursive is set
+Directories are walked depth first, with the entries of each in the order readdir() gives them.
+Symbolic links to directories are not followed. Only files the batch would code are taken from
+a directory: ones not ending in .chuff to compress, ones ending in it to decompress.
+Takes:
+- A pointer to the BatchList
+- The path of the file or directory
+- Whether to walk directories
+- Whether the batch compresses (or decompresses)
+Returns:
+- 0 on success, -1 if the path is a directory and recursive is not set or it can't be read
+  (after printing a message to stderr)
+*/
+int batch_list_add(BatchList* list, const char* path, bool recursive, bool compress);
+
+/*
+Adds the paths listed one per line in a file (blank lines are skipped)
+Takes:
+- A pointer to the BatchList
+- A pointer to the FILE to read the list from
+- Whether to walk directories in the list
+- Whether the batch compresses (or decompresses)
+Returns:
+- 0 on success, -1 if any path could not be added (the rest are still added)
+*/
+int batch_list_read(BatchList* list, FILE* in, bool recursive, bool compress);
+
+/*
+Compresses or decompresses every file in a BatchList in one go
+Files are spread over a single pool of num_threads workers, each with its own ChuffCtx and
+buffers kept from one file to the next, so a small file costs little more than opening,
+reading and writing it. Files over BATCH_MAX_JOB_SIZE are run through the block pipeline one at
+a time instead (see stream_compress()), so their blocks are shared out between the workers.
+Output is the same as chuff -c or chuff -d would write for each file on its own.
+Failures are reported on stderr, in file order, and the rest of the batch carries on.
+Takes:
+- A pointer to the BatchList
+- A pointer to the BatchOptions
+- A pointer to BatchStats to fill in
+Returns:
+- 0 if every file was coded, -1 if any failed
+*/
+int batch_run(BatchList* list, BatchOptions* options, BatchStats* stats);
+
+# endif
@@ -0,0 +1,544 @@
+// chuff_bench.c
+// Ben Crabtree, 2021
+
+/*
+Benchmark driver (make bench)
+Times each stage of Huffman coding on its own, over generated corpora of several sizes
+and any real files given on the command line:
+- histogram: counting bytes (histogram_count)
+- tree: building the Huffman tree (ht_build)
+- codes: reducing the tree to code lengths and assigning canonical codes
+- encode: packing every byte's code
+- decode_table: building the decode table from the codes
+- decode: unpacking every byte again
+- compress / decompress: the whole block coder, set up as chuff -c sets it up by default
+  (checksums and block types, see stream_options_init()), in DEFAULT_BLOCK_SIZE blocks of
+  DEFAULT_NUM_STREAMS interleaved streams (or the number given with -n)
+Each stage is repeated until it has run for at least BENCH_MIN_SECONDS, and the mean is reported.
+Results go to stdout as CSV, one row per corpus, size and stage:
+corpus,size,stage,runs,seconds,mb_per_s,ns_per_symbol,ratio,peak_rss_kb
+ns_per_symbol is per input byte for every stage, so stages can be added up.
+ratio is the compressed size over the raw size with the block coder.
+*/
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdbool.h>
+# include <stdint.h>
+# include <string.h>
+# include <math.h>
+# include <time.h>
+# include <getopt.h>
+# include <sys/resource.h>
+
+# include "chuff_shared.h"
+# include "chuff_heap.h"
+# include "chuff_huffman_tree.h"
+# include "chuff_bitstream.h"
+# include "chuff_decode_table.h"
+# include "chuff_canonical.h"
+# include "chuff_histogram.h"
+# include "chuff_block.h"
+# include "chuff_stream.h"
+
+# define BENCH_MIN_SECONDS 0.2
+# define BENCH_DEFAULT_SIZES "1K,64K,1M,16M"
+# define BENCH_DEFAULT_CORPORA "uniform,zipf,text,binary"
+# define BENCH_MAX_SIZES 16
+// Distinct words in the generated text
+# define BENCH_VOCAB_SIZE 2000
+
+// Streams per block for the compress and decompress stages
+static int bench_num_streams = DEFAULT_NUM_STREAMS;
+
+/*
+Everything the stages work on for one corpus
+Each stage leaves what the next one needs, so they run in order once before timing.
+*/
+struct BenchCorpus
+{
+    const char* name;
+    uint8_t* data;
+    size_t size;
+    uint64_t counts[NUM_SYMBOLS];
+    HTree tree;
+    int code_lengths[NUM_SYMBOLS];
+    HuffCode codes[NUM_SYMBOLS];
+    uint8_t* encoded;
+    size_t encoded_size;
+    DecodeTable decode_table;
+    uint8_t* decoded;
+    BlockCoder coder;
+    uint8_t* comp;
+    size_t comp_size;
+    bool failed; // Set by a stage that couldn't finish, after saying why
+};
+
+typedef struct BenchCorpus BenchCorpus;
+
+typedef void (*BenchStage)(BenchCorpus* corpus);
+
+uint64_t rng_state = 0x9E3779B97F4A7C15ull;
+
+uint64_t rng_next()
+{
+    // xorshift64*, fixed seed so every run benchmarks the same data
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1Dull;
+}
+
+double rng_double()
+{
+    return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+Draws from a Zipf distribution over n ranks, given its cumulative weights
+*/
+int zipf_sample(double cdf[], int n)
+{
+    double u = rng_double() * cdf[n - 1];
+    int lo = 0;
+    int hi = n - 1;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (cdf[mid] < u)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+void zipf_init(double cdf[], int n, double s)
+{
+    double total = 0;
+    for (int i = 0; i < n; i++)
+    {
+        total += 1.0 / pow(i + 1, s);
+        cdf[i] = total;
+    }
+}
+
+void gen_uniform(uint8_t* data, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        data[i] = (uint8_t)(rng_next() >> 56);
+    }
+}
+
+void gen_zipf(uint8_t* data, size_t size)
+{
+    double cdf[NUM_SYMBOLS];
+    zipf_init(cdf, NUM_SYMBOLS, 1.1);
+    for (size_t i = 0; i < size; i++)
+    {
+        data[i] = (uint8_t)zipf_sample(cdf, NUM_SYMBOLS);
+    }
+}
+
+void gen_text(uint8_t* data, size_t size)
+{
+    // Made up words built from letters at English frequencies, used at Zipf frequencies
+    const char* letters = "eeeeeeeeeeeetttttttttaaaaaaaaooooooooiiiiiiinnnnnnnsssssshhhhhhrrrrrrddddlllluuummwwffggyyppbbvk";
+    size_t num_letters = strlen(letters);
+    char vocab[BENCH_VOCAB_SIZE][12];
+    for (int i = 0; i < BENCH_VOCAB_SIZE; i++)
+    {
+        int len = 1 + (int)(rng_next() % 3) + (int)(rng_next() % 3) + (int)(rng_next() % 5);
+        for (int j = 0; j < len; j++)
+        {
+            vocab[i][j] = letters[rng_next() % num_letters];
+        }
+        vocab[i][len] = '\0';
+    }
+    double* cdf = malloc( BENCH_VOCAB_SIZE * sizeof(double) );
+    zipf_init(cdf, BENCH_VOCAB_SIZE, 1.0);
+
+    size_t pos = 0;
+    bool sentence_start = true;
+    while (pos < size)
+    {
+        const char* word = vocab[zipf_sample(cdf, BENCH_VOCAB_SIZE)];
+        for (size_t j = 0; word[j] != '\0' && pos < size; j++)
+        {
+            char c = word[j];
+            data[pos++] = (j == 0 && sentence_start) ? c - 'a' + 'A' : c;
+        }
+        sentence_start = false;
+        uint64_t r = rng_next() % 100;
+        if (r < 6 && pos < size)
+        {
+            data[pos++] = r < 5 ? '.' : ',';
+            sentence_start = r < 5;
+        }
+        if (pos < size)
+        {
+            data[pos++] = (r == 99) ? '\n' : ' ';
+        }
+    }
+    free(cdf);
+}
+
+void gen_binary(uint8_t* data, size_t size)
+{
+    // 16 byte records: counter, small geometric value, flag, random tail (like a packed log)
+    uint32_t counter = 0;
+    uint8_t record[16];
+    for (size_t pos = 0; pos < size; pos += 16)
+    {
+        uint32_t small = 0;
+        while ((rng_next() & 3) != 0 && small < 1000)
+        {
+            small++;
+        }
+        uint64_t r = rng_next();
+        memcpy(record, &counter, 4);
+        memcpy(record + 4, &small, 4);
+        record[8] = (uint8_t)(r % 4);
+        record[9] = 0;
+        memcpy(record + 10, &r, 6);
+        counter++;
+        memcpy(data + pos, record, size - pos < 16 ? size - pos : 16);
+    }
+}
+
+void stage_histogram(BenchCorpus* corpus)
+{
+    memset(corpus->counts, 0, sizeof(corpus->counts));
+    histogram_count(corpus->data, corpus->size, corpus->counts);
+}
+
+void stage_tree(BenchCorpus* corpus)
+{
+    ht_build(&corpus->tree, corpus->counts, NUM_SYMBOLS);
+}
+
+void stage_codes(BenchCorpus* corpus)
+{
+    memset(corpus->code_lengths, 0, sizeof(corpus->code_lengths));
+    ht_get_code_lengths(&corpus->tree, corpus->code_lengths);
+    canonical_assign_codes(corpus->code_lengths, corpus->codes, NUM_SYMBOLS);
+}
+
+void stage_encode(BenchCorpus* corpus)
+{
+    BitWriter bw;
+    bw_init(&bw, corpus->encoded);
+    for (size_t i = 0; i < corpus->size; i++)
+    {
+        bw_put_code(&bw, corpus->codes[corpus->data[i]]);
+    }
+    corpus->encoded_size = bw_finish(&bw);
+}
+
+void stage_decode_table(BenchCorpus* corpus)
+{
+    dt_build(&corpus->decode_table, corpus->codes, NUM_SYMBOLS);
+}
+
+void stage_decode(BenchCorpus* corpus)
+{
+    BitReader br;
+    br_init(&br, corpus->encoded, corpus->encoded_size);
+    block_decode_run(&corpus->decode_table, &br, corpus->decoded, corpus->size);
+}
+
+void stage_compress(BenchCorpus* corpus)
+{
+    size_t comp_size = 0;
+    for (size_t pos = 0; pos < corpus->size; pos += DEFAULT_BLOCK_SIZE)
+    {
+        size_t raw_size = corpus->size - pos < DEFAULT_BLOCK_SIZE ? corpus->size - pos : DEFAULT_BLOCK_SIZE;
+        long block_size = block_compress(&corpus->coder, corpus->data + pos, raw_size, corpus->comp + comp_size, block_compress_bound(raw_size));
+        if (block_size < 0)
+        {
+            fprintf(stderr, "Could not compress %s at %zu bytes.\n", corpus->name, corpus->size);
+            corpus->failed = true;
+            return;
+        }
+        comp_size += block_size;
+    }
+    corpus->comp_size = comp_size;
+}
+
+void stage_decompress(BenchCorpus* corpus)
+{
+    size_t comp_pos = 0;
+    size_t raw_pos = 0;
+    while (comp_pos < corpus->comp_size)
+    {
+        long raw_size = block_decompress(&corpus->coder, corpus->comp + comp_pos, corpus->comp_size - comp_pos, corpus->decoded + raw_pos, corpus->size - raw_pos);
+        if (raw_size < 0)
+        {
+            fprintf(stderr, "Could not decompress %s at %zu bytes.\n", corpus->name, corpus->size);
+            corpus->failed = true;
+            return;
+        }
+        raw_pos += raw_size;
+        comp_pos += BLOCK_HEADER_SIZE + get_u32(corpus->comp + comp_pos + 4);
+    }
+}
+
+double get_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+long get_peak_rss_kb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+void run_stage(BenchCorpus* corpus, const char* stage_name, BenchStage stage)
+{
+    // After a stage fails the rest would time garbage, so they are skipped
+    if (corpus->failed)
+    {
+        return;
+    }
+    int runs = 0;
+    double start = get_seconds();
+    double elapsed;
+    do
+    {
+        stage(corpus);
+        if (corpus->failed)
+        {
+            return;
+        }
+        runs++;
+        elapsed = get_seconds() - start;
+    }
+    while (elapsed < BENCH_MIN_SECONDS);
+    double seconds = elapsed / runs;
+    printf("%s,%zu,%s,%d,%.9f,%.2f,%.4f,%.6f,%ld\n",
+        corpus->name, corpus->size, stage_name, runs, seconds,
+        corpus->size / seconds / 1e6, seconds * 1e9 / corpus->size,
+        (double)corpus->comp_size / corpus->size, get_peak_rss_kb());
+    fflush(stdout);
+}
+
+int bench_corpus(const char* name, uint8_t* data, size_t size)
+{
+    if (size == 0)
+    {
+        return 0;
+    }
+    BenchCorpus corpus;
+    memset(&corpus, 0, sizeof(BenchCorpus));
+    corpus.name = name;
+    corpus.data = data;
+    corpus.size = size;
+    ht_init(&corpus.tree);
+    dt_init(&corpus.decode_table);
+    // Time the block coder as chuff -c runs it
+    StreamOptions options;
+    stream_options_init(&options);
+    block_coder_init(&corpus.coder);
+    corpus.coder.checksums = options.checksums;
+    corpus.coder.block_types = options.block_types;
+    corpus.coder.num_streams = bench_num_streams;
+    // Size the encode buffer from the real codes rather than the worst case
+    stage_histogram(&corpus);
+    stage_tree(&corpus);
+    stage_codes(&corpus);
+    uint64_t num_bits = 0;
+    for (int i = 0; i < NUM_SYMBOLS; i++)
+    {
+        num_bits += corpus.counts[i] * corpus.codes[i].len;
+    }
+    corpus.encoded = malloc( bw_bytes_needed(num_bits) );
+    corpus.decoded = malloc(size);
+    corpus.comp = malloc( (size / DEFAULT_BLOCK_SIZE + 1) * block_compress_bound(DEFAULT_BLOCK_SIZE) );
+    if (corpus.encoded == NULL || corpus.decoded == NULL || corpus.comp == NULL)
+    {
+        fprintf(stderr, "Not enough memory to benchmark %s at %zu bytes.\n", name, size);
+        free(corpus.encoded);
+        free(corpus.decoded);
+        free(corpus.comp);
+        return -1;
+    }
+
+    // The compressed size is needed for every row, so work it out first
+    stage_compress(&corpus);
+    run_stage(&corpus, "histogram", stage_histogram);
+    run_stage(&corpus, "tree", stage_tree);
+    run_stage(&corpus, "codes", stage_codes);
+    run_stage(&corpus, "encode", stage_encode);
+    run_stage(&corpus, "decode_table", stage_decode_table);
+    run_stage(&corpus, "decode", stage_decode);
+    if (!corpus.failed && memcmp(corpus.decoded, data, size) != 0)
+    {
+        fprintf(stderr, "Decoded %s does not match at %zu bytes.\n", name, size);
+    }
+    run_stage(&corpus, "compress", stage_compress);
+    run_stage(&corpus, "decompress", stage_decompress);
+    if (!corpus.failed && memcmp(corpus.decoded, data, size) != 0)
+    {
+        fprintf(stderr, "Decompressed %s does not match at %zu bytes.\n", name, size);
+    }
+
+    ht_free(&corpus.tree);
+    dt_free(&corpus.decode_table);
+    block_coder_free(&corpus.coder);
+    free(corpus.encoded);
+    free(corpus.decoded);
+    free(corpus.comp);
+    return corpus.failed ? -1 : 0;
+}
+
+size_t parse_size(char* arg)
+{
+    char* end;
+    unsigned long long size = strtoull(arg, &end, 10);
+    switch (*end)
+    {
+        case 'K': case 'k': size <<= 10; end++; break;
+        case 'M': case 'm': size <<= 20; end++; break;
+        case 'G': case 'g': size <<= 30; end++; break;
+    }
+    return (end == arg || *end != '\0') ? 0 : size;
+}
+
+int bench_file(char* filename)
+{
+    FILE* fp = fopen(filename, "rb");
+    if (fp == NULL)
+    {
+        fprintf(stderr, "Could not open %s.\n", filename);
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    size_t size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    uint8_t* data = malloc(size > 0 ? size : 1);
+    size_t num_read = fread(data, 1, size, fp);
+    fclose(fp);
+    int result = bench_corpus(filename, data, num_read);
+    free(data);
+    return result;
+}
+
+void print_usage()
+{
+    printf("Usage: chuff_bench [-s sizes] [-g corpora] [-n streams] [files...]\n");
+    printf("  -s  Comma separated sizes with optional K, M or G suffix (default %s)\n", BENCH_DEFAULT_SIZES);
+    printf("  -g  Comma separated generated corpora: uniform, zipf, text, binary or none (default %s)\n", BENCH_DEFAULT_CORPORA);
+    printf("  -n  Interleaved streams per block for compress and decompress, 1 to %d (default %d)\n", BLOCK_MAX_STREAMS, DEFAULT_NUM_STREAMS);
+    printf("  Files given are benchmarked whole as well.\n");
+}
+
+int main(int argc, char* argv[])
+{
+    char sizes_arg[256] = BENCH_DEFAULT_SIZES;
+    char corpora_arg[256] = BENCH_DEFAULT_CORPORA;
+    int opt;
+    while ( (opt = getopt(argc, argv, "s:g:n:h")) != -1 )
+    {
+        switch (opt)
+        {
+            case 's':
+                snprintf(sizes_arg, sizeof(sizes_arg), "%s", optarg);
+                break;
+            case 'g':
+                snprintf(corpora_arg, sizeof(corpora_arg), "%s", optarg);
+                break;
+            case 'n':
+                bench_num_streams = atoi(optarg);
+                if (bench_num_streams < 1 || bench_num_streams > BLOCK_MAX_STREAMS)
+                {
+                    fprintf(stderr, "Number of streams must be between 1 and %d.\n", BLOCK_MAX_STREAMS);
+                    return 1;
+                }
+                break;
+            case 'h':
+                print_usage();
+                return 0;
+            default:
+                print_usage();
+                return 1;
+        }
+    }
+
+    size_t sizes[BENCH_MAX_SIZES];
+    int num_sizes = 0;
+    for (char* tok = strtok(sizes_arg, ","); tok != NULL && num_sizes < BENCH_MAX_SIZES; tok = strtok(NULL, ","))
+    {
+        sizes[num_sizes] = parse_size(tok);
+        if (sizes[num_sizes] == 0)
+        {
+            fprintf(stderr, "Bad size %s.\n", tok);
+            return 1;
+        }
+        num_sizes++;
+    }
+
+    printf("corpus,size,stage,runs,seconds,mb_per_s,ns_per_symbol,ratio,peak_rss_kb\n");
+    int result = 0;
+    for (char* tok = strtok(corpora_arg, ","); tok != NULL; tok = strtok(NULL, ","))
+    {
+        void (*generate)(uint8_t*, size_t) = NULL;
+        if (strcmp(tok, "uniform") == 0)
+        {
+            generate = gen_uniform;
+        }
+        else if (strcmp(tok, "zipf") == 0)
+        {
+            generate = gen_zipf;
+        }
+        else if (strcmp(tok, "text") == 0)
+        {
+            generate = gen_text;
+        }
+        else if (strcmp(tok, "binary") == 0)
+        {
+            generate = gen_binary;
+        }
+        else if (strcmp(tok, "none") == 0)
+        {
+            continue;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown corpus %s.\n", tok);
+            return 1;
+        }
+        for (int i = 0; i < num_sizes; i++)
+        {
+            uint8_t* data = malloc(sizes[i]);
+            if (data == NULL)
+            {
+                fprintf(stderr, "Not enough memory for %s at %zu bytes.\n", tok, sizes[i]);
+                result = 1;
+                continue;
+            }
+            generate(data, sizes[i]);
+            if (bench_corpus(tok, data, sizes[i]) != 0)
+            {
+                result = 1;
+            }
+            free(data);
+        }
+    }
+    for (int i = optind; i < argc; i++)
+    {
+        if (bench_file(argv[i]) != 0)
+        {
+            result = 1;
+        }
+    }
+    return result;
+}
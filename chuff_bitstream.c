@@ -0,0 +1,40 @@
+// chuff_bitstream.c
+// Ben Crabtree, 2021
+
+# include "chuff_bitstream.h"
+
+size_t bw_bytes_needed(uint64_t num_bits)
+{
+    return (size_t)((num_bits + 63) / 64) * sizeof(uint64_t);
+}
+
+void bw_init(BitWriter* bw, uint8_t* buf)
+{
+    bw->buf = buf;
+    bw->pos = 0;
+    bw->acc = 0;
+    bw->count = 0;
+}
+
+size_t bw_finish(BitWriter* bw)
+{
+    // Only copy out the bytes which actually hold bits
+    int num_bytes = (bw->count + 7) / 8;
+    for (int i = 0; i < num_bytes; i++)
+    {
+        bw->buf[bw->pos] = (uint8_t)(bw->acc >> (56 - 8 * i));
+        bw->pos++;
+    }
+    bw->acc = 0;
+    bw->count = 0;
+    return bw->pos;
+}
+
+void br_init(BitReader* br, const uint8_t* buf, size_t size)
+{
+    br->buf = buf;
+    br->size = size;
+    br->pos = 0;
+    br->acc = 0;
+    br->count = 0;
+}
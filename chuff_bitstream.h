@@ -0,0 +1,245 @@
+// chuff_bitstream.h
+// Ben Crabtree, 2021
+
+# ifndef CHUFF_BITSTREAM_H
+# define CHUFF_BITSTREAM_H
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdbool.h>
+# include <stdint.h>
+# include <string.h>
+
+/*
+A Huffman code for one symbol as an integer pair rather than a string of '0'/'1' chars.
+The code occupies the low len bits of bits, most significant bit first.
+*/
+struct HuffCode
+{
+    uint64_t bits;
+    int len; // 0 if the symbol does not occur
+};
+
+typedef struct HuffCode HuffCode;
+
+/*
+Packs codes into a byte buffer, most significant bit first.
+Bits are collected in a 64-bit accumulator and written out a whole word at a time.
+*/
+struct BitWriter
+{
+    uint8_t* buf;
+    size_t pos; // Number of bytes written to buf so far
+    uint64_t acc; // Pending bits, left aligned
+    int count; // Number of pending bits in acc (always < 64 between calls)
+};
+
+typedef struct BitWriter BitWriter;
+
+/*
+Reads bits back out of a buffer written by a BitWriter.
+Keeps a left aligned 64-bit window over the buffer. Reading past the end yields 0 bits.
+*/
+struct BitReader
+{
+    const uint8_t* buf;
+    size_t size; // Size of buf in bytes
+    size_t pos; // Next byte of buf to load into acc
+    uint64_t acc; // Window of upcoming bits, left aligned
+    int count; // Number of valid bits in acc
+};
+
+typedef struct BitReader BitReader;
+
+/*
+Gets the number of bytes a BitWriter needs to hold num_bits bits
+Rounded up to a whole number of 64-bit words, as the writer only flushes whole words until bw_finish()
+Takes:
+- The number of bits to be written
+Returns:
+- The buffer size in bytes
+*/
+size_t bw_bytes_needed(uint64_t num_bits);
+
+/*
+Initialises a BitWriter to write into buf from the start
+Takes:
+- A pointer to the BitWriter
+- A pointer to a buffer of at least bw_bytes_needed() bytes
+Returns:
+- Void
+*/
+void bw_init(BitWriter* bw, uint8_t* buf);
+
+/*
+Writes the 64-bit accumulator to the buffer as 8 big endian bytes and empties it
+Takes:
+- A pointer to the BitWriter
+Returns:
+- Void
+*/
+static inline void bw_flush_word(BitWriter* bw)
+{
+    uint64_t word = __builtin_bswap64(bw->acc);
+    memcpy(bw->buf + bw->pos, &word, sizeof(word));
+    bw->pos += sizeof(word);
+    bw->acc = 0;
+    bw->count = 0;
+}
+
+/*
+Appends the low len bits of bits to the stream
+Takes:
+- A pointer to the BitWriter
+- The bits to write (nothing above the low len bits may be set)
+- The number of bits, 1 to 64
+Returns:
+- Void
+*/
+static inline void bw_put_bits(BitWriter* bw, uint64_t bits, int len)
+{
+    int free_bits = 64 - bw->count;
+    if (len < free_bits)
+    {
+        bw->acc |= bits << (free_bits - len);
+        bw->count += len;
+        return;
+    }
+    // Fill up the accumulator, flush it and start the next word with what is left over
+    int rest = len - free_bits;
+    bw->acc |= bits >> rest;
+    bw_flush_word(bw);
+    if (rest > 0)
+    {
+        bw->acc = bits << (64 - rest);
+        bw->count = rest;
+    }
+}
+
+/*
+Appends a Huffman code to the stream
+Takes:
+- A pointer to the BitWriter
+- The code to write
+Returns:
+- Void
+*/
+static inline void bw_put_code(BitWriter* bw, HuffCode code)
+{
+    bw_put_bits(bw, code.bits, code.len);
+}
+
+/*
+Writes out any bits still pending in the accumulator, padding the last byte with 0s
+Takes:
+- A pointer to the BitWriter
+Returns:
+- The total number of bytes written to the buffer
+*/
+size_t bw_finish(BitWriter* bw);
+
+/*
+Initialises a BitReader to read from the start of buf
+Takes:
+- A pointer to the BitReader
+- A pointer to the buffer
+- The size of the buffer in bytes
+Returns:
+- Void
+*/
+void br_init(BitReader* br, const uint8_t* buf, size_t size);
+
+/*
+Tops up the window so it holds at least 57 bits
+Loads 8 bytes at a time while they are available, then falls back to single bytes at the end of the buffer
+Takes:
+- A pointer to the BitReader
+Returns:
+- Void
+*/
+static inline void br_refill(BitReader* br)
+{
+    if (br->count > 56)
+    {
+        return;
+    }
+    if (br->pos + sizeof(uint64_t) <= br->size)
+    {
+        uint64_t word;
+        memcpy(&word, br->buf + br->pos, sizeof(word));
+        br->acc |= __builtin_bswap64(word) >> br->count;
+        // Only count the whole bytes that fitted; the rest get loaded again next time
+        int num_bytes = (64 - br->count) >> 3;
+        br->pos += num_bytes;
+        br->count += num_bytes * 8;
+        return;
+    }
+    while (br->count <= 56)
+    {
+        uint64_t byte = br->pos < br->size ? br->buf[br->pos] : 0;
+        br->pos++;
+        br->acc |= byte << (56 - br->count);
+        br->count += 8;
+    }
+}
+
+/*
+Looks at the next n bits without consuming them
+Call br_refill() first so enough bits are available
+Takes:
+- A pointer to the BitReader
+- The number of bits, 1 to 57
+Returns:
+- The next n bits as an integer, first bit most significant
+*/
+static inline uint64_t br_peek(const BitReader* br, int n)
+{
+    return br->acc >> (64 - n);
+}
+
+/*
+Consumes n bits previously looked at with br_peek()
+Takes:
+- A pointer to the BitReader
+- The number of bits to consume
+Returns:
+- Void
+*/
+static inline void br_consume(BitReader* br, int n)
+{
+    br->acc <<= n;
+    br->count -= n;
+}
+
+/*
+Checks whether more bits have been consumed than the buffer holds
+br_refill() pads with 0s past the end, so decoding a truncated input doesn't fail by itself.
+Takes:
+- A pointer to the BitReader
+Returns:
+- true if any padding has been consumed
+*/
+static inline bool br_overrun(const BitReader* br)
+{
+    return (uint64_t)br->pos * 8 - br->count > (uint64_t)br->size * 8;
+}
+
+/*
+Reads a single bit
+Takes:
+- A pointer to the BitReader
+Returns:
+- The next bit, 0 or 1
+*/
+static inline int br_get_bit(BitReader* br)
+{
+    if (br->count == 0)
+    {
+        br_refill(br);
+    }
+    int bit = (int)br_peek(br, 1);
+    br_consume(br, 1);
+    return bit;
+}
+
+# endif
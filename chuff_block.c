@@ -0,0 +1,542 @@
+// chuff_block.c
+// Ben Crabtree, 2021
+
+# include "chuff_block.h"
+# include "chuff_huffman_tree.h"
+# include "chuff_heap.h"
+# include "chuff_context.h"
+# include "chuff_words.h"
+# include "chuff_ans.h"
+# include "chuff_crc32.h"
+
+void block_coder_init(BlockCoder* coder)
+{
+    memset(coder, 0, sizeof(BlockCoder));
+    coder->num_streams = 1;
+    dt_init(&coder->decode_table);
+    ht_init(&coder->tree);
+}
+
+void block_coder_free(BlockCoder* coder)
+{
+    dt_free(&coder->decode_table);
+    ht_free(&coder->tree);
+    context_coder_free(coder->context);
+    coder->context = NULL;
+    words_coder_free(coder->word_coder);
+    coder->word_coder = NULL;
+    ans_coder_free(coder->ans_coder);
+    coder->ans_coder = NULL;
+}
+
+/*
+Makes sure an order-1 BlockCoder has its ContextCoder
+Takes:
+- A pointer to the BlockCoder
+Returns:
+- 0 on success, -1 if memory runs out
+*/
+int block_get_context(BlockCoder* coder)
+{
+    if (coder->context == NULL)
+    {
+        coder->context = context_coder_new();
+    }
+    return coder->context != NULL ? 0 : -1;
+}
+
+/*
+Makes sure a word BlockCoder has its WordCoder
+Takes:
+- A pointer to the BlockCoder
+Returns:
+- 0 on success, -1 if memory runs out
+*/
+int block_get_words(BlockCoder* coder)
+{
+    if (coder->word_coder == NULL)
+    {
+        coder->word_coder = words_coder_new();
+    }
+    return coder->word_coder != NULL ? 0 : -1;
+}
+
+/*
+Makes sure a tANS BlockCoder has its AnsCoder
+Takes:
+- A pointer to the BlockCoder
+Returns:
+- 0 on success, -1 if memory runs out
+*/
+int block_get_ans(BlockCoder* coder)
+{
+    if (coder->ans_coder == NULL)
+    {
+        coder->ans_coder = ans_coder_new();
+    }
+    return coder->ans_coder != NULL ? 0 : -1;
+}
+
+size_t block_compress_bound(size_t raw_size)
+{
+    // An order-1 header is the largest there is, and each stream can end with a partly used byte
+    return BLOCK_HEADER_SIZE + CONTEXT_MAX_TABLES_SIZE + (BLOCK_MAX_STREAMS - 1) * (BLOCK_JUMP_ENTRY_SIZE + 1)
+        + bw_bytes_needed((uint64_t)raw_size * 8) + BLOCK_CHECKSUM_SIZE;
+}
+
+size_t block_segment_size(size_t raw_size, int num_streams)
+{
+    return (raw_size + num_streams - 1) / num_streams;
+}
+
+int block_open_streams(const uint8_t* payload, size_t payload_size, int num_streams, BitReader readers[])
+{
+    size_t pos = (num_streams - 1) * BLOCK_JUMP_ENTRY_SIZE;
+    if (pos > payload_size)
+    {
+        return -1;
+    }
+    for (int s = 0; s < num_streams - 1; s++)
+    {
+        size_t stream_size = get_u32(payload + s * BLOCK_JUMP_ENTRY_SIZE);
+        if (stream_size > payload_size - pos)
+        {
+            return -1;
+        }
+        br_init(&readers[s], payload + pos, stream_size);
+        pos += stream_size;
+    }
+    br_init(&readers[num_streams - 1], payload + pos, payload_size - pos);
+    return 0;
+}
+
+void block_decode_run(const DecodeTable* table, BitReader* br, uint8_t* dst, size_t size)
+{
+    size_t num_decoded = 0;
+    while (num_decoded < size)
+    {
+        // Each refill holds enough bits to look up several codes before the next one
+        br_refill(br);
+        while (br->count >= table->max_len && num_decoded < size)
+        {
+            dst[num_decoded] = (uint8_t)dt_decode_symbol(table, br);
+            num_decoded++;
+        }
+    }
+}
+
+int block_set_lengths(BlockCoder* coder, uint64_t counts[], int num_symbols, int code_lengths[], int max_len)
+{
+    if (ht_build(&coder->tree, counts, num_symbols) != 0)
+    {
+        return -1;
+    }
+
+    // Only the code lengths are kept, the tree's memory is reused by the next block
+    memset(code_lengths, 0, num_symbols * sizeof(int));
+    int tree_max_len = ht_get_code_lengths(&coder->tree, code_lengths);
+    for (int i = 0; i < num_symbols; i++)
+    {
+        coder->unlimited_bits += counts[i] * code_lengths[i];
+    }
+
+    // Plain Huffman codes are already optimal if they fit in the limit
+    if (max_len > 0 && tree_max_len > max_len)
+    {
+        return package_merge_lengths(counts, num_symbols, max_len, code_lengths);
+    }
+    return 0;
+}
+
+int block_set_codes(BlockCoder* coder)
+{
+    if (block_set_lengths(coder, coder->counts, NUM_SYMBOLS, coder->code_lengths, coder->max_code_len) != 0)
+    {
+        return -1;
+    }
+    return canonical_assign_codes(coder->code_lengths, coder->huffman_codes, NUM_SYMBOLS);
+}
+
+/*
+Decodes the same number of bytes from four bitstreams side by side
+Each reader is copied to a local so the compiler can keep all four in registers,
+and the four lookups in each round don't depend on each other.
+Takes:
+- A pointer to the DecodeTable
+- An array of four BitReaders
+- An array of four destination pointers
+- The number of bytes to decode from each stream
+Returns:
+- Void
+*/
+void block_decode_4(const DecodeTable* table, BitReader readers[], uint8_t* outs[], size_t size)
+{
+    BitReader br0 = readers[0];
+    BitReader br1 = readers[1];
+    BitReader br2 = readers[2];
+    BitReader br3 = readers[3];
+    uint8_t* out0 = outs[0];
+    uint8_t* out1 = outs[1];
+    uint8_t* out2 = outs[2];
+    uint8_t* out3 = outs[3];
+    // A refill always leaves at least 57 bits, enough for this many codes from each stream
+    size_t per_refill = 57 / table->max_len;
+    size_t num_decoded = 0;
+    while (size - num_decoded >= per_refill)
+    {
+        br_refill(&br0);
+        br_refill(&br1);
+        br_refill(&br2);
+        br_refill(&br3);
+        for (size_t k = 0; k < per_refill; k++)
+        {
+            out0[num_decoded] = (uint8_t)dt_decode_symbol(table, &br0);
+            out1[num_decoded] = (uint8_t)dt_decode_symbol(table, &br1);
+            out2[num_decoded] = (uint8_t)dt_decode_symbol(table, &br2);
+            out3[num_decoded] = (uint8_t)dt_decode_symbol(table, &br3);
+            num_decoded++;
+        }
+    }
+    readers[0] = br0;
+    readers[1] = br1;
+    readers[2] = br2;
+    readers[3] = br3;
+    block_decode_run(table, &readers[0], out0 + num_decoded, size - num_decoded);
+    block_decode_run(table, &readers[1], out1 + num_decoded, size - num_decoded);
+    block_decode_run(table, &readers[2], out2 + num_decoded, size - num_decoded);
+    block_decode_run(table, &readers[3], out3 + num_decoded, size - num_decoded);
+}
+
+/*
+Decodes the same number of bytes from two bitstreams side by side, as block_decode_4() does for four
+Takes:
+- A pointer to the DecodeTable
+- An array of two BitReaders
+- An array of two destination pointers
+- The number of bytes to decode from each stream
+Returns:
+- Void
+*/
+void block_decode_2(const DecodeTable* table, BitReader readers[], uint8_t* outs[], size_t size)
+{
+    BitReader br0 = readers[0];
+    BitReader br1 = readers[1];
+    uint8_t* out0 = outs[0];
+    uint8_t* out1 = outs[1];
+    size_t per_refill = 57 / table->max_len;
+    size_t num_decoded = 0;
+    while (size - num_decoded >= per_refill)
+    {
+        br_refill(&br0);
+        br_refill(&br1);
+        for (size_t k = 0; k < per_refill; k++)
+        {
+            out0[num_decoded] = (uint8_t)dt_decode_symbol(table, &br0);
+            out1[num_decoded] = (uint8_t)dt_decode_symbol(table, &br1);
+            num_decoded++;
+        }
+    }
+    readers[0] = br0;
+    readers[1] = br1;
+    block_decode_run(table, &readers[0], out0 + num_decoded, size - num_decoded);
+    block_decode_run(table, &readers[1], out1 + num_decoded, size - num_decoded);
+}
+
+long block_compress_body(BlockCoder* coder, const uint8_t* src, size_t src_size, uint8_t* body, size_t body_cap)
+{
+    uint64_t start = get_time_ns();
+    memset(coder->counts, 0, sizeof(coder->counts));
+    histogram_count(src, src_size, coder->counts);
+    uint64_t counted = get_time_ns();
+    coder->phase_ns[PHASE_COUNT] += counted - start;
+    if (block_set_codes(coder) != 0)
+    {
+        return -1;
+    }
+    uint64_t coded = get_time_ns();
+    coder->phase_ns[PHASE_CODES] += coded - counted;
+
+    uint64_t num_bits = 0;
+    for (int i = 0; i < NUM_SYMBOLS; i++)
+    {
+        num_bits += coder->counts[i] * coder->huffman_codes[i].len;
+    }
+    int num_streams = coder->num_streams;
+    size_t table_size = canonical_header_size(coder->code_lengths, NUM_SYMBOLS);
+    size_t jump_size = (num_streams - 1) * BLOCK_JUMP_ENTRY_SIZE;
+    // Each stream but the last can end with a partly used byte on top of the bits themselves
+    if (table_size + jump_size + bw_bytes_needed(num_bits) + num_streams - 1 > body_cap)
+    {
+        return -1;
+    }
+
+    canonical_write_lengths(coder->code_lengths, NUM_SYMBOLS, body);
+    uint8_t* payload = body + table_size;
+    size_t segment_size = block_segment_size(src_size, num_streams);
+    size_t payload_size = jump_size;
+    for (int s = 0; s < num_streams; s++)
+    {
+        size_t start = s * segment_size < src_size ? s * segment_size : src_size;
+        size_t end = start + segment_size < src_size ? start + segment_size : src_size;
+        BitWriter bw;
+        bw_init(&bw, payload + payload_size);
+        for (size_t i = start; i < end; i++)
+        {
+            bw_put_code(&bw, coder->huffman_codes[src[i]]);
+        }
+        size_t stream_size = bw_finish(&bw);
+        if (s < num_streams - 1)
+        {
+            put_u32(payload + s * BLOCK_JUMP_ENTRY_SIZE, (uint32_t)stream_size);
+        }
+        payload_size += stream_size;
+    }
+    coder->payload_bits += num_bits;
+    coder->order0_entropy_bits += histogram_entropy(coder->counts, NUM_SYMBOLS) * src_size;
+    coder->order0_raw_bytes += src_size;
+    coder->order0_body_bytes += table_size + payload_size;
+    coder->phase_ns[PHASE_ENCODE] += get_time_ns() - coded;
+    return table_size + payload_size;
+}
+
+/*
+Checks whether a block's bytes are so evenly spread that an order-1 or word model isn't worth trying
+Counting is much quicker than either model, and already compressed or encrypted data is close to 8 bits of entropy per byte.
+Takes:
+- A pointer to the BlockCoder
+- A pointer to the raw data
+- The size of the raw data
+Returns:
+- true if the order-0 entropy is above BLOCK_STORE_ENTROPY bits per byte, false if not
+*/
+bool block_is_incompressible(BlockCoder* coder, const uint8_t* src, size_t src_size)
+{
+    uint64_t start = get_time_ns();
+    uint64_t counts[NUM_SYMBOLS] = {0};
+    histogram_count(src, src_size, counts);
+    bool incompressible = histogram_entropy(counts, NUM_SYMBOLS) > BLOCK_STORE_ENTROPY;
+    coder->phase_ns[PHASE_COUNT] += get_time_ns() - start;
+    return incompressible;
+}
+
+long block_compress(BlockCoder* coder, const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_cap)
+{
+    size_t type_size = coder->block_types ? BLOCK_TYPE_SIZE : 0;
+    if (src_size == 0 || src_size > UINT32_MAX || dst_cap < BLOCK_HEADER_SIZE + type_size + BLOCK_CHECKSUM_SIZE)
+    {
+        return -1;
+    }
+    size_t checksum_size = coder->checksums ? BLOCK_CHECKSUM_SIZE : 0;
+    uint8_t* body = dst + BLOCK_HEADER_SIZE + type_size;
+    size_t body_cap = dst_cap - BLOCK_HEADER_SIZE - type_size - checksum_size;
+    size_t stored_cap = body_cap;
+    uint64_t unlimited_bits = coder->unlimited_bits;
+    double order0_entropy_bits = coder->order0_entropy_bits;
+    uint64_t order0_raw_bytes = coder->order0_raw_bytes;
+    uint64_t order0_body_bytes = coder->order0_body_bytes;
+    if (coder->block_types && body_cap > src_size - 1)
+    {
+        // A coded body has to come out smaller than the raw data, or the block is stored instead
+        body_cap = src_size - 1;
+    }
+    // tANS blocks need a type byte to tell them apart
+    bool ans = coder->ans && coder->block_types && !coder->words && coder->order == 0;
+    long body_size;
+    if (coder->block_types && (coder->words || coder->order == 1) && block_is_incompressible(coder, src, src_size))
+    {
+        body_size = -1;
+    }
+    else if (coder->words)
+    {
+        body_size = block_get_words(coder) == 0 ? words_compress(coder, src, src_size, body, body_cap) : -1;
+    }
+    else if (coder->order == 1)
+    {
+        body_size = block_get_context(coder) == 0 ? context_compress(coder, src, src_size, body, body_cap) : -1;
+    }
+    else if (ans)
+    {
+        body_size = block_get_ans(coder) == 0 ? ans_compress(coder, src, src_size, body, body_cap) : -1;
+    }
+    else
+    {
+        body_size = block_compress_body(coder, src, src_size, body, body_cap);
+    }
+    if (coder->block_types)
+    {
+        if (body_size >= 0)
+        {
+            body[-1] = ans ? BLOCK_TYPE_ANS : BLOCK_TYPE_CODED;
+        }
+        else if (src_size <= stored_cap)
+        {
+            uint64_t start = get_time_ns();
+            body[-1] = BLOCK_TYPE_STORED;
+            memcpy(body, src, src_size);
+            body_size = src_size;
+            // Stored bytes count as 8-bit codes, whatever the model worked out before giving up
+            coder->payload_bits += (uint64_t)src_size * 8;
+            coder->unlimited_bits = unlimited_bits + (uint64_t)src_size * 8;
+            // Nor were any order-0 codes used, if a word block fell back to them and still didn't fit
+            coder->order0_entropy_bits = order0_entropy_bits;
+            coder->order0_raw_bytes = order0_raw_bytes;
+            coder->order0_body_bytes = order0_body_bytes;
+            coder->phase_ns[PHASE_ENCODE] += get_time_ns() - start;
+        }
+    }
+    if (body_size < 0)
+    {
+        return -1;
+    }
+    if (coder->checksums)
+    {
+        uint64_t start = get_time_ns();
+        put_u32(body + body_size, crc32_update(0, src, src_size));
+        coder->phase_ns[PHASE_CHECKSUM] += get_time_ns() - start;
+    }
+    put_u32(dst, (uint32_t)src_size);
+    put_u32(dst + 4, (uint32_t)(type_size + body_size + checksum_size));
+    return BLOCK_HEADER_SIZE + type_size + body_size + checksum_size;
+}
+
+int block_decompress_body(BlockCoder* coder, const uint8_t* body, size_t body_size, uint8_t* dst, size_t raw_size)
+{
+    uint64_t start = get_time_ns();
+    const uint8_t* table = body;
+    long table_size = canonical_read_lengths(table, body_size, coder->code_lengths, NUM_SYMBOLS);
+    if (table_size < 0 || canonical_assign_codes(coder->code_lengths, coder->huffman_codes, NUM_SYMBOLS) != 0)
+    {
+        return -1;
+    }
+    if (dt_build(&coder->decode_table, coder->huffman_codes, NUM_SYMBOLS) != 0)
+    {
+        return -1;
+    }
+
+    uint64_t built = get_time_ns();
+    coder->phase_ns[PHASE_DECODE_TABLE] += built - start;
+
+    int num_streams = coder->num_streams;
+    BitReader readers[BLOCK_MAX_STREAMS];
+    if (block_open_streams(table + table_size, body_size - table_size, num_streams, readers) != 0)
+    {
+        return -1;
+    }
+    const DecodeTable* decode_table = &coder->decode_table;
+    size_t segment_size = block_segment_size(raw_size, num_streams);
+    // Every segment is at least as long as the last, so all streams can be decoded side by side that far
+    size_t full_size = (num_streams - 1) * segment_size;
+    size_t last_size = raw_size > full_size ? raw_size - full_size : 0;
+    if (num_streams > 1)
+    {
+        uint8_t* outs[BLOCK_MAX_STREAMS];
+        for (int s = 0; s < num_streams; s++)
+        {
+            outs[s] = dst + s * segment_size;
+        }
+        // Four streams at a time (then two, then one) as far as the last segment goes
+        int s = 0;
+        for ( ; s + 4 <= num_streams; s += 4)
+        {
+            block_decode_4(decode_table, &readers[s], &outs[s], last_size);
+        }
+        for ( ; s + 2 <= num_streams; s += 2)
+        {
+            block_decode_2(decode_table, &readers[s], &outs[s], last_size);
+        }
+        if (s < num_streams)
+        {
+            block_decode_run(decode_table, &readers[s], outs[s], last_size);
+        }
+        // Then each stream finishes its own segment
+        for (s = 0; s < num_streams; s++)
+        {
+            size_t start = s * segment_size < raw_size ? s * segment_size : raw_size;
+            size_t end = start + segment_size < raw_size ? start + segment_size : raw_size;
+            if (end - start > last_size)
+            {
+                block_decode_run(decode_table, &readers[s], dst + start + last_size, end - start - last_size);
+            }
+        }
+    }
+    else
+    {
+        block_decode_run(decode_table, &readers[0], dst, raw_size);
+    }
+    coder->phase_ns[PHASE_DECODE] += get_time_ns() - built;
+    return 0;
+}
+
+long block_decompress(BlockCoder* coder, const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_cap)
+{
+    if (src_size < BLOCK_HEADER_SIZE)
+    {
+        return -1;
+    }
+    size_t raw_size = get_u32(src);
+    size_t rest_size = get_u32(src + 4);
+    size_t checksum_size = coder->checksums ? BLOCK_CHECKSUM_SIZE : 0;
+    if (raw_size > dst_cap || rest_size > src_size - BLOCK_HEADER_SIZE || rest_size < checksum_size)
+    {
+        return -1;
+    }
+    const uint8_t* body = src + BLOCK_HEADER_SIZE;
+    size_t body_size = rest_size - checksum_size;
+    int block_type = BLOCK_TYPE_CODED;
+    if (coder->block_types)
+    {
+        if (body_size < BLOCK_TYPE_SIZE)
+        {
+            return -1;
+        }
+        block_type = body[0];
+        body += BLOCK_TYPE_SIZE;
+        body_size -= BLOCK_TYPE_SIZE;
+    }
+    int result;
+    if (block_type == BLOCK_TYPE_STORED)
+    {
+        uint64_t start = get_time_ns();
+        result = body_size == raw_size ? 0 : -1;
+        if (result == 0)
+        {
+            memcpy(dst, body, raw_size);
+        }
+        coder->phase_ns[PHASE_DECODE] += get_time_ns() - start;
+    }
+    else if (block_type == BLOCK_TYPE_ANS)
+    {
+        result = block_get_ans(coder) == 0 ? ans_decompress(coder, body, body_size, dst, raw_size) : -1;
+    }
+    else if (block_type != BLOCK_TYPE_CODED)
+    {
+        result = -1;
+    }
+    else if (coder->words)
+    {
+        result = block_get_words(coder) == 0 ? words_decompress(coder, body, body_size, dst, raw_size) : -1;
+    }
+    else if (coder->order == 1)
+    {
+        result = block_get_context(coder) == 0 ? context_decompress(coder, body, body_size, dst, raw_size) : -1;
+    }
+    else
+    {
+        result = block_decompress_body(coder, body, body_size, dst, raw_size);
+    }
+    if (result != 0)
+    {
+        return -1;
+    }
+    if (coder->checksums)
+    {
+        uint64_t start = get_time_ns();
+        uint32_t crc = crc32_update(0, dst, raw_size);
+        coder->phase_ns[PHASE_CHECKSUM] += get_time_ns() - start;
+        if (crc != get_u32(body + body_size))
+        {
+            return -1;
+        }
+    }
+    return raw_size;
+}
@@ -0,0 +1,265 @@
+// chuff_block.h
+// Ben Crabtree, 2021
+
+# ifndef CHUFF_BLOCK_H
+# define CHUFF_BLOCK_H
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdint.h>
+# include <stdbool.h>
+# include <math.h>
+# include <string.h>
+
+# include "chuff_shared.h"
+# include "chuff_bitstream.h"
+# include "chuff_decode_table.h"
+# include "chuff_canonical.h"
+# include "chuff_histogram.h"
+# include "chuff_package_merge.h"
+# include "chuff_huffman_tree.h"
+
+// Raw size and compressed size fields at the start of every block
+# define BLOCK_HEADER_SIZE 8
+// CRC-32 of the raw data at the end of every block, in streams that have checksums
+# define BLOCK_CHECKSUM_SIZE 4
+
+// Phases a BlockCoder times, indexing phase_ns
+# define PHASE_COUNT 0
+# define PHASE_CODES 1
+# define PHASE_ENCODE 2
+# define PHASE_DECODE_TABLE 3
+# define PHASE_DECODE 4
+# define PHASE_CHECKSUM 5 // CRC-32 of the raw data, both ways
+# define NUM_BLOCK_PHASES 6
+
+// Highest context order a block can be coded with (see chuff_context.h)
+# define BLOCK_MAX_ORDER 1
+
+// Interleaved bitstreams a block is split into by default
+# define DEFAULT_NUM_STREAMS 4
+// Most bitstreams a block can be split into
+# define BLOCK_MAX_STREAMS 8
+// Size of each jump table entry
+# define BLOCK_JUMP_ENTRY_SIZE 4
+
+// Block type byte at the start of the body, in streams whose blocks have one
+# define BLOCK_TYPE_SIZE 1
+# define BLOCK_TYPE_CODED 0
+# define BLOCK_TYPE_STORED 1
+# define BLOCK_TYPE_ANS 2
+// Order-0 entropy (bits per byte) above which an order-1 or word block is stored without trying its model
+# define BLOCK_STORE_ENTROPY 7.95
+
+struct ContextCoder;
+struct WordCoder;
+struct AnsCoder;
+
+/*
+Everything needed to compress or decompress one block on its own
+Each block gets its own histogram and code table, so a BlockCoder can be reused
+for any number of blocks without memory growing.
+With order 1, blocks are coded by context_compress() instead, which lays them out differently,
+and with words set by words_compress().
+
+A compressed block is laid out as:
+- 4 bytes raw size (big endian)
+- 4 bytes size of the rest of the block (big endian)
+- 1 byte block type, if block_types is set: BLOCK_TYPE_CODED for the layout below,
+  BLOCK_TYPE_STORED for the raw data as it is (then the checksum, if any), or
+  BLOCK_TYPE_ANS for an order-0 block coded with tANS instead (see chuff_ans.h)
+- Code lengths header (see canonical_write_lengths())
+- Bit-packed payload
+- 4 bytes CRC-32 of the raw data (big endian), if checksums is set
+
+With num_streams > 1 the raw data is cut into num_streams segments of equal size (the last
+one shorter), each packed into its own bitstream, and the payload is laid out as:
+- Jump table: the size of every stream but the last (4 bytes each, big endian)
+- The streams one after another
+One bitstream is a serial chain, as each code has to be looked up before the next one can be
+found, so the decoder steps through all the streams in the same loop to keep several lookups
+in flight at once.
+
+With block_types set, a block is only coded if that makes it smaller than its raw data, so
+already compressed or encrypted input costs a histogram and a copy rather than a full pass of
+coding, and decompresses with a memcpy.
+*/
+struct BlockCoder
+{
+    uint64_t counts[NUM_SYMBOLS];
+    int code_lengths[NUM_SYMBOLS];
+    HuffCode huffman_codes[NUM_SYMBOLS];
+    DecodeTable decode_table;
+    HTree tree; // Reset for each block rather than freed
+    int max_code_len; // Longest code block_compress() may use, or 0 for no limit
+    uint64_t payload_bits; // Bits of codes written by block_compress() so far
+    uint64_t unlimited_bits; // Bits the same blocks would have needed with no code length limit
+    // Blocks given order-0 Huffman codes so far, to measure the codes against each block's own entropy
+    double order0_entropy_bits; // Order-0 entropy of each of them times its size, summed
+    uint64_t order0_raw_bytes;
+    uint64_t order0_body_bytes; // Code lengths, jump tables and codes written for them
+    uint64_t phase_ns[NUM_BLOCK_PHASES]; // Time spent in each phase so far
+    int order; // 0 for one table per block, 1 for a table per previous byte
+    int num_streams; // Interleaved bitstreams per block, 1 to BLOCK_MAX_STREAMS
+    struct ContextCoder* context; // Order-1 tables, allocated on first use
+    bool checksums; // Whether blocks end with a CRC-32 of their raw data
+    bool words; // Whether blocks are coded as words and separators (see chuff_words.h)
+    struct WordCoder* word_coder; // Word model, allocated on first use
+    bool block_types; // Whether blocks start with a type byte, so those that don't shrink can be stored
+    bool ans; // Whether order-0 byte blocks are coded with tANS rather than Huffman codes (needs block_types)
+    struct AnsCoder* ans_coder; // tANS tables, allocated on first use
+};
+
+typedef struct BlockCoder BlockCoder;
+
+/*
+Initialises an order-0, single stream BlockCoder with no code length limit or checksums
+Takes:
+- A pointer to the BlockCoder
+Returns:
+- Void
+*/
+void block_coder_init(BlockCoder* coder);
+
+/*
+Frees memory held by a BlockCoder (but not the BlockCoder itself)
+Takes:
+- A pointer to the BlockCoder
+Returns:
+- Void
+*/
+void block_coder_free(BlockCoder* coder);
+
+/*
+Gets the largest compressed size a block of raw_size bytes can have, at any order
+A Huffman code never does worse than a fixed 8 bits per char, so the payload is at most raw_size bytes
+Takes:
+- The raw size of the block
+Returns:
+- The maximum compressed block size in bytes, including the block header and checksum
+*/
+size_t block_compress_bound(size_t raw_size);
+
+/*
+Gets the size of each segment a block is cut into for its bitstreams
+Segment i covers raw bytes i * segment size up to the next segment or the end of the block,
+so when the block is smaller than num_streams the last segments are empty.
+Takes:
+- The raw size of the block
+- The number of streams
+Returns:
+- The segment size in bytes
+*/
+size_t block_segment_size(size_t raw_size, int num_streams);
+
+/*
+Reads a block's jump table and points a BitReader at each of its streams
+Takes:
+- A pointer to the payload, starting at the jump table
+- The size of the payload
+- The number of streams
+- An array of num_streams BitReaders to initialise
+Returns:
+- 0 on success, -1 if the jump table is truncated or the streams overrun the payload
+*/
+int block_open_streams(const uint8_t* payload, size_t payload_size, int num_streams, BitReader readers[]);
+
+/*
+Decodes bytes from one bitstream with a single decode table
+Takes:
+- A pointer to the DecodeTable
+- A pointer to the BitReader
+- A pointer to the destination buffer
+- The number of bytes to decode
+Returns:
+- Void
+*/
+void block_decode_run(const DecodeTable* table, BitReader* br, uint8_t* dst, size_t size);
+
+/*
+Works out code lengths from counts, using the BlockCoder's tree:
+- Builds a Huffman tree and reduces it to code lengths
+- If any code is longer than max_len, works out length-limited code lengths instead
+The bits unlimited Huffman codes would take are added to the BlockCoder's unlimited_bits.
+Takes:
+- A pointer to the BlockCoder
+- An array of counts indexed by symbol
+- The number of symbols (NUM_SYMBOLS for bytes, more for a bigger alphabet)
+- An int array of num_symbols code lengths to fill in
+- The maximum code length, or 0 for no limit
+Returns:
+- 0 on success, -1 if every count is 0 or no code fits the limit
+*/
+int block_set_lengths(BlockCoder* coder, uint64_t counts[], int num_symbols, int code_lengths[], int max_len);
+
+/*
+Works out code lengths and canonical codes from the counts in a BlockCoder:
+- Builds a Huffman tree and reduces it to code lengths
+- If any code is longer than max_code_len, works out length-limited code lengths instead
+Takes:
+- A pointer to the BlockCoder with counts filled in
+Returns:
+- 0 on success, -1 if every count is 0 or no code fits the limit
+*/
+int block_set_codes(BlockCoder* coder);
+
+/*
+Compresses one block's body (everything after the block header) with a single code table
+Takes:
+- A pointer to the BlockCoder
+- A pointer to the raw data
+- The size of the raw data
+- A pointer to where the body goes
+- The room left for the body
+Returns:
+- The body size in bytes, or -1 if there isn't room or no code fits the limit
+*/
+long block_compress_body(BlockCoder* coder, const uint8_t* src, size_t src_size, uint8_t* body, size_t body_cap);
+
+/*
+Decompresses one block body written by block_compress_body()
+Takes:
+- A pointer to the BlockCoder
+- A pointer to the body, just after the block header
+- The size of the body, not counting any checksum
+- A pointer to the destination buffer
+- The raw size of the block
+Returns:
+- 0 on success, -1 if the body is malformed
+*/
+int block_decompress_body(BlockCoder* coder, const uint8_t* body, size_t body_size, uint8_t* dst, size_t raw_size);
+
+/*
+Compresses one block (or hands it to context_compress() if the coder's order is 1, to
+words_compress() if its words flag is set, or to ans_compress() if its ans and block_types flags are set):
+- Counts bytes in src
+- Builds a Huffman tree and reduces it to code lengths
+- If any code is longer than max_code_len, works out length-limited code lengths instead
+- Assigns canonical codes and packs src with them
+- If the coder's block_types flag is set, stores src as it is instead when coding wouldn't make it smaller
+- Appends a CRC-32 of src if the coder's checksums flag is set
+Takes:
+- A pointer to the BlockCoder
+- A pointer to the raw data
+- The size of the raw data (1 to UINT32_MAX bytes)
+- A pointer to the destination buffer
+- The capacity of the destination buffer (block_compress_bound() is always enough)
+Returns:
+- The compressed block size in bytes, or -1 if dst is too small or memory runs out
+*/
+long block_compress(BlockCoder* coder, const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_cap);
+
+/*
+Decompresses one block written by block_compress(), checking its CRC-32 if the coder's checksums flag is set
+Takes:
+- A pointer to the BlockCoder, set to the order, streams, checksums, words and block types the block was compressed with
+- A pointer to the compressed block, starting at its block header
+- The size of the compressed block
+- A pointer to the destination buffer
+- The capacity of the destination buffer
+Returns:
+- The raw size of the block in bytes, or -1 if the block is malformed, fails its checksum or dst is too small
+*/
+long block_decompress(BlockCoder* coder, const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_cap);
+
+# endif
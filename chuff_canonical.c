@@ -0,0 +1,99 @@
+// chuff_canonical.c
+// Ben Crabtree, 2021
+
+# include "chuff_canonical.h"
+
+int canonical_assign_codes(int code_lengths[], HuffCode codes[], int num_symbols)
+{
+    // Count how many codes there are of each length
+    uint64_t len_counts[MAX_CODE_LEN + 1] = {0};
+    for (int i = 0; i < num_symbols; i++)
+    {
+        if (code_lengths[i] < 0 || code_lengths[i] > MAX_CODE_LEN)
+        {
+            return -1;
+        }
+        len_counts[code_lengths[i]]++;
+    }
+    len_counts[0] = 0;
+
+    // Work out the first code of each length
+    uint64_t next_code[MAX_CODE_LEN + 1] = {0};
+    uint64_t code = 0;
+    for (int len = 1; len <= MAX_CODE_LEN; len++)
+    {
+        code = (code + len_counts[len - 1]) << 1;
+        next_code[len] = code;
+        // More codes of this length than there is room for means the lengths aren't a valid prefix code
+        if (len_counts[len] > ((uint64_t)1 << len) - code)
+        {
+            return -1;
+        }
+    }
+
+    // Hand out consecutive codes in symbol order
+    for (int i = 0; i < num_symbols; i++)
+    {
+        int len = code_lengths[i];
+        codes[i].len = len;
+        codes[i].bits = 0;
+        if (len > 0)
+        {
+            codes[i].bits = next_code[len];
+            next_code[len]++;
+        }
+    }
+    return 0;
+}
+
+/*
+Gets how many symbols the header has to list: all of them up to the last one with a code
+Takes:
+- An array of code lengths
+- The number of symbols
+Returns:
+- One more than the last symbol with a nonzero code length, 0 if there are none
+*/
+static int canonical_num_coded_symbols(int code_lengths[], int num_symbols)
+{
+    int n = num_symbols;
+    while (n > 0 && code_lengths[n - 1] == 0)
+    {
+        n--;
+    }
+    return n;
+}
+
+size_t canonical_header_size(int code_lengths[], int num_symbols)
+{
+    return CANONICAL_COUNT_SIZE + canonical_num_coded_symbols(code_lengths, num_symbols);
+}
+
+size_t canonical_write_lengths(int code_lengths[], int num_symbols, uint8_t* header)
+{
+    int n = canonical_num_coded_symbols(code_lengths, num_symbols);
+    put_u32(header, n);
+    for (int i = 0; i < n; i++)
+    {
+        header[CANONICAL_COUNT_SIZE + i] = (uint8_t)code_lengths[i];
+    }
+    return CANONICAL_COUNT_SIZE + n;
+}
+
+long canonical_read_lengths(const uint8_t* header, size_t size, int code_lengths[], int num_symbols)
+{
+    if (size < CANONICAL_COUNT_SIZE)
+    {
+        return -1;
+    }
+    uint32_t n = get_u32(header);
+    if (n > (uint32_t)num_symbols || size - CANONICAL_COUNT_SIZE < n)
+    {
+        return -1;
+    }
+    for (int i = 0; i < num_symbols; i++)
+    {
+        code_lengths[i] = (uint32_t)i < n ? header[CANONICAL_COUNT_SIZE + i] : 0;
+    }
+    return CANONICAL_COUNT_SIZE + n;
+}
@@ -0,0 +1,69 @@
+// chuff_canonical.h
+// Ben Crabtree, 2021
+
+# ifndef CHUFF_CANONICAL_H
+# define CHUFF_CANONICAL_H
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdint.h>
+# include <string.h>
+
+# include "chuff_shared.h"
+# include "chuff_bitstream.h"
+
+// Longest code length canonical_assign_codes() can handle
+# define MAX_CODE_LEN 56
+// Size of the symbol count at the start of a code lengths header
+# define CANONICAL_COUNT_SIZE 4
+
+/*
+Assigns canonical Huffman codes from code lengths
+Codes of the same length are consecutive binary numbers in symbol order,
+and each length starts where the previous (shorter) length left off, shifted left by one.
+So the lengths alone are enough for the decoder to rebuild exactly the same codes.
+Takes:
+- An int array of code lengths indexed by symbol (0 for unused symbols)
+- An array of HuffCodes to fill in, indexed by symbol
+- The number of symbols in both arrays
+Returns:
+- 0 on success, -1 if a length is over MAX_CODE_LEN or the lengths can't form a prefix code
+*/
+int canonical_assign_codes(int code_lengths[], HuffCode codes[], int num_symbols);
+
+/*
+Gets the number of bytes canonical_write_lengths() needs
+Takes:
+- An int array of code lengths indexed by symbol
+- The number of symbols in the array
+Returns:
+- The header size in bytes
+*/
+size_t canonical_header_size(int code_lengths[], int num_symbols);
+
+/*
+Serialises code lengths as a compact header:
+- 4 bytes (big endian) giving n, one more than the last symbol with a code
+- n bytes, the code length of each symbol 0 to n-1
+Takes:
+- An int array of code lengths indexed by symbol
+- The number of symbols in the array
+- A pointer to a buffer of at least canonical_header_size() bytes
+Returns:
+- The number of bytes written
+*/
+size_t canonical_write_lengths(int code_lengths[], int num_symbols, uint8_t* header);
+
+/*
+Reads back code lengths written by canonical_write_lengths()
+Takes:
+- A pointer to the header
+- The number of bytes available in the header
+- An int array of code lengths to fill in, indexed by symbol
+- The number of symbols in the array
+Returns:
+- The number of header bytes read, or -1 if the header is truncated or names too many symbols
+*/
+long canonical_read_lengths(const uint8_t* header, size_t size, int code_lengths[], int num_symbols);
+
+# endif
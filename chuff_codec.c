@@ -0,0 +1,31 @@
+// chuff_codec.c
+// Ben Crabtree, 2021
+
+# include "chuff_codec.h"
+// Written by chuff gen-codec from CODEC_MODEL (see the Makefile)
+# include "chuff_codec_gen.h"
+
+uint32_t chuff_codec_model_id(void)
+{
+    return CHUFF_GEN_MODEL_ID;
+}
+
+size_t chuff_codec_compress_bound(size_t src_size)
+{
+    return chuff_gen_compress_bound(src_size);
+}
+
+long chuff_codec_compress(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_cap)
+{
+    return chuff_gen_compress(src, src_size, dst, dst_cap);
+}
+
+long chuff_codec_decompressed_size(const uint8_t* src, size_t src_size)
+{
+    return chuff_gen_decompressed_size(src, src_size);
+}
+
+long chuff_codec_decompress(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_cap)
+{
+    return chuff_gen_decompress(src, src_size, dst, dst_cap);
+}
@@ -0,0 +1,70 @@
+// chuff_codec.h
+// Ben Crabtree, 2021
+
+# ifndef CHUFF_CODEC_H
+# define CHUFF_CODEC_H
+
+# include <stddef.h>
+# include <stdint.h>
+
+/*
+A record codec with one model's code table compiled in (see chuff gen-codec)
+Built into libchuff when it is made with CODEC_MODEL set, e.g. make CODEC_MODEL=events.chm,
+for services that always code records with the same model: there is no model to load or
+ChuffCtx to set up, and the tables and loops are fixed for that model when the library is built.
+Records are the same as chuff_compress() writes with the model set, so either can read the other's.
+*/
+
+/*
+Gets the model ID the codec was built with, which every record it writes starts with
+Takes:
+- Nothing
+Returns:
+- The model ID
+*/
+uint32_t chuff_codec_model_id(void);
+
+/*
+Gets the size of buffer chuff_codec_compress() needs
+Takes:
+- The size of the data to compress
+Returns:
+- The buffer size in bytes
+*/
+size_t chuff_codec_compress_bound(size_t src_size);
+
+/*
+Compresses one record with the built in model
+Takes:
+- A pointer to the data to compress
+- The size of the data, at most UINT32_MAX
+- A pointer to the buffer to write to
+- The size of that buffer, at least chuff_codec_compress_bound(src_size)
+Returns:
+- The record size in bytes, or -1 if src is too big or dst too small
+*/
+long chuff_codec_compress(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_cap);
+
+/*
+Gets the raw size of a record written with the built in model
+Takes:
+- A pointer to the record
+- The size of the record
+Returns:
+- The raw size in bytes, or -1 if the record is too short or was written with another model
+*/
+long chuff_codec_decompressed_size(const uint8_t* src, size_t src_size);
+
+/*
+Decompresses one record written with the built in model
+Takes:
+- A pointer to the record
+- The size of the record
+- A pointer to the buffer to write to
+- The size of that buffer
+Returns:
+- The raw size in bytes, or -1 if the record is for another model or dst is too small
+*/
+long chuff_codec_decompress(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_cap);
+
+# endif
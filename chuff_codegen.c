@@ -0,0 +1,435 @@
+// chuff_codegen.c
+// Ben Crabtree, 2021
+
+# include <ctype.h>
+
+# include "chuff_codegen.h"
+
+/*
+The code below is written out with $ standing for the prefix and @ for the prefix in capitals.
+Parts that depend on the model (tables, the decode step and the unrolled loops) are written by
+the functions that use them.
+*/
+
+static const char* CODEGEN_HELPERS[] =
+{
+    "static inline void $_put_u32(uint8_t* dst, uint32_t value)",
+    "{",
+    "    dst[0] = (uint8_t)(value >> 24);",
+    "    dst[1] = (uint8_t)(value >> 16);",
+    "    dst[2] = (uint8_t)(value >> 8);",
+    "    dst[3] = (uint8_t)value;",
+    "}",
+    "",
+    "static inline uint32_t $_get_u32(const uint8_t* src)",
+    "{",
+    "    return (uint32_t)src[0] << 24 | (uint32_t)src[1] << 16 | (uint32_t)src[2] << 8 | (uint32_t)src[3];",
+    "}",
+    "",
+    "// Appends the code for byte to the low end of the window",
+    "static inline void $_put_symbol(uint8_t byte, uint64_t* acc, int* count)",
+    "{",
+    "    $_code_t entry = $_encode_table[byte];",
+    "    int len = (int)(entry & 0xFF);",
+    "    *acc = *acc << len | (uint64_t)(entry >> 8);",
+    "    *count += len;",
+    "}",
+    "",
+    "// Writes out the whole bytes in the window (1 to 64 bits), leaving 0 to 7 behind",
+    "// dst must have 8 bytes free at pos, as a whole word is stored each time",
+    "static inline void $_flush(uint8_t* dst, size_t* pos, uint64_t acc, int* count)",
+    "{",
+    "    uint64_t word = __builtin_bswap64(acc << (64 - *count));",
+    "    memcpy(dst + *pos, &word, sizeof(word));",
+    "    *pos += *count >> 3;",
+    "    *count &= 7;",
+    "}",
+    "",
+    "// Tops the window up to at least 57 bits, reading 0s past the end of src",
+    "static inline void $_refill(const uint8_t* src, size_t size, size_t* pos, uint64_t* acc, int* count)",
+    "{",
+    "    if (*count > 56)",
+    "    {",
+    "        return;",
+    "    }",
+    "    if (*pos + sizeof(uint64_t) <= size)",
+    "    {",
+    "        uint64_t word;",
+    "        memcpy(&word, src + *pos, sizeof(word));",
+    "        *acc |= __builtin_bswap64(word) >> *count;",
+    "        int num_bytes = (64 - *count) >> 3;",
+    "        *pos += num_bytes;",
+    "        *count += num_bytes * 8;",
+    "        return;",
+    "    }",
+    "    while (*count <= 56)",
+    "    {",
+    "        uint64_t byte = *pos < size ? src[*pos] : 0;",
+    "        (*pos)++;",
+    "        *acc |= byte << (56 - *count);",
+    "        *count += 8;",
+    "    }",
+    "}",
+    "",
+    NULL
+};
+
+// Every code fits the primary table, so one lookup always finds the symbol
+static const char* CODEGEN_DECODE_ONE_LEVEL[] =
+{
+    "static inline uint8_t $_decode_symbol(uint64_t* acc, int* count)",
+    "{",
+    "    uint16_t entry = $_decode_table[*acc >> (64 - @_PRIMARY_BITS)];",
+    "    int len = entry >> 8;",
+    "    *acc <<= len;",
+    "    *count -= len;",
+    "    return (uint8_t)entry;",
+    "}",
+    "",
+    NULL
+};
+
+static const char* CODEGEN_DECODE_TWO_LEVEL[] =
+{
+    "static inline uint8_t $_decode_symbol(uint64_t* acc, int* count)",
+    "{",
+    "    struct $_decode_entry entry = $_decode_table[*acc >> (64 - @_PRIMARY_BITS)];",
+    "    if (entry.len == 0)",
+    "    {",
+    "        entry = $_decode_table[entry.value + ((*acc << @_PRIMARY_BITS) >> (64 - entry.sub_bits))];",
+    "    }",
+    "    *acc <<= entry.len;",
+    "    *count -= entry.len;",
+    "    return (uint8_t)entry.value;",
+    "}",
+    "",
+    NULL
+};
+
+static const char* CODEGEN_COMPRESS_START[] =
+{
+    "/*",
+    "Gets the largest size a record of raw_size bytes can have, plus room for the last word stored",
+    "Takes:",
+    "- The raw size of the record",
+    "Returns:",
+    "- The size of buffer $_compress() needs",
+    "*/",
+    "static inline size_t $_compress_bound(size_t raw_size)",
+    "{",
+    "    return @_HEADER_SIZE + (raw_size * @_MAX_LEN + 7) / 8 + sizeof(uint64_t);",
+    "}",
+    "",
+    "/*",
+    "Compresses one record",
+    "Takes:",
+    "- A pointer to the data to compress",
+    "- The size of the data, at most UINT32_MAX",
+    "- A pointer to the buffer to write to",
+    "- The size of that buffer, at least $_compress_bound(src_size)",
+    "Returns:",
+    "- The record size in bytes, or -1 if src is too big or dst too small",
+    "*/",
+    "static inline long $_compress(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_cap)",
+    "{",
+    "    if ((uint64_t)src_size > UINT32_MAX || dst_cap < $_compress_bound(src_size))",
+    "    {",
+    "        return -1;",
+    "    }",
+    "    $_put_u32(dst, @_MODEL_ID);",
+    "    $_put_u32(dst + 4, (uint32_t)src_size);",
+    "    size_t pos = @_HEADER_SIZE;",
+    "    uint64_t acc = 0;",
+    "    int count = 0;",
+    "    size_t i = 0;",
+    "    for (; i + @_CODES_PER_FLUSH <= src_size; i += @_CODES_PER_FLUSH)",
+    "    {",
+    NULL
+};
+
+static const char* CODEGEN_COMPRESS_END[] =
+{
+    "        $_flush(dst, &pos, acc, &count);",
+    "    }",
+    "    for (; i < src_size; i++)",
+    "    {",
+    "        $_put_symbol(src[i], &acc, &count);",
+    "        $_flush(dst, &pos, acc, &count);",
+    "    }",
+    "    // The last byte is padded with 0s",
+    "    if (count > 0)",
+    "    {",
+    "        dst[pos] = (uint8_t)(acc << (8 - count));",
+    "        pos++;",
+    "    }",
+    "    return (long)pos;",
+    "}",
+    "",
+    NULL
+};
+
+static const char* CODEGEN_DECOMPRESS_START[] =
+{
+    "/*",
+    "Gets the raw size of a record written with this model",
+    "Takes:",
+    "- A pointer to the record",
+    "- The size of the record",
+    "Returns:",
+    "- The raw size in bytes, or -1 if the record is too short or was written with another model",
+    "*/",
+    "static inline long $_decompressed_size(const uint8_t* src, size_t src_size)",
+    "{",
+    "    if (src_size < @_HEADER_SIZE || $_get_u32(src) != @_MODEL_ID)",
+    "    {",
+    "        return -1;",
+    "    }",
+    "    return (long)$_get_u32(src + 4);",
+    "}",
+    "",
+    "/*",
+    "Decompresses one record",
+    "Takes:",
+    "- A pointer to the record",
+    "- The size of the record",
+    "- A pointer to the buffer to write to",
+    "- The size of that buffer",
+    "Returns:",
+    "- The raw size in bytes, or -1 if the record is for another model, is truncated or dst is too small",
+    "*/",
+    "static inline long $_decompress(const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_cap)",
+    "{",
+    "    long raw_size = $_decompressed_size(src, src_size);",
+    "    if (raw_size < 0 || (size_t)raw_size > dst_cap)",
+    "    {",
+    "        return -1;",
+    "    }",
+    "    const uint8_t* payload = src + @_HEADER_SIZE;",
+    "    size_t payload_size = src_size - @_HEADER_SIZE;",
+    "    size_t pos = 0;",
+    "    uint64_t acc = 0;",
+    "    int count = 0;",
+    "    size_t i = 0;",
+    "    for (; i + @_CODES_PER_REFILL <= (size_t)raw_size; i += @_CODES_PER_REFILL)",
+    "    {",
+    "        $_refill(payload, payload_size, &pos, &acc, &count);",
+    NULL
+};
+
+static const char* CODEGEN_DECOMPRESS_END[] =
+{
+    "    }",
+    "    for (; i < (size_t)raw_size; i++)",
+    "    {",
+    "        $_refill(payload, payload_size, &pos, &acc, &count);",
+    "        dst[i] = $_decode_symbol(&acc, &count);",
+    "    }",
+    "    // $_refill() reads 0s past the end, so a truncated record only shows as bits used that it doesn't have",
+    "    if ((uint64_t)pos * 8 - count > (uint64_t)payload_size * 8)",
+    "    {",
+    "        return -1;",
+    "    }",
+    "    return raw_size;",
+    "}",
+    "",
+    NULL
+};
+
+bool codegen_valid_prefix(const char* prefix)
+{
+    size_t len = strlen(prefix);
+    if (len == 0 || len > CODEGEN_MAX_PREFIX_LEN || isdigit((unsigned char)prefix[0]))
+    {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++)
+    {
+        if (!isalnum((unsigned char)prefix[i]) && prefix[i] != '_')
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+Writes one line of template code, replacing $ with the prefix and @ with the prefix in capitals
+Takes:
+- A pointer to the output FILE
+- The line
+- The prefix
+Returns:
+- Void
+*/
+void codegen_put_line(FILE* out, const char* line, const char* prefix)
+{
+    for (const char* c = line; *c != '\0'; c++)
+    {
+        if (*c == '$')
+        {
+            fputs(prefix, out);
+        }
+        else if (*c == '@')
+        {
+            for (const char* p = prefix; *p != '\0'; p++)
+            {
+                fputc(toupper((unsigned char)*p), out);
+            }
+        }
+        else
+        {
+            fputc(*c, out);
+        }
+    }
+    fputc('\n', out);
+}
+
+/*
+Writes a NULL-terminated array of template lines
+Takes:
+- A pointer to the output FILE
+- The lines
+- The prefix
+Returns:
+- Void
+*/
+void codegen_put_lines(FILE* out, const char* lines[], const char* prefix)
+{
+    for (int i = 0; lines[i] != NULL; i++)
+    {
+        codegen_put_line(out, lines[i], prefix);
+    }
+}
+
+/*
+Writes the encode table: each symbol's code in the high bits and its length in the low 8 bits
+The entries are 32 bits wide if every code fits in 24 bits, otherwise 64.
+Takes:
+- A pointer to the ChuffModel
+- The prefix
+- A pointer to the output FILE
+Returns:
+- Void
+*/
+void codegen_write_encode_table(ChuffModel* model, const char* prefix, FILE* out)
+{
+    bool wide = model->max_len > 24;
+    fprintf(out, "typedef %s %s_code_t;\n\n", wide ? "uint64_t" : "uint32_t", prefix);
+    fprintf(out, "// Code of each byte value in the high bits, its length in the low 8 bits\n");
+    fprintf(out, "static const %s_code_t %s_encode_table[%d] =\n{", prefix, prefix, NUM_SYMBOLS);
+    int per_line = wide ? 4 : 8;
+    for (int i = 0; i < NUM_SYMBOLS; i++)
+    {
+        uint64_t entry = model->codes[i].bits << 8 | (uint64_t)model->codes[i].len;
+        fprintf(out, "%s", i % per_line == 0 ? "\n    " : " ");
+        if (wide)
+        {
+            fprintf(out, "0x%016llxull,", (unsigned long long)entry);
+        }
+        else
+        {
+            fprintf(out, "0x%08xu,", (unsigned int)entry);
+        }
+    }
+    fprintf(out, "\n};\n\n");
+}
+
+/*
+Writes the model's decode table
+With one level, each entry is the code length in the high byte and the symbol in the low byte.
+With two, the entries are copied out of the DecodeTable as they are.
+Takes:
+- A pointer to the ChuffModel
+- Whether any code is longer than the primary table bits
+- The prefix
+- A pointer to the output FILE
+Returns:
+- Void
+*/
+void codegen_write_decode_table(ChuffModel* model, bool two_level, const char* prefix, FILE* out)
+{
+    const DecodeTable* table = &model->decode_table;
+    if (!two_level)
+    {
+        fprintf(out, "// Code length << 8 | symbol, indexed by the next %d bits\n", table->primary_bits);
+        fprintf(out, "static const uint16_t %s_decode_table[%d] =\n{", prefix, table->num_entries);
+        for (int i = 0; i < table->num_entries; i++)
+        {
+            DecodeEntry entry = table->entries[i];
+            fprintf(out, "%s0x%04x,", i % 12 == 0 ? "\n    " : " ", (unsigned int)(entry.len << 8 | entry.value));
+        }
+        fprintf(out, "\n};\n\n");
+        return;
+    }
+    fprintf(out, "// Primary table indexed by the next %d bits, followed by the secondary tables\n", table->primary_bits);
+    fprintf(out, "struct %s_decode_entry\n{\n", prefix);
+    fprintf(out, "    uint32_t value; // Symbol, or index of the first slot of the secondary table for a link\n");
+    fprintf(out, "    uint8_t len; // Full code length of the symbol, or 0 for a link\n");
+    fprintf(out, "    uint8_t sub_bits; // For a link, number of extra bits indexing the secondary table\n");
+    fprintf(out, "};\n\n");
+    fprintf(out, "static const struct %s_decode_entry %s_decode_table[%d] =\n{", prefix, prefix, table->num_entries);
+    for (int i = 0; i < table->num_entries; i++)
+    {
+        DecodeEntry entry = table->entries[i];
+        fprintf(out, "%s{%u, %u, %u},", i % 6 == 0 ? "\n    " : " ",
+            (unsigned int)entry.value, (unsigned int)entry.len, (unsigned int)entry.sub_bits);
+    }
+    fprintf(out, "\n};\n\n");
+}
+
+int codegen_write(ChuffModel* model, const char* prefix, const char* file_name, FILE* out)
+{
+    const DecodeTable* table = &model->decode_table;
+    bool two_level = model->max_len > table->primary_bits;
+    // After a flush at most 7 bits are left in the 64-bit window, and a refill leaves at least 57
+    int codes_per_flush = (64 - 7) / model->max_len;
+    int codes_per_refill = CODEGEN_REFILL_BITS / model->max_len;
+    char line[128];
+
+    fprintf(out, "// %s\n", file_name);
+    fprintf(out, "// Generated by chuff gen-codec from model %08x, do not edit\n\n", model->id);
+    codegen_put_line(out, "# ifndef @_H", prefix);
+    codegen_put_line(out, "# define @_H", prefix);
+    fprintf(out, "\n# include <stddef.h>\n# include <stdint.h>\n# include <string.h>\n\n");
+    fprintf(out, "// ID every record written with the model starts with\n");
+    snprintf(line, sizeof(line), "# define @_MODEL_ID 0x%08xu", model->id);
+    codegen_put_line(out, line, prefix);
+    fprintf(out, "// Model ID and raw size at the start of every record\n");
+    snprintf(line, sizeof(line), "# define @_HEADER_SIZE %d", MODEL_RECORD_HEADER_SIZE);
+    codegen_put_line(out, line, prefix);
+    fprintf(out, "// Longest code in the model\n");
+    snprintf(line, sizeof(line), "# define @_MAX_LEN %d", model->max_len);
+    codegen_put_line(out, line, prefix);
+    fprintf(out, "// Bits indexing the primary decode table\n");
+    snprintf(line, sizeof(line), "# define @_PRIMARY_BITS %d", table->primary_bits);
+    codegen_put_line(out, line, prefix);
+    fprintf(out, "// Codes packed between stores of the window, and decoded between refills of it\n");
+    snprintf(line, sizeof(line), "# define @_CODES_PER_FLUSH %d", codes_per_flush);
+    codegen_put_line(out, line, prefix);
+    snprintf(line, sizeof(line), "# define @_CODES_PER_REFILL %d", codes_per_refill);
+    codegen_put_line(out, line, prefix);
+    fprintf(out, "\n");
+
+    codegen_write_encode_table(model, prefix, out);
+    codegen_write_decode_table(model, two_level, prefix, out);
+    codegen_put_lines(out, CODEGEN_HELPERS, prefix);
+    codegen_put_lines(out, two_level ? CODEGEN_DECODE_TWO_LEVEL : CODEGEN_DECODE_ONE_LEVEL, prefix);
+
+    // The unrolled loop bodies: one step per code that fits between flushes or refills
+    codegen_put_lines(out, CODEGEN_COMPRESS_START, prefix);
+    for (int i = 0; i < codes_per_flush; i++)
+    {
+        snprintf(line, sizeof(line), "        $_put_symbol(src[i + %d], &acc, &count);", i);
+        codegen_put_line(out, line, prefix);
+    }
+    codegen_put_lines(out, CODEGEN_COMPRESS_END, prefix);
+    codegen_put_lines(out, CODEGEN_DECOMPRESS_START, prefix);
+    for (int i = 0; i < codes_per_refill; i++)
+    {
+        snprintf(line, sizeof(line), "        dst[i + %d] = $_decode_symbol(&acc, &count);", i);
+        codegen_put_line(out, line, prefix);
+    }
+    codegen_put_lines(out, CODEGEN_DECOMPRESS_END, prefix);
+    fprintf(out, "# endif\n");
+    return ferror(out) ? -1 : 0;
+}
@@ -0,0 +1,53 @@
+// chuff_codegen.h
+// Ben Crabtree, 2021
+
+# ifndef CHUFF_CODEGEN_H
+# define CHUFF_CODEGEN_H
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdbool.h>
+# include <stdint.h>
+# include <string.h>
+
+# include "chuff_shared.h"
+# include "chuff_model.h"
+
+// Name the generated functions and tables start with if no other is given
+# define CODEGEN_DEFAULT_PREFIX "chuff_gen"
+// Longest prefix accepted, leaving room for the names built from it
+# define CODEGEN_MAX_PREFIX_LEN 64
+// Bits a refill is guaranteed to leave in the window, as with br_refill()
+# define CODEGEN_REFILL_BITS 57
+
+/*
+Checks a prefix can start C identifiers: a letter or underscore, then letters, digits or underscores
+Takes:
+- The prefix
+Returns:
+- true if it can be used, false if not
+*/
+bool codegen_valid_prefix(const char* prefix);
+
+/*
+Writes a C header that codes records (see chuff_model.h) with one model built in
+The header needs nothing but the C library, and declares (with <prefix> replaced by the prefix):
+- <PREFIX>_MODEL_ID, the model ID records are tagged with
+- <prefix>_compress_bound(), <prefix>_compress() and <prefix>_decompress(), all static
+Each symbol's code and length are baked into one static const table entry, and the decode table
+into a static const copy of the model's DecodeTable. The longest code is a constant too, so the
+encode and decode loops are written out with one step per code that fits in a 57-bit window,
+and the second table lookup is left out altogether when every code fits the primary table.
+Records are byte for byte the same as model_compress() writes, so either side can be swapped
+for chuff -c/-d --model or chuff_decompress() with the model loaded.
+Takes:
+- A pointer to the ChuffModel
+- The prefix for every name in the header (see codegen_valid_prefix())
+- The file name to put at the top of the header
+- A pointer to the output FILE
+Returns:
+- 0 on success, -1 if writing fails
+*/
+int codegen_write(ChuffModel* model, const char* prefix, const char* file_name, FILE* out);
+
+# endif
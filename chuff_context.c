@@ -0,0 +1,457 @@
+// chuff_context.c
+// Ben Crabtree, 2021
+
+# include <math.h>
+
+# include "chuff_context.h"
+
+struct ContextLoad
+{
+    uint64_t total;
+    int context;
+};
+
+typedef struct ContextLoad ContextLoad;
+
+int compare_context_loads(const void* a, const void* b)
+{
+    const ContextLoad* load_a = a;
+    const ContextLoad* load_b = b;
+    if (load_a->total != load_b->total)
+    {
+        return load_a->total > load_b->total ? -1 : 1;
+    }
+    return load_a->context - load_b->context;
+}
+
+ContextCoder* context_coder_new()
+{
+    ContextCoder* context = malloc( sizeof(ContextCoder) );
+    if (context == NULL)
+    {
+        return NULL;
+    }
+    memset(context, 0, sizeof(ContextCoder));
+    for (int t = 0; t < CONTEXT_MAX_TABLES; t++)
+    {
+        dt_init(&context->decode_tables[t]);
+    }
+    return context;
+}
+
+void context_coder_free(ContextCoder* context)
+{
+    if (context == NULL)
+    {
+        return;
+    }
+    for (int t = 0; t < CONTEXT_MAX_TABLES; t++)
+    {
+        dt_free(&context->decode_tables[t]);
+    }
+    free(context);
+}
+
+/*
+Sums the pair counts of the contexts using each table into table_counts
+Takes:
+- A pointer to the ContextCoder with pair counts, followers and context map filled in
+- An array of the contexts that occur in the block
+- The number of contexts in the array
+Returns:
+- Void
+*/
+void context_sum_tables(ContextCoder* context, const int used[], int num_used)
+{
+    memset(context->table_counts, 0, sizeof(context->table_counts));
+    for (int i = 0; i < num_used; i++)
+    {
+        int c = used[i];
+        uint64_t* table_counts = context->table_counts[context->context_map[c]];
+        for (int j = 0; j < context->num_followers[c]; j++)
+        {
+            int s = context->followers[c][j];
+            table_counts[s] += context->pair_counts[c][s];
+        }
+    }
+}
+
+/*
+Groups the contexts used in a block into at most num_tables tables
+The busiest contexts seed the tables, then each context is moved to whichever table's
+estimated code lengths give its bytes the fewest bits, CONTEXT_ITERATIONS times over.
+Tables left with no contexts are dropped and the rest renumbered.
+Takes:
+- A pointer to the ContextCoder with pair counts and followers filled in
+- An array of the contexts that occur in the block, busiest first
+- The number of contexts in the array
+- The number of tables to aim for (1 to num_used)
+Returns:
+- Void (the context map, num_tables and table_counts are filled in)
+*/
+void context_cluster(ContextCoder* context, const int used[], int num_used, int num_tables)
+{
+    // Every context starts in the first table and the busiest get a table each
+    memset(context->context_map, 0, sizeof(context->context_map));
+    for (int t = 0; t < num_tables; t++)
+    {
+        context->context_map[used[t]] = t;
+    }
+    context->num_tables = num_tables;
+    if (num_tables > 1)
+    {
+        // The seeds alone decide the first estimates, so the others can't drag table 0 about
+        memset(context->table_counts, 0, sizeof(context->table_counts));
+        for (int t = 0; t < num_tables; t++)
+        {
+            int c = used[t];
+            for (int s = 0; s < NUM_SYMBOLS; s++)
+            {
+                context->table_counts[t][s] = context->pair_counts[c][s];
+            }
+        }
+        for (int iteration = 0; iteration < CONTEXT_ITERATIONS; iteration++)
+        {
+            // Estimate code lengths from the table counts, smoothed so unseen bytes aren't free or infinite
+            for (int t = 0; t < num_tables; t++)
+            {
+                uint64_t total = 0;
+                for (int s = 0; s < NUM_SYMBOLS; s++)
+                {
+                    total += context->table_counts[t][s];
+                }
+                float total_bits = log2f(total + 0.5f * NUM_SYMBOLS);
+                for (int s = 0; s < NUM_SYMBOLS; s++)
+                {
+                    context->symbol_bits[t][s] = total_bits - log2f(context->table_counts[t][s] + 0.5f);
+                }
+            }
+            for (int i = 0; i < num_used; i++)
+            {
+                int c = used[i];
+                int best_table = 0;
+                float best_bits = 0;
+                for (int t = 0; t < num_tables; t++)
+                {
+                    float bits = 0;
+                    for (int j = 0; j < context->num_followers[c]; j++)
+                    {
+                        int s = context->followers[c][j];
+                        bits += context->pair_counts[c][s] * context->symbol_bits[t][s];
+                    }
+                    if (t == 0 || bits < best_bits)
+                    {
+                        best_table = t;
+                        best_bits = bits;
+                    }
+                }
+                context->context_map[c] = best_table;
+            }
+            context_sum_tables(context, used, num_used);
+        }
+    }
+    else
+    {
+        context_sum_tables(context, used, num_used);
+    }
+
+    // Drop empty tables, keeping the others in order
+    int renumber[CONTEXT_MAX_TABLES];
+    int num_kept = 0;
+    for (int t = 0; t < num_tables; t++)
+    {
+        bool empty = true;
+        for (int s = 0; s < NUM_SYMBOLS && empty; s++)
+        {
+            empty = context->table_counts[t][s] == 0;
+        }
+        renumber[t] = num_kept;
+        if (!empty)
+        {
+            if (num_kept != t)
+            {
+                memcpy(context->table_counts[num_kept], context->table_counts[t], sizeof(context->table_counts[t]));
+            }
+            num_kept++;
+        }
+    }
+    for (int c = 0; c < NUM_SYMBOLS; c++)
+    {
+        context->context_map[c] = renumber[context->context_map[c]];
+    }
+    // Unused contexts point at a kept table so the map is always valid
+    for (int c = 0; c < NUM_SYMBOLS; c++)
+    {
+        if (context->context_map[c] >= num_kept)
+        {
+            context->context_map[c] = 0;
+        }
+    }
+    context->num_tables = num_kept;
+}
+
+/*
+Decodes bytes from one bitstream, picking each byte's table by the byte before it
+Takes:
+- The decode table for each context
+- The longest code in any of the tables
+- A pointer to the BitReader
+- The previous byte (0 at the start of a segment)
+- A pointer to the destination buffer
+- The number of bytes to decode
+Returns:
+- Void
+*/
+void context_decode_run(const DecodeTable* context_tables[], int max_len, BitReader* br, uint8_t prev, uint8_t* dst, size_t size)
+{
+    size_t num_decoded = 0;
+    while (num_decoded < size)
+    {
+        // Refill for the longest code in any table, since the table changes with every byte
+        br_refill(br);
+        while (br->count >= max_len && num_decoded < size)
+        {
+            prev = (uint8_t)dt_decode_symbol(context_tables[prev], br);
+            dst[num_decoded] = prev;
+            num_decoded++;
+        }
+    }
+}
+
+long context_compress(BlockCoder* coder, const uint8_t* src, size_t src_size, uint8_t* body, size_t body_cap)
+{
+    ContextCoder* context = coder->context;
+    uint64_t start = get_time_ns();
+    memset(context->pair_counts, 0, sizeof(context->pair_counts));
+    int num_streams = coder->num_streams;
+    size_t segment_size = block_segment_size(src_size, num_streams);
+    for (size_t seg_start = 0; seg_start < src_size; seg_start += segment_size)
+    {
+        size_t seg_end = seg_start + segment_size < src_size ? seg_start + segment_size : src_size;
+        uint8_t prev = 0;
+        for (size_t i = seg_start; i < seg_end; i++)
+        {
+            context->pair_counts[prev][src[i]]++;
+            prev = src[i];
+        }
+    }
+
+    // Only the bytes that follow a context are looked at when weighing it up
+    ContextLoad loads[NUM_SYMBOLS];
+    int num_used = 0;
+    for (int c = 0; c < NUM_SYMBOLS; c++)
+    {
+        uint64_t total = 0;
+        int num_followers = 0;
+        for (int s = 0; s < NUM_SYMBOLS; s++)
+        {
+            uint32_t count = context->pair_counts[c][s];
+            if (count > 0)
+            {
+                context->followers[c][num_followers] = s;
+                num_followers++;
+                total += count;
+            }
+        }
+        context->num_followers[c] = num_followers;
+        if (total > 0)
+        {
+            loads[num_used].total = total;
+            loads[num_used].context = c;
+            num_used++;
+        }
+    }
+    qsort(loads, num_used, sizeof(ContextLoad), compare_context_loads);
+    int used[NUM_SYMBOLS];
+    for (int i = 0; i < num_used; i++)
+    {
+        used[i] = loads[i].context;
+    }
+    uint64_t counted = get_time_ns();
+    coder->phase_ns[PHASE_COUNT] += counted - start;
+
+    size_t num_tables = src_size / CONTEXT_BYTES_PER_TABLE;
+    if (num_tables < 1)
+    {
+        num_tables = 1;
+    }
+    if (num_tables > CONTEXT_MAX_TABLES)
+    {
+        num_tables = CONTEXT_MAX_TABLES;
+    }
+    if (num_tables > (size_t)num_used)
+    {
+        num_tables = num_used;
+    }
+    context_cluster(context, used, num_used, num_tables);
+
+    int max_len = CONTEXT_MAX_CODE_LEN;
+    if (coder->max_code_len > 0 && coder->max_code_len < max_len)
+    {
+        max_len = coder->max_code_len;
+    }
+    size_t map_size = context->num_tables > 1 ? NUM_SYMBOLS : 0;
+    size_t table_size = 1 + map_size;
+    for (int t = 0; t < context->num_tables; t++)
+    {
+        if (block_set_lengths(coder, context->table_counts[t], NUM_SYMBOLS, context->code_lengths[t], max_len) != 0 ||
+            canonical_assign_codes(context->code_lengths[t], context->codes[t], NUM_SYMBOLS) != 0)
+        {
+            return -1;
+        }
+        table_size += canonical_header_size(context->code_lengths[t], NUM_SYMBOLS);
+    }
+    uint64_t coded = get_time_ns();
+    coder->phase_ns[PHASE_CODES] += coded - counted;
+
+    uint64_t num_bits = 0;
+    const HuffCode* context_codes[NUM_SYMBOLS];
+    for (int c = 0; c < NUM_SYMBOLS; c++)
+    {
+        context_codes[c] = context->codes[context->context_map[c]];
+        for (int j = 0; j < context->num_followers[c]; j++)
+        {
+            int s = context->followers[c][j];
+            num_bits += (uint64_t)context->pair_counts[c][s] * context_codes[c][s].len;
+        }
+    }
+    size_t jump_size = (num_streams - 1) * BLOCK_JUMP_ENTRY_SIZE;
+    if (table_size + jump_size + bw_bytes_needed(num_bits) + num_streams - 1 > body_cap)
+    {
+        return -1;
+    }
+
+    uint8_t* header = body;
+    header[0] = (uint8_t)context->num_tables;
+    memcpy(header + 1, context->context_map, map_size);
+    size_t header_pos = 1 + map_size;
+    for (int t = 0; t < context->num_tables; t++)
+    {
+        header_pos += canonical_write_lengths(context->code_lengths[t], NUM_SYMBOLS, header + header_pos);
+    }
+    uint8_t* payload = header + table_size;
+    size_t payload_size = jump_size;
+    for (int s = 0; s < num_streams; s++)
+    {
+        size_t seg_start = s * segment_size < src_size ? s * segment_size : src_size;
+        size_t seg_end = seg_start + segment_size < src_size ? seg_start + segment_size : src_size;
+        BitWriter bw;
+        bw_init(&bw, payload + payload_size);
+        uint8_t prev = 0;
+        for (size_t i = seg_start; i < seg_end; i++)
+        {
+            bw_put_code(&bw, context_codes[prev][src[i]]);
+            prev = src[i];
+        }
+        size_t stream_size = bw_finish(&bw);
+        if (s < num_streams - 1)
+        {
+            put_u32(payload + s * BLOCK_JUMP_ENTRY_SIZE, (uint32_t)stream_size);
+        }
+        payload_size += stream_size;
+    }
+    coder->payload_bits += num_bits;
+    coder->phase_ns[PHASE_ENCODE] += get_time_ns() - coded;
+    return table_size + payload_size;
+}
+
+int context_decompress(BlockCoder* coder, const uint8_t* body, size_t body_size, uint8_t* dst, size_t raw_size)
+{
+    if (body_size < 1)
+    {
+        return -1;
+    }
+    ContextCoder* context = coder->context;
+    uint64_t start = get_time_ns();
+    const uint8_t* header = body;
+    int num_tables = header[0];
+    if (num_tables < 1 || num_tables > CONTEXT_MAX_TABLES)
+    {
+        return -1;
+    }
+    context->num_tables = num_tables;
+    size_t map_size = num_tables > 1 ? NUM_SYMBOLS : 0;
+    if (body_size < 1 + map_size)
+    {
+        return -1;
+    }
+    memset(context->context_map, 0, NUM_SYMBOLS);
+    memcpy(context->context_map, header + 1, map_size);
+    for (int c = 0; c < NUM_SYMBOLS; c++)
+    {
+        if (context->context_map[c] >= num_tables)
+        {
+            return -1;
+        }
+    }
+    size_t table_size = 1 + map_size;
+    int max_len = 0;
+    for (int t = 0; t < num_tables; t++)
+    {
+        long lengths_size = canonical_read_lengths(header + table_size, body_size - table_size,
+                                                   context->code_lengths[t], NUM_SYMBOLS);
+        if (lengths_size < 0 ||
+            canonical_assign_codes(context->code_lengths[t], context->codes[t], NUM_SYMBOLS) != 0 ||
+            dt_build(&context->decode_tables[t], context->codes[t], NUM_SYMBOLS) != 0)
+        {
+            return -1;
+        }
+        table_size += lengths_size;
+        if (context->decode_tables[t].max_len > max_len)
+        {
+            max_len = context->decode_tables[t].max_len;
+        }
+    }
+    const DecodeTable* context_tables[NUM_SYMBOLS];
+    for (int c = 0; c < NUM_SYMBOLS; c++)
+    {
+        context_tables[c] = &context->decode_tables[context->context_map[c]];
+    }
+
+    uint64_t built = get_time_ns();
+    coder->phase_ns[PHASE_DECODE_TABLE] += built - start;
+
+    int num_streams = coder->num_streams;
+    BitReader readers[BLOCK_MAX_STREAMS];
+    if (block_open_streams(header + table_size, body_size - table_size, num_streams, readers) != 0)
+    {
+        return -1;
+    }
+    size_t segment_size = block_segment_size(raw_size, num_streams);
+    size_t full_size = (num_streams - 1) * segment_size;
+    size_t last_size = raw_size > full_size ? raw_size - full_size : 0;
+    uint8_t prevs[BLOCK_MAX_STREAMS] = {0};
+    size_t num_decoded = 0;
+    if (num_streams > 1)
+    {
+        // Decode all the streams side by side as far as the shortest segment, as for order 0
+        size_t per_refill = 57 / max_len;
+        while (last_size - num_decoded >= per_refill)
+        {
+            for (int s = 0; s < num_streams; s++)
+            {
+                br_refill(&readers[s]);
+            }
+            for (size_t k = 0; k < per_refill; k++)
+            {
+                for (int s = 0; s < num_streams; s++)
+                {
+                    prevs[s] = (uint8_t)dt_decode_symbol(context_tables[prevs[s]], &readers[s]);
+                    dst[s * segment_size + num_decoded] = prevs[s];
+                }
+                num_decoded++;
+            }
+        }
+    }
+    for (int s = 0; s < num_streams; s++)
+    {
+        size_t seg_start = s * segment_size < raw_size ? s * segment_size : raw_size;
+        size_t seg_end = seg_start + segment_size < raw_size ? seg_start + segment_size : raw_size;
+        if (seg_end - seg_start > num_decoded)
+        {
+            context_decode_run(context_tables, max_len, &readers[s], prevs[s], dst + seg_start + num_decoded, seg_end - seg_start - num_decoded);
+        }
+    }
+    coder->phase_ns[PHASE_DECODE] += get_time_ns() - built;
+    return 0;
+}
@@ -0,0 +1,112 @@
+// chuff_context.h
+// Ben Crabtree, 2021
+
+# ifndef CHUFF_CONTEXT_H
+# define CHUFF_CONTEXT_H
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdint.h>
+# include <string.h>
+
+# include "chuff_shared.h"
+# include "chuff_bitstream.h"
+# include "chuff_decode_table.h"
+# include "chuff_canonical.h"
+# include "chuff_package_merge.h"
+# include "chuff_heap.h"
+# include "chuff_huffman_tree.h"
+# include "chuff_block.h"
+
+// Most code tables an order-1 block can have
+# define CONTEXT_MAX_TABLES 32
+// A table is only worth its header for about this many bytes of data
+# define CONTEXT_BYTES_PER_TABLE 8192
+// Rounds of reassigning contexts to the table that codes them best
+# define CONTEXT_ITERATIONS 3
+// Codes are kept to this length (or max_code_len if lower) so many decode tables stay small
+# define CONTEXT_MAX_CODE_LEN 15
+// Table count, context map and the biggest possible code lengths headers
+# define CONTEXT_MAX_TABLES_SIZE (1 + NUM_SYMBOLS + CONTEXT_MAX_TABLES * (CANONICAL_COUNT_SIZE + NUM_SYMBOLS))
+
+/*
+Order-1 context model: each byte is coded with a table picked by the byte before it
+Contexts whose following bytes look alike share a table, so a block needs at most
+CONTEXT_MAX_TABLES tables however many contexts it uses. Tables are chosen by clustering:
+the busiest contexts seed the tables, then each context moves to whichever table would
+code its bytes in the fewest bits, and the tables are rebuilt, a few times over.
+
+An order-1 block is laid out as:
+- Block header (see chuff_block.h)
+- 1 byte number of tables
+- 256 bytes context map: the table used after each byte value (the first byte uses context 0),
+  left out when there is only one table
+- A code lengths header (see canonical_write_lengths()) per table
+- Bit-packed payload, split into streams as for an order-0 block (see chuff_block.h)
+- Checksum, if the stream has them
+Each stream's segment starts again from context 0, so the streams can be decoded side by side.
+*/
+struct ContextCoder
+{
+    uint32_t pair_counts[NUM_SYMBOLS][NUM_SYMBOLS]; // [previous byte][byte]
+    uint8_t context_map[NUM_SYMBOLS];
+    int num_tables;
+    int code_lengths[CONTEXT_MAX_TABLES][NUM_SYMBOLS];
+    HuffCode codes[CONTEXT_MAX_TABLES][NUM_SYMBOLS];
+    DecodeTable decode_tables[CONTEXT_MAX_TABLES];
+    // Scratch space for clustering
+    uint64_t table_counts[CONTEXT_MAX_TABLES][NUM_SYMBOLS];
+    float symbol_bits[CONTEXT_MAX_TABLES][NUM_SYMBOLS]; // Estimated cost of each byte in each table
+    uint8_t followers[NUM_SYMBOLS][NUM_SYMBOLS]; // Bytes seen after each context
+    int num_followers[NUM_SYMBOLS];
+};
+
+typedef struct ContextCoder ContextCoder;
+
+/*
+Allocates and initialises a ContextCoder
+Takes:
+- Nothing
+Returns:
+- A pointer to the new ContextCoder, or NULL if memory runs out
+*/
+ContextCoder* context_coder_new();
+
+/*
+Frees a ContextCoder and its decode tables
+Takes:
+- A pointer to the ContextCoder (NULL is allowed)
+Returns:
+- Void
+*/
+void context_coder_free(ContextCoder* context);
+
+/*
+Compresses one block's body (everything after the block header) with the order-1 model,
+using the BlockCoder's ContextCoder, code length limit and tree, and adding to its stats
+block_compress() calls this and writes the block header and checksum around it.
+Takes:
+- A pointer to a BlockCoder with a ContextCoder
+- A pointer to the raw data
+- The size of the raw data (1 to UINT32_MAX bytes)
+- A pointer to where the body goes
+- The room left for the body
+Returns:
+- The body size in bytes, or -1 if there isn't room
+*/
+long context_compress(BlockCoder* coder, const uint8_t* src, size_t src_size, uint8_t* body, size_t body_cap);
+
+/*
+Decompresses one block body written by context_compress()
+Takes:
+- A pointer to a BlockCoder with a ContextCoder
+- A pointer to the body, just after the block header
+- The size of the body, not counting any checksum
+- A pointer to the destination buffer
+- The raw size of the block, from its header (dst must have room for it)
+Returns:
+- 0 on success, -1 if the body is malformed
+*/
+int context_decompress(BlockCoder* coder, const uint8_t* body, size_t body_size, uint8_t* dst, size_t raw_size);
+
+# endif
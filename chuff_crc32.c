@@ -0,0 +1,60 @@
+// chuff_crc32.c
+// Ben Crabtree, 2021
+
+# include <pthread.h>
+
+# include "chuff_crc32.h"
+
+// Reversed CRC-32 polynomial
+# define CRC32_POLY 0xEDB88320u
+
+// crc_tables[k][b] is the CRC of byte b followed by k zero bytes
+static uint32_t crc_tables[8][256];
+static pthread_once_t crc_tables_once = PTHREAD_ONCE_INIT;
+
+void crc32_build_tables()
+{
+    for (uint32_t b = 0; b < 256; b++)
+    {
+        uint32_t crc = b;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (CRC32_POLY & (0 - (crc & 1)));
+        }
+        crc_tables[0][b] = crc;
+    }
+    for (int k = 1; k < 8; k++)
+    {
+        for (int b = 0; b < 256; b++)
+        {
+            uint32_t prev = crc_tables[k - 1][b];
+            crc_tables[k][b] = (prev >> 8) ^ crc_tables[0][prev & 0xFF];
+        }
+    }
+}
+
+uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t size)
+{
+    // Blocks are checksummed on several worker threads, so the tables are built exactly once
+    pthread_once(&crc_tables_once, crc32_build_tables);
+    crc = ~crc;
+    while (size >= 8)
+    {
+        // Fold the first 4 bytes into the running CRC, then look all 8 up at once
+        uint32_t low = crc ^ ((uint32_t)data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24);
+        uint32_t high = (uint32_t)data[4] | (uint32_t)data[5] << 8 | (uint32_t)data[6] << 16 | (uint32_t)data[7] << 24;
+        crc = crc_tables[7][low & 0xFF] ^ crc_tables[6][(low >> 8) & 0xFF]
+            ^ crc_tables[5][(low >> 16) & 0xFF] ^ crc_tables[4][low >> 24]
+            ^ crc_tables[3][high & 0xFF] ^ crc_tables[2][(high >> 8) & 0xFF]
+            ^ crc_tables[1][(high >> 16) & 0xFF] ^ crc_tables[0][high >> 24];
+        data += 8;
+        size -= 8;
+    }
+    while (size > 0)
+    {
+        crc = (crc >> 8) ^ crc_tables[0][(crc ^ *data) & 0xFF];
+        data++;
+        size--;
+    }
+    return ~crc;
+}
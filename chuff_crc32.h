@@ -0,0 +1,25 @@
+// chuff_crc32.h
+// Ben Crabtree, 2021
+
+# ifndef CHUFF_CRC32_H
+# define CHUFF_CRC32_H
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdint.h>
+# include <string.h>
+
+/*
+Works out the CRC-32 of a buffer (the same one as zlib, gzip and PNG use)
+Works through 8 bytes per step with 8 lookup tables (slicing-by-8), which are built on first use.
+Calls can be chained to checksum data that arrives in pieces: pass the result of one call as crc to the next.
+Takes:
+- The CRC-32 so far, or 0 to start
+- A pointer to the data
+- The size of the data in bytes
+Returns:
+- The updated CRC-32
+*/
+uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t size);
+
+# endif
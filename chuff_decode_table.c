@@ -0,0 +1,122 @@
+// chuff_decode_table.c
+// Ben Crabtree, 2021
+
+# include "chuff_decode_table.h"
+
+void dt_init(DecodeTable* table)
+{
+    table->entries = NULL;
+    table->num_entries = 0;
+    table->cap = 0;
+    table->max_len = 0;
+}
+
+int dt_build(DecodeTable* table, HuffCode codes[], int num_symbols)
+{
+    table->num_entries = 0;
+    table->max_len = 0;
+    for (int i = 0; i < num_symbols; i++)
+    {
+        if (codes[i].len > table->max_len)
+        {
+            table->max_len = codes[i].len;
+        }
+    }
+    if (table->max_len == 0 || table->max_len > 56)
+    {
+        return -1;
+    }
+    int primary_bits = table->max_len < DECODE_TABLE_BITS ? table->max_len : DECODE_TABLE_BITS;
+    int primary_size = 1 << primary_bits;
+    table->primary_bits = primary_bits;
+
+    // Work out how many extra bits each group of long codes sharing a primary prefix needs
+    int sub_bits[1 << DECODE_TABLE_BITS] = {0};
+    for (int i = 0; i < num_symbols; i++)
+    {
+        if (codes[i].len > primary_bits)
+        {
+            int extra = codes[i].len - primary_bits;
+            uint64_t prefix = codes[i].bits >> extra;
+            if (extra > sub_bits[prefix])
+            {
+                sub_bits[prefix] = extra;
+            }
+        }
+    }
+
+    // Lay the secondary tables out one after another behind the primary table
+    uint64_t num_entries = primary_size;
+    for (int i = 0; i < primary_size; i++)
+    {
+        if (sub_bits[i] > 0)
+        {
+            num_entries += (uint64_t)1 << sub_bits[i];
+        }
+    }
+    if (num_entries > INT32_MAX)
+    {
+        return -1;
+    }
+    if (num_entries > (uint64_t)table->cap)
+    {
+        DecodeEntry* entries = realloc(table->entries, num_entries * sizeof(DecodeEntry));
+        if (entries == NULL)
+        {
+            return -1;
+        }
+        table->entries = entries;
+        table->cap = (int)num_entries;
+    }
+    memset(table->entries, 0, num_entries * sizeof(DecodeEntry));
+    table->num_entries = (int)num_entries;
+    uint32_t next_sub_table = primary_size;
+    for (int i = 0; i < primary_size; i++)
+    {
+        if (sub_bits[i] > 0)
+        {
+            table->entries[i].value = next_sub_table;
+            table->entries[i].len = 0;
+            table->entries[i].sub_bits = sub_bits[i];
+            next_sub_table += (uint32_t)1 << sub_bits[i];
+        }
+    }
+
+    // Fill in every slot whose index starts with each code
+    for (int i = 0; i < num_symbols; i++)
+    {
+        int len = codes[i].len;
+        if (len == 0)
+        {
+            continue;
+        }
+        uint64_t first;
+        uint64_t count;
+        if (len <= primary_bits)
+        {
+            first = codes[i].bits << (primary_bits - len);
+            count = (uint64_t)1 << (primary_bits - len);
+        }
+        else
+        {
+            int extra = len - primary_bits;
+            DecodeEntry* link = &table->entries[codes[i].bits >> extra];
+            uint64_t rest = codes[i].bits & (((uint64_t)1 << extra) - 1);
+            first = link->value + (rest << (link->sub_bits - extra));
+            count = (uint64_t)1 << (link->sub_bits - extra);
+        }
+        for (uint64_t j = 0; j < count; j++)
+        {
+            table->entries[first + j].value = i;
+            table->entries[first + j].len = len;
+            table->entries[first + j].sub_bits = 0;
+        }
+    }
+    return 0;
+}
+
+void dt_free(DecodeTable* table)
+{
+    free(table->entries);
+    dt_init(table);
+}
@@ -0,0 +1,95 @@
+// chuff_decode_table.h
+// Ben Crabtree, 2021
+
+# ifndef CHUFF_DECODE_TABLE_H
+# define CHUFF_DECODE_TABLE_H
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdint.h>
+# include <string.h>
+
+# include "chuff_bitstream.h"
+
+// Number of bits looked up at once in the primary table
+# define DECODE_TABLE_BITS 11
+
+/*
+One slot of a decode table
+In the primary table a slot either holds a symbol directly (len > 0)
+or links to a secondary table for codes longer than the primary table bits (len == 0).
+*/
+struct DecodeEntry
+{
+    uint32_t value; // Symbol, or index of the first slot of the secondary table for a link
+    uint8_t len; // Full code length of the symbol, or 0 for a link
+    uint8_t sub_bits; // For a link, number of extra bits indexing the secondary table
+};
+
+typedef struct DecodeEntry DecodeEntry;
+
+struct DecodeTable
+{
+    DecodeEntry* entries; // Primary table followed by all secondary tables
+    int num_entries;
+    int cap; // Number of entries allocated, kept across dt_build() calls
+    int primary_bits; // Bits indexing the primary table (DECODE_TABLE_BITS or the max code length if smaller)
+    int max_len; // Longest code in the table
+};
+
+typedef struct DecodeTable DecodeTable;
+
+/*
+Initialises an empty DecodeTable
+Takes:
+- A pointer to the DecodeTable
+Returns:
+- Void
+*/
+void dt_init(DecodeTable* table);
+
+/*
+Builds a decode table for a prefix code:
+- Each code of up to primary_bits bits fills every primary slot starting with that code
+- Longer codes are grouped by their first primary_bits bits,
+  each group getting a secondary table indexed by the remaining bits
+Takes:
+- A pointer to an initialised DecodeTable to fill in (its memory is reused if big enough)
+- An array of HuffCodes indexed by symbol (len 0 for unused symbols)
+- The number of symbols in the array
+Returns:
+- 0 on success, -1 if there are no codes, a code is too long to look up (> 56 bits) or memory runs out
+*/
+int dt_build(DecodeTable* table, HuffCode codes[], int num_symbols);
+
+/*
+Frees the entries of a DecodeTable
+Takes:
+- A pointer to the DecodeTable
+Returns:
+- Void
+*/
+void dt_free(DecodeTable* table);
+
+/*
+Decodes one symbol with at most two table lookups
+The reader must hold at least max_len bits (call br_refill() first)
+Takes:
+- A pointer to the DecodeTable
+- A pointer to the BitReader to consume the code from
+Returns:
+- The decoded symbol
+*/
+static inline uint32_t dt_decode_symbol(const DecodeTable* table, BitReader* br)
+{
+    DecodeEntry entry = table->entries[br_peek(br, table->primary_bits)];
+    if (entry.len == 0)
+    {
+        uint64_t sub_index = br_peek(br, table->primary_bits + entry.sub_bits) & (((uint64_t)1 << entry.sub_bits) - 1);
+        entry = table->entries[entry.value + sub_index];
+    }
+    br_consume(br, entry.len);
+    return entry.value;
+}
+
+# endif
@@ -0,0 +1,91 @@
+// chuff_heap.c
+// Ben Crabtree, 2021
+
+# include "chuff_heap.h"
+
+void heap_init(HTHeap* heap, HTree* tree)
+{
+    heap->nodes = tree->heap_nodes;
+    heap->size = 0;
+    heap->tree_nodes = tree->nodes;
+}
+
+void heap_push(HTHeap* heap, uint32_t node)
+{
+    HTNode* tree_nodes = heap->tree_nodes;
+    int64_t freq = tree_nodes[node].freq;
+    int i = heap->size;
+    heap->size++;
+    // Move parents down until node's spot is found
+    while (i > 0)
+    {
+        int parent = (i - 1) / 2;
+        if (tree_nodes[heap->nodes[parent]].freq <= freq)
+        {
+            break;
+        }
+        heap->nodes[i] = heap->nodes[parent];
+        i = parent;
+    }
+    heap->nodes[i] = node;
+}
+
+uint32_t heap_pop(HTHeap* heap)
+{
+    HTNode* tree_nodes = heap->tree_nodes;
+    uint32_t min = heap->nodes[0];
+    heap->size--;
+    uint32_t last = heap->nodes[heap->size];
+    int64_t last_freq = tree_nodes[last].freq;
+    int i = 0;
+    // Move smaller children up until the last node's spot is found
+    while (true)
+    {
+        int child = 2 * i + 1;
+        if (child >= heap->size)
+        {
+            break;
+        }
+        if (child + 1 < heap->size && tree_nodes[heap->nodes[child + 1]].freq < tree_nodes[heap->nodes[child]].freq)
+        {
+            child++;
+        }
+        if (last_freq <= tree_nodes[heap->nodes[child]].freq)
+        {
+            break;
+        }
+        heap->nodes[i] = heap->nodes[child];
+        i = child;
+    }
+    heap->nodes[i] = last;
+    return min;
+}
+
+int ht_build(HTree* tree, uint64_t counts[], int num_symbols)
+{
+    ht_reset(tree, num_symbols);
+    HTHeap heap;
+    heap_init(&heap, tree);
+    for (int i = 0; i < num_symbols; i++)
+    {
+        // We're only interested in symbols with frequency > 0
+        if (counts[i] > 0)
+        {
+            heap_push(&heap, htnode_init(tree, counts[i], i));
+        }
+    }
+    if (heap.size == 0)
+    {
+        return -1;
+    }
+    while (heap.size > 1) // Loop until there is one node left in the heap
+    {
+        uint32_t htnode_left = heap_pop(&heap);
+        tree->nodes[htnode_left].code = '0';
+        uint32_t htnode_right = heap_pop(&heap);
+        tree->nodes[htnode_right].code = '1';
+        heap_push(&heap, htparent_init(tree, htnode_left, htnode_right));
+    }
+    tree->root = heap_pop(&heap); // Last node left is the root of the Huffman tree
+    return 0;
+}
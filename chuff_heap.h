@@ -0,0 +1,73 @@
+// chuff_heap.h
+// Ben Crabtree, 2021
+
+# ifndef CHUFF_HEAP_H
+# define CHUFF_HEAP_H
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdbool.h>
+# include <stdint.h>
+# include <string.h>
+
+# include "chuff_huffman_tree.h"
+
+/*
+Binary min-heap of HTNode indices into a HTree, ordered by freq
+Stored as an array where the children of nodes[i] are nodes[2i+1] and nodes[2i+2],
+so inserting and removing the minimum are O(log n) instead of a linear scan.
+*/
+struct HTHeap
+{
+    uint32_t* nodes;
+    int size;
+    HTNode* tree_nodes; // The HTree's node array, to look up freqs
+};
+
+typedef struct HTHeap HTHeap;
+
+/*
+Initialises an empty HTHeap using the HTree's scratch space, so it needs no memory of its own
+Takes:
+- A pointer to the HTHeap
+- A pointer to the HTree the indices refer to
+Returns:
+- Void
+*/
+void heap_init(HTHeap* heap, HTree* tree);
+
+/*
+Inserts a HTNode index, sifting it up until its parent has a smaller or equal freq
+Takes:
+- A pointer to the HTHeap
+- The index of the HTNode to insert
+Returns:
+- Void
+*/
+void heap_push(HTHeap* heap, uint32_t node);
+
+/*
+Removes the HTNode with the smallest freq, moving the last node to the top and sifting it down
+Takes:
+- A pointer to a non-empty HTHeap
+Returns:
+- The index of the removed HTNode
+*/
+uint32_t heap_pop(HTHeap* heap);
+
+/*
+Builds a Huffman tree
+Uses the heap functions, so it goes in here
+- Resets the HTree and adds a leaf for each symbol with non-zero count to a heap
+- Keeps taking the two least frequent nodes and joining them under a new parent
+  which goes back into the heap, until one node (the root) is left
+Takes:
+- A pointer to the HTree to build in (any tree already in it is thrown away)
+- An array of counts indexed by symbol
+- The number of symbols in the array (the alphabet size, which can be much larger than 256)
+Returns:
+- 0 on success with tree->root set, or -1 if every count is 0
+*/
+int ht_build(HTree* tree, uint64_t counts[], int num_symbols);
+
+# endif
@@ -0,0 +1,98 @@
+// chuff_histogram.c
+// Ben Crabtree, 2021
+
+# include <math.h>
+
+# include "chuff_histogram.h"
+
+# ifdef __SSE2__
+# include <emmintrin.h>
+# endif
+
+// Each table sees at most a quarter of a chunk, so 32-bit entries can't overflow
+# define HISTOGRAM_CHUNK_SIZE ((size_t)1 << 30)
+
+void histogram_merge(uint32_t tables[4][NUM_SYMBOLS], uint64_t counts[])
+{
+# ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+    for (int i = 0; i < NUM_SYMBOLS; i += 4)
+    {
+        __m128i sum = _mm_loadu_si128((const __m128i*)&tables[0][i]);
+        sum = _mm_add_epi32(sum, _mm_loadu_si128((const __m128i*)&tables[1][i]));
+        sum = _mm_add_epi32(sum, _mm_loadu_si128((const __m128i*)&tables[2][i]));
+        sum = _mm_add_epi32(sum, _mm_loadu_si128((const __m128i*)&tables[3][i]));
+        // Widen the four 32-bit sums to 64 bits and add them to the running counts
+        __m128i low = _mm_unpacklo_epi32(sum, zero);
+        __m128i high = _mm_unpackhi_epi32(sum, zero);
+        __m128i* dst = (__m128i*)&counts[i];
+        _mm_storeu_si128(dst, _mm_add_epi64(_mm_loadu_si128(dst), low));
+        _mm_storeu_si128(dst + 1, _mm_add_epi64(_mm_loadu_si128(dst + 1), high));
+    }
+# else
+    for (int i = 0; i < NUM_SYMBOLS; i++)
+    {
+        counts[i] += (uint64_t)tables[0][i] + tables[1][i] + tables[2][i] + tables[3][i];
+    }
+# endif
+}
+
+void histogram_count_chunk(const uint8_t* src, size_t size, uint32_t tables[4][NUM_SYMBOLS])
+{
+    size_t i = 0;
+    // Read 8 bytes at a time and spread them over the 4 tables
+    for ( ; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, src + i, sizeof(word));
+        tables[0][word & 0xff]++;
+        tables[1][(word >> 8) & 0xff]++;
+        tables[2][(word >> 16) & 0xff]++;
+        tables[3][(word >> 24) & 0xff]++;
+        tables[0][(word >> 32) & 0xff]++;
+        tables[1][(word >> 40) & 0xff]++;
+        tables[2][(word >> 48) & 0xff]++;
+        tables[3][word >> 56]++;
+    }
+    for ( ; i < size; i++)
+    {
+        tables[i & 3][src[i]]++;
+    }
+}
+
+void histogram_count(const uint8_t* src, size_t size, uint64_t counts[])
+{
+    uint32_t tables[4][NUM_SYMBOLS];
+    while (size > 0)
+    {
+        size_t chunk_size = size < HISTOGRAM_CHUNK_SIZE ? size : HISTOGRAM_CHUNK_SIZE;
+        memset(tables, 0, sizeof(tables));
+        histogram_count_chunk(src, chunk_size, tables);
+        histogram_merge(tables, counts);
+        src += chunk_size;
+        size -= chunk_size;
+    }
+}
+
+double histogram_entropy(const uint64_t counts[], int num_symbols)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < num_symbols; i++)
+    {
+        total += counts[i];
+    }
+    if (total == 0)
+    {
+        return 0;
+    }
+    double entropy = 0;
+    for (int i = 0; i < num_symbols; i++)
+    {
+        if (counts[i] > 0)
+        {
+            double p = (double)counts[i] / total;
+            entropy -= p * log2(p);
+        }
+    }
+    return entropy;
+}
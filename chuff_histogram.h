@@ -0,0 +1,39 @@
+// chuff_histogram.h
+// Ben Crabtree, 2021
+
+# ifndef CHUFF_HISTOGRAM_H
+# define CHUFF_HISTOGRAM_H
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdint.h>
+# include <string.h>
+
+# include "chuff_shared.h"
+
+/*
+Counts every byte value in a buffer and adds the counts to counts[]
+Works on any data, not just text. Bytes are counted into 4 separate 32-bit tables in turn,
+so a run of the same byte doesn't make each increment wait for the previous one to be stored.
+The tables are merged into the 64-bit counts (with SSE2 where available) every 1 GiB and at the end.
+Takes:
+- A pointer to the data
+- The size of the data in bytes
+- An array of NUM_SYMBOLS 64-bit counts indexed by byte value
+Returns:
+- Void
+*/
+void histogram_count(const uint8_t* src, size_t size, uint64_t counts[]);
+
+/*
+Works out the Shannon entropy of a set of counts, the fewest bits per symbol any
+order-0 code could average on that data
+Takes:
+- An array of counts indexed by symbol
+- The number of symbols in the array
+Returns:
+- The entropy in bits per symbol, or 0 if every count is 0
+*/
+double histogram_entropy(const uint64_t counts[], int num_symbols);
+
+# endif
@@ -3,41 +3,111 @@
 
 # include "chuff_huffman_tree.h"
 
-HTNode* htnode_init(int freq, int cs)
+void ht_init(HTree* tree)
 {
-    HTNode* node = malloc( sizeof(HTNode) );
-    node->left = NULL;
-    node->right = NULL;
+    tree->nodes = NULL;
+    tree->num_nodes = 0;
+    tree->cap = 0;
+    tree->root = HT_NULL;
+    tree->heap_nodes = NULL;
+}
+
+void ht_free(HTree* tree)
+{
+    free(tree->nodes);
+    free(tree->heap_nodes);
+    ht_init(tree);
+}
+
+void ht_reset(HTree* tree, int num_symbols)
+{
+    uint32_t needed = num_symbols > 0 ? 2 * (uint32_t)num_symbols - 1 : 1;
+    if (needed > tree->cap)
+    {
+        free(tree->nodes);
+        free(tree->heap_nodes);
+        tree->nodes = malloc( needed * sizeof(HTNode) );
+        tree->heap_nodes = malloc( needed * sizeof(uint32_t) );
+        tree->cap = needed;
+    }
+    tree->num_nodes = 0;
+    tree->root = HT_NULL;
+}
+
+uint32_t htnode_init(HTree* tree, int64_t freq, Symbol cs)
+{
+    uint32_t i = tree->num_nodes++;
+    HTNode* node = &tree->nodes[i];
+    node->left = HT_NULL;
+    node->right = HT_NULL;
     node->freq = freq;
     node->cs = cs;
-    node->visited = false;
+    node->depth = 0;
     node->code = 'X';
-    return node;
+    return i;
 }
 
-HTNode* htparent_init(HTNode* left_child, HTNode* right_child)
+uint32_t htparent_init(HTree* tree, uint32_t left_child, uint32_t right_child)
 {
-    HTNode* node = malloc( sizeof(HTNode) );
+    uint32_t i = tree->num_nodes++;
+    HTNode* node = &tree->nodes[i];
     node->left = left_child;
     node->right = right_child;
-    node->freq = left_child->freq + right_child->freq;
-    node->cs = left_child->cs + right_child->cs;
-    node->visited = false;
+    node->freq = tree->nodes[left_child].freq + tree->nodes[right_child].freq;
+    node->cs = tree->nodes[left_child].cs + tree->nodes[right_child].cs;
+    node->depth = 0;
     node->code = 'X';
-    return node;
+    return i;
 }
 
-void ht_print(HTNode* ht)
+void ht_print(HTree* tree)
 {
-    HTNode* curr = ht;
-    if (curr->left != NULL && curr->right != NULL)
+    // Parents come after their children, so going backwards prints from the root down
+    for (uint32_t i = tree->num_nodes; i-- > 0; )
     {
-        printf("       {%d, %d, %c}\n", curr->freq, curr->cs, curr->code);
+        HTNode* curr = &tree->nodes[i];
+        if (curr->left == HT_NULL)
+        {
+            continue;
+        }
+        HTNode* left = &tree->nodes[curr->left];
+        HTNode* right = &tree->nodes[curr->right];
+        printf("       {%lld, %u, %c}\n", (long long)curr->freq, curr->cs, curr->code);
         printf("          /   \\ \n");
-        printf("{%d, %d, %c}", curr->left->freq, curr->left->cs, curr->left->code);
-        printf("    {%d, %d, %c}\n", curr->right->freq, curr->right->cs, curr->right->code);
+        printf("{%lld, %u, %c}", (long long)left->freq, left->cs, left->code);
+        printf("    {%lld, %u, %c}\n", (long long)right->freq, right->cs, right->code);
         printf("\n");
-        ht_print(curr->left);
-        ht_print(curr->right);
     }
 }
+
+int ht_get_code_lengths(HTree* tree, int code_lengths[])
+{
+    HTNode* nodes = tree->nodes;
+    // A lone leaf still needs a 1 bit code
+    if (nodes[tree->root].left == HT_NULL)
+    {
+        code_lengths[nodes[tree->root].cs] = 1;
+        return 1;
+    }
+
+    // Every parent comes after its children, so walking backwards from the root
+    // always reaches a node after its parent has set its depth
+    int max_len = 0;
+    nodes[tree->root].depth = 0;
+    for (uint32_t i = tree->root + 1; i-- > 0; )
+    {
+        HTNode* node = &nodes[i];
+        if (node->left == HT_NULL)
+        {
+            code_lengths[node->cs] = node->depth;
+            if (node->depth > max_len)
+            {
+                max_len = node->depth;
+            }
+            continue;
+        }
+        nodes[node->left].depth = node->depth + 1;
+        nodes[node->right].depth = node->depth + 1;
+    }
+    return max_len;
+}
@@ -7,59 +7,122 @@
 # include <stdio.h>
 # include <stdlib.h>
 # include <stdbool.h>
+# include <stdint.h>
 # include <string.h>
 
+# include "chuff_shared.h"
+
+// Index used for a missing child
+# define HT_NULL UINT32_MAX
+
 struct HTNode
 {
-    struct HTNode* left;
-    struct HTNode* right;
-    int freq;
-    int cs; // Int representation of ascii character (or sum of ascii characters)
-    bool visited; // For use in dfs() to set huffman encodings
+    int64_t freq;
+    uint32_t left; // Index of the left child in the HTree, or HT_NULL for a leaf
+    uint32_t right; // Index of the right child in the HTree, or HT_NULL for a leaf
+    Symbol cs; // Symbol for a leaf (or sum of the symbols below it for a parent)
+    uint16_t depth; // Filled in by ht_get_code_lengths()
     char code; // 1 or 0 depending on if this is a left or right child of another node
 };
 
 typedef struct HTNode HTNode;
 
 /*
-Initialises a HTNode:
-- Allocates memory
+Arena holding every node of a Huffman tree in one array
+Nodes refer to their children by index, and a parent is always added after its children.
+Building a tree takes no allocations once the arena is big enough, and ht_reset()
+throws the whole tree away at once, so one HTree can be reused for any number of blocks.
+*/
+struct HTree
+{
+    HTNode* nodes;
+    uint32_t num_nodes;
+    uint32_t cap;
+    uint32_t root;
+    uint32_t* heap_nodes; // Scratch space of cap indices for ht_build()'s heap
+};
+
+typedef struct HTree HTree;
+
+/*
+Initialises an empty HTree
+Takes:
+- A pointer to the HTree
+Returns:
+- Void
+*/
+void ht_init(HTree* tree);
+
+/*
+Frees the arrays of a HTree
+Takes:
+- A pointer to the HTree
+Returns:
+- Void
+*/
+void ht_free(HTree* tree);
+
+/*
+Makes sure a HTree can hold a tree over num_symbols symbols (2 * num_symbols - 1 nodes)
+and empties it, keeping its memory for reuse
+Takes:
+- A pointer to the HTree
+- The number of symbols the next tree will have at most
+Returns:
+- Void
+*/
+void ht_reset(HTree* tree, int num_symbols);
+
+/*
+Adds a leaf HTNode:
 - Set frequency and cs using values passed in as arguments
-- Sets left and right children to NULL
-- Set visited to false
+- Sets left and right children to HT_NULL
 - Sets code to 'X'
 Takes:
-- An int freq
-- An int cs
+- A pointer to a HTree with room for the node
+- An int64_t freq
+- A Symbol cs
 Returns:
-- A pointer to the initialised HTNode
+- The index of the new HTNode
 */
-HTNode* htnode_init(int freq, int cs);
+uint32_t htnode_init(HTree* tree, int64_t freq, Symbol cs);
 
 /*
-Initialise a parent HTNode:
-- Allocates memory
-- Sets left and right to point at HTNodes passed in as arguments
+Adds a parent HTNode:
+- Sets left and right to the indices passed in as arguments
 - Sets frequency to freq of left_child + freq of right_child
 - Sets cs to cs of left_child + cs of right_child
-- Sets visited to false
 - Sets code to 'X'
 Takes:
-- A pointer to a HTNode left_child
-- A pointer to a HTNode right_child
+- A pointer to a HTree with room for the node
+- The index of the left child
+- The index of the right child
 Returns:
-- A pointer to the initialised HTNode
+- The index of the new HTNode
 */
-HTNode* htparent_init(HTNode* left_child, HTNode* right_child);
+uint32_t htparent_init(HTree* tree, uint32_t left_child, uint32_t right_child);
 
 /*
 Prints Huffman tree as series of stumps (parent and two children)
 Each node printed is of the form {freq, cs, code}
 Takes:
-- A pointer to a HTNode which is the root of a Huffman tree
+- A pointer to a HTree holding a built tree
 Returns:
 - Void
 */
-void ht_print(HTNode* ht);
+void ht_print(HTree* tree);
+
+/*
+Reduces a Huffman tree to the code length of each character, which is all canonical codes need
+The length of a symbol's code is the depth of its leaf. If the root is itself a leaf it gets length 1.
+Depths are worked out in one pass from the root down the node array, so even very deep trees
+need no recursion.
+Takes:
+- A pointer to a HTree holding a built tree
+- An int array of code lengths indexed by symbol, which must start out all 0
+Returns:
+- The longest code length
+*/
+int ht_get_code_lengths(HTree* tree, int code_lengths[]);
 
-# endif
\ No newline at end of file
+# endif
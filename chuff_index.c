@@ -0,0 +1,129 @@
+// chuff_index.c
+// Ben Crabtree, 2021
+
+# include "chuff_index.h"
+
+void index_init(BlockIndex* index)
+{
+    index->entries = NULL;
+    index->num_entries = 0;
+    index->cap = 0;
+    index->raw_size = 0;
+}
+
+void index_free(BlockIndex* index)
+{
+    free(index->entries);
+    index_init(index);
+}
+
+void index_reset(BlockIndex* index)
+{
+    index->num_entries = 0;
+    index->raw_size = 0;
+}
+
+void index_add(BlockIndex* index, uint64_t raw_offset, uint64_t raw_size, uint64_t comp_offset)
+{
+    if (index->num_entries == index->cap)
+    {
+        index->cap = index->cap == 0 ? 64 : 2 * index->cap;
+        index->entries = realloc(index->entries, index->cap * sizeof(IndexEntry));
+    }
+    index->entries[index->num_entries].raw_offset = raw_offset;
+    index->entries[index->num_entries].comp_offset = comp_offset;
+    index->num_entries++;
+    index->raw_size = raw_offset + raw_size;
+}
+
+size_t index_size(BlockIndex* index)
+{
+    return index->num_entries * INDEX_ENTRY_SIZE + INDEX_TRAILER_SIZE;
+}
+
+size_t index_write_buffer(BlockIndex* index, uint8_t* dst)
+{
+    uint8_t* p = dst;
+    for (size_t i = 0; i < index->num_entries; i++)
+    {
+        put_u64(p, index->entries[i].raw_offset);
+        put_u64(p + 8, index->entries[i].comp_offset);
+        p += INDEX_ENTRY_SIZE;
+    }
+    put_u64(p, index->num_entries);
+    put_u64(p + 8, index->raw_size);
+    memcpy(p + 16, INDEX_MAGIC, 4);
+    return index_size(index);
+}
+
+int index_read(BlockIndex* index, FILE* in)
+{
+    index_init(index);
+    uint8_t trailer[INDEX_TRAILER_SIZE];
+    if (fseeko(in, 0, SEEK_END) != 0)
+    {
+        return -1;
+    }
+    off_t file_size = ftello(in);
+    if (file_size < INDEX_TRAILER_SIZE
+        || fseeko(in, -INDEX_TRAILER_SIZE, SEEK_END) != 0
+        || fread(trailer, 1, INDEX_TRAILER_SIZE, in) != INDEX_TRAILER_SIZE
+        || memcmp(trailer + 16, INDEX_MAGIC, 4) != 0)
+    {
+        return -1;
+    }
+    uint64_t num_entries = get_u64(trailer);
+    uint64_t raw_size = get_u64(trailer + 8);
+    if (num_entries > (uint64_t)(file_size - INDEX_TRAILER_SIZE) / INDEX_ENTRY_SIZE)
+    {
+        return -1;
+    }
+    off_t index_size = num_entries * INDEX_ENTRY_SIZE + INDEX_TRAILER_SIZE;
+    if (fseeko(in, -index_size, SEEK_END) != 0)
+    {
+        return -1;
+    }
+
+    index->entries = malloc( (num_entries + 1) * sizeof(IndexEntry) );
+    index->cap = num_entries + 1;
+    uint8_t entry[INDEX_ENTRY_SIZE];
+    for (uint64_t i = 0; i < num_entries; i++)
+    {
+        if (fread(entry, 1, INDEX_ENTRY_SIZE, in) != INDEX_ENTRY_SIZE)
+        {
+            index_free(index);
+            return -1;
+        }
+        index->entries[i].raw_offset = get_u64(entry);
+        index->entries[i].comp_offset = get_u64(entry + 8);
+        // Blocks must come in order for index_find() to work
+        if (i > 0 && index->entries[i].raw_offset <= index->entries[i - 1].raw_offset)
+        {
+            index_free(index);
+            return -1;
+        }
+    }
+    index->num_entries = num_entries;
+    index->raw_size = raw_size;
+    return 0;
+}
+
+size_t index_find(BlockIndex* index, uint64_t raw_offset)
+{
+    // Find the last block starting at or before raw_offset
+    size_t low = 0;
+    size_t high = index->num_entries;
+    while (high - low > 1)
+    {
+        size_t mid = low + (high - low) / 2;
+        if (index->entries[mid].raw_offset <= raw_offset)
+        {
+            low = mid;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
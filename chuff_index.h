@@ -0,0 +1,123 @@
+// chuff_index.h
+// Ben Crabtree, 2021
+
+# ifndef CHUFF_INDEX_H
+# define CHUFF_INDEX_H
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdint.h>
+# include <string.h>
+
+# include "chuff_shared.h"
+
+# define INDEX_MAGIC "CHIX"
+// Raw offset and compressed offset of one block
+# define INDEX_ENTRY_SIZE 16
+// Number of blocks, total raw size and magic
+# define INDEX_TRAILER_SIZE 20
+
+struct IndexEntry
+{
+    uint64_t raw_offset; // Offset of the block's first byte in the original data
+    uint64_t comp_offset; // Offset of the block's header in the chuff file
+};
+
+typedef struct IndexEntry IndexEntry;
+
+/*
+Block index written as a footer after a stream's end marker:
+- One entry per block (see IndexEntry), each field 8 bytes big endian
+- Trailer: number of blocks (8 bytes), total raw size (8 bytes), magic "CHIX"
+The trailer sits at the very end of the file, so a reader can find the index by seeking back from the end.
+Blocks always start on a byte boundary, so a compressed byte offset is all a reader needs to start decoding.
+*/
+struct BlockIndex
+{
+    IndexEntry* entries;
+    size_t num_entries;
+    size_t cap;
+    uint64_t raw_size; // Total size of the original data
+};
+
+typedef struct BlockIndex BlockIndex;
+
+/*
+Initialises an empty BlockIndex
+Takes:
+- A pointer to the BlockIndex
+Returns:
+- Void
+*/
+void index_init(BlockIndex* index);
+
+/*
+Frees the entries of a BlockIndex
+Takes:
+- A pointer to the BlockIndex
+Returns:
+- Void
+*/
+void index_free(BlockIndex* index);
+
+/*
+Empties a BlockIndex but keeps its memory for reuse
+Takes:
+- A pointer to the BlockIndex
+Returns:
+- Void
+*/
+void index_reset(BlockIndex* index);
+
+/*
+Adds an entry for the next block, which must follow the previous one
+Takes:
+- A pointer to the BlockIndex
+- The raw offset of the block
+- The raw size of the block
+- The compressed offset of the block
+Returns:
+- Void
+*/
+void index_add(BlockIndex* index, uint64_t raw_offset, uint64_t raw_size, uint64_t comp_offset);
+
+/*
+Gets the size of the index footer
+Takes:
+- A pointer to the BlockIndex
+Returns:
+- The number of bytes index_write_buffer() will write
+*/
+size_t index_size(BlockIndex* index);
+
+/*
+Writes the index footer to memory
+Takes:
+- A pointer to the BlockIndex
+- A pointer to a buffer of at least index_size() bytes
+Returns:
+- The number of bytes written
+*/
+size_t index_write_buffer(BlockIndex* index, uint8_t* dst);
+
+/*
+Reads the index footer from the end of a chuff file
+Takes:
+- A pointer to the BlockIndex to fill in
+- A pointer to the input FILE, which must be seekable
+Returns:
+- 0 on success, -1 if the file has no valid index
+*/
+int index_read(BlockIndex* index, FILE* in);
+
+/*
+Finds the block holding a given byte of the original data with a binary search
+Takes:
+- A pointer to the BlockIndex
+- An offset into the original data, less than raw_size
+Returns:
+- The number of the block (index into entries)
+*/
+size_t index_find(BlockIndex* index, uint64_t raw_offset);
+
+# endif
@@ -0,0 +1,234 @@
+// chuff_io.c
+// Ben Crabtree, 2021
+
+# include <errno.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+
+# include "chuff_io.h"
+# include "chuff_shared.h"
+
+int input_map(FILE* in, InputMap* map)
+{
+    map->data = NULL;
+    map->size = 0;
+    map->base = NULL;
+    map->map_size = 0;
+    map->released = 0;
+    struct stat st;
+    int fd = fileno(in);
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+    {
+        return -1;
+    }
+    // Map from wherever the FILE has got to, in case something before us has read from it
+    off_t offset = ftello(in);
+    if (offset < 0 || offset >= st.st_size)
+    {
+        return -1;
+    }
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        return -1;
+    }
+    // Blocks are read front to back, so ask the kernel to read ahead
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    map->base = data;
+    map->map_size = st.st_size;
+    map->data = (const uint8_t*)data + offset;
+    map->size = st.st_size - offset;
+    return 0;
+}
+
+void input_release(InputMap* map, size_t done)
+{
+    if (map->base == NULL)
+    {
+        return;
+    }
+    // Only whole pages can go, so stop at the page the next block starts in
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t end = (size_t)(map->data - (const uint8_t*)map->base) + done;
+    end -= end % page_size;
+    if (end > map->released)
+    {
+        madvise((uint8_t*)map->base + map->released, end - map->released, MADV_DONTNEED);
+        map->released = end;
+    }
+}
+
+void input_unmap(InputMap* map)
+{
+    if (map->base != NULL)
+    {
+        munmap(map->base, map->map_size);
+    }
+    map->data = NULL;
+    map->size = 0;
+    map->base = NULL;
+    map->map_size = 0;
+    map->released = 0;
+}
+
+/*
+Writes a whole buffer to a file descriptor, carrying on after short writes and interrupts
+Takes:
+- The file descriptor
+- A pointer to the bytes
+- The number of bytes
+Returns:
+- 0 on success, -1 if a write fails
+*/
+int write_all(int fd, const uint8_t* buf, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t num_written = write(fd, buf, size);
+        if (num_written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        buf += num_written;
+        size -= num_written;
+    }
+    return 0;
+}
+
+void* writer_thread(void* arg)
+{
+    AsyncWriter* writer = arg;
+    pthread_mutex_lock(&writer->lock);
+    while (true)
+    {
+        while (writer->pending == 0 && !writer->shutdown)
+        {
+            pthread_cond_wait(&writer->work_ready, &writer->lock);
+        }
+        if (writer->pending == 0)
+        {
+            break;
+        }
+        // The caller never touches the other buffer while it is pending, so write it without the lock
+        const uint8_t* buf = writer->buffers[1 - writer->current];
+        size_t size = writer->pending;
+        pthread_mutex_unlock(&writer->lock);
+        int result = write_all(writer->fd, buf, size);
+        pthread_mutex_lock(&writer->lock);
+        if (result != 0)
+        {
+            writer->error = true;
+        }
+        writer->pending = 0;
+        pthread_cond_signal(&writer->work_done);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+int writer_open(AsyncWriter* writer, FILE* out)
+{
+    if (fflush(out) != 0)
+    {
+        return -1;
+    }
+    writer->fd = fileno(out);
+    writer->buffers[0] = malloc(IO_WRITE_BUFFER_SIZE);
+    writer->buffers[1] = malloc(IO_WRITE_BUFFER_SIZE);
+    writer->current = 0;
+    writer->fill = 0;
+    writer->pending = 0;
+    writer->shutdown = false;
+    writer->error = false;
+    writer->wait_ns = 0;
+    if (writer->buffers[0] == NULL || writer->buffers[1] == NULL)
+    {
+        free(writer->buffers[0]);
+        free(writer->buffers[1]);
+        return -1;
+    }
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->work_ready, NULL);
+    pthread_cond_init(&writer->work_done, NULL);
+    if (pthread_create(&writer->thread, NULL, writer_thread, writer) != 0)
+    {
+        pthread_mutex_destroy(&writer->lock);
+        pthread_cond_destroy(&writer->work_ready);
+        pthread_cond_destroy(&writer->work_done);
+        free(writer->buffers[0]);
+        free(writer->buffers[1]);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+Hands the current buffer to the writer thread and starts filling the other one
+Waits for the other buffer's write to finish first if it hasn't yet.
+Takes:
+- A pointer to the AsyncWriter
+Returns:
+- 0 on success, -1 if a write has failed
+*/
+int writer_swap(AsyncWriter* writer)
+{
+    uint64_t start = get_time_ns();
+    pthread_mutex_lock(&writer->lock);
+    while (writer->pending > 0)
+    {
+        pthread_cond_wait(&writer->work_done, &writer->lock);
+    }
+    writer->current = 1 - writer->current;
+    writer->pending = writer->fill;
+    writer->fill = 0;
+    bool error = writer->error;
+    pthread_cond_signal(&writer->work_ready);
+    pthread_mutex_unlock(&writer->lock);
+    writer->wait_ns += get_time_ns() - start;
+    return error ? -1 : 0;
+}
+
+int writer_write(AsyncWriter* writer, const void* src, size_t size)
+{
+    const uint8_t* bytes = src;
+    while (size > 0)
+    {
+        size_t room = IO_WRITE_BUFFER_SIZE - writer->fill;
+        size_t num_copied = size < room ? size : room;
+        memcpy(writer->buffers[writer->current] + writer->fill, bytes, num_copied);
+        writer->fill += num_copied;
+        bytes += num_copied;
+        size -= num_copied;
+        // A failed write is only noticed at the next swap, a buffer or so late
+        if (writer->fill == IO_WRITE_BUFFER_SIZE && writer_swap(writer) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int writer_close(AsyncWriter* writer)
+{
+    if (writer->fill > 0)
+    {
+        writer_swap(writer);
+    }
+    pthread_mutex_lock(&writer->lock);
+    writer->shutdown = true;
+    pthread_cond_signal(&writer->work_ready);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, NULL);
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->work_ready);
+    pthread_cond_destroy(&writer->work_done);
+    free(writer->buffers[0]);
+    free(writer->buffers[1]);
+    // The writer thread has stopped, so error can be read without the lock
+    return writer->error ? -1 : 0;
+}
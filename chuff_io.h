@@ -0,0 +1,123 @@
+// chuff_io.h
+// Ben Crabtree, 2021
+
+# ifndef CHUFF_IO_H
+# define CHUFF_IO_H
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdbool.h>
+# include <stdint.h>
+# include <string.h>
+# include <pthread.h>
+
+// Size of each of an AsyncWriter's two buffers
+# define IO_WRITE_BUFFER_SIZE (4 << 20)
+
+/*
+A regular file mapped into memory, so blocks can be compressed straight out of the page cache
+without copying them into buffers first
+*/
+struct InputMap
+{
+    const uint8_t* data; // From the FILE's position when it was mapped
+    size_t size;
+    void* base; // Whole file mapping, for unmapping
+    size_t map_size;
+    size_t released; // Bytes from base already handed back by input_release()
+};
+
+typedef struct InputMap InputMap;
+
+/*
+Writes to a file descriptor from its own thread, so the caller can go on with the next block
+while the last one is still being written
+Bytes are gathered in one buffer while the other is being written. When the gathering buffer
+fills up the two swap over, waiting only if the previous write hasn't finished yet.
+Writes go straight to the file descriptor with write(), bypassing stdio.
+*/
+struct AsyncWriter
+{
+    int fd;
+    uint8_t* buffers[2];
+    int current; // Buffer being filled by the caller
+    size_t fill; // Bytes in the current buffer
+    size_t pending; // Bytes in the other buffer still to be written, 0 once written
+    bool shutdown;
+    bool error; // Set by the writer thread if a write fails
+    uint64_t wait_ns; // Time the caller spent waiting for the writer thread
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready; // Signalled when a buffer is handed over or the writer shuts down
+    pthread_cond_t work_done; // Signalled when a buffer has been written
+};
+
+typedef struct AsyncWriter AsyncWriter;
+
+/*
+Maps a file into memory for reading, if it is a regular file
+Pipes, terminals and empty files can't be mapped, and are left to be read in the usual way.
+The FILE's position is not moved.
+Takes:
+- A pointer to the input FILE
+- A pointer to the InputMap to fill in
+Returns:
+- 0 if the file was mapped, -1 if not
+*/
+int input_map(FILE* in, InputMap* map);
+
+/*
+Hands back the pages of a mapping before a given point, once the blocks there are finished with
+Otherwise every page read stays resident until input_unmap(), and compressing a file would
+take as much memory as the file. Pages are only dropped from the mapping, not the page
+cache, and reading them again just maps them back in.
+Takes:
+- A pointer to the InputMap
+- How many bytes from map->data are finished with
+Returns:
+- Void
+*/
+void input_release(InputMap* map, size_t done);
+
+/*
+Unmaps a file mapped by input_map()
+Takes:
+- A pointer to the InputMap
+Returns:
+- Void
+*/
+void input_unmap(InputMap* map);
+
+/*
+Starts an AsyncWriter for a FILE
+Anything already buffered in the FILE is flushed first, and the FILE must not be written to
+again until writer_close() has returned.
+Takes:
+- A pointer to the AsyncWriter
+- A pointer to the output FILE
+Returns:
+- 0 on success, -1 if memory runs out or the thread can't be started
+*/
+int writer_open(AsyncWriter* writer, FILE* out);
+
+/*
+Queues bytes to be written
+Takes:
+- A pointer to the AsyncWriter
+- A pointer to the bytes
+- The number of bytes
+Returns:
+- 0 on success, -1 if an earlier write has failed
+*/
+int writer_write(AsyncWriter* writer, const void* src, size_t size);
+
+/*
+Writes out everything still queued, stops the writer thread and frees the buffers
+Takes:
+- A pointer to the AsyncWriter
+Returns:
+- 0 on success, -1 if any write failed
+*/
+int writer_close(AsyncWriter* writer);
+
+# endif
@@ -0,0 +1,287 @@
+// chuff_lib.c
+// Ben Crabtree, 2021
+
+# include <limits.h>
+
+# include "chuff_lib.h"
+# include "chuff_shared.h"
+# include "chuff_block.h"
+# include "chuff_index.h"
+# include "chuff_stream.h"
+# include "chuff_model.h"
+
+struct ChuffCtx
+{
+    BlockCoder coder;
+    BlockIndex index;
+    StreamOptions format; // Block size, order and streams per block for chuff_compress()
+    ChuffModel* model; // Records are coded with this if it is set
+};
+
+ChuffCtx* chuff_ctx_new(void)
+{
+    ChuffCtx* ctx = malloc( sizeof(ChuffCtx) );
+    if (ctx == NULL)
+    {
+        return NULL;
+    }
+    block_coder_init(&ctx->coder);
+    index_init(&ctx->index);
+    stream_options_init(&ctx->format);
+    ctx->model = NULL;
+    return ctx;
+}
+
+void chuff_ctx_free(ChuffCtx* ctx)
+{
+    if (ctx == NULL)
+    {
+        return;
+    }
+    block_coder_free(&ctx->coder);
+    index_free(&ctx->index);
+    free(ctx);
+}
+
+int chuff_ctx_set_block_size(ChuffCtx* ctx, size_t block_size)
+{
+    if (block_size < MIN_BLOCK_SIZE || block_size > MAX_BLOCK_SIZE)
+    {
+        return -1;
+    }
+    ctx->format.block_size = block_size;
+    return 0;
+}
+
+int chuff_ctx_set_order(ChuffCtx* ctx, int order)
+{
+    if (order < 0 || order > BLOCK_MAX_ORDER || (order != 0 && (ctx->format.words || ctx->format.ans)))
+    {
+        return -1;
+    }
+    ctx->format.order = order;
+    return 0;
+}
+
+int chuff_ctx_set_streams(ChuffCtx* ctx, int num_streams)
+{
+    if (num_streams < 1 || num_streams > BLOCK_MAX_STREAMS)
+    {
+        return -1;
+    }
+    ctx->format.num_streams = num_streams;
+    return 0;
+}
+
+int chuff_ctx_set_max_code_len(ChuffCtx* ctx, int max_code_len)
+{
+    if (max_code_len != 0 && (max_code_len < MIN_CODE_LEN_LIMIT || max_code_len > MAX_CODE_LEN_LIMIT))
+    {
+        return -1;
+    }
+    ctx->coder.max_code_len = max_code_len;
+    return 0;
+}
+
+void chuff_ctx_set_checksums(ChuffCtx* ctx, int checksums)
+{
+    ctx->format.checksums = checksums != 0;
+}
+
+int chuff_ctx_set_words(ChuffCtx* ctx, int words)
+{
+    if (words != 0 && (ctx->format.order != 0 || ctx->format.ans))
+    {
+        return -1;
+    }
+    ctx->format.words = words != 0;
+    return 0;
+}
+
+int chuff_ctx_set_coder(ChuffCtx* ctx, int coder)
+{
+    if ((coder != CHUFF_CODER_HUFFMAN && coder != CHUFF_CODER_ANS)
+        || (coder == CHUFF_CODER_ANS && (ctx->format.order != 0 || ctx->format.words)))
+    {
+        return -1;
+    }
+    ctx->format.ans = coder == CHUFF_CODER_ANS;
+    return 0;
+}
+
+ChuffModel* chuff_model_load(const char* path)
+{
+    FILE* in = fopen(path, "rb");
+    if (in == NULL)
+    {
+        return NULL;
+    }
+    ChuffModel* model = malloc( sizeof(ChuffModel) );
+    if (model != NULL)
+    {
+        model_init(model);
+        if (model_read(model, in) != 0)
+        {
+            chuff_model_free(model);
+            model = NULL;
+        }
+    }
+    fclose(in);
+    return model;
+}
+
+void chuff_model_free(ChuffModel* model)
+{
+    if (model == NULL)
+    {
+        return;
+    }
+    model_free(model);
+    free(model);
+}
+
+uint32_t chuff_model_id(const ChuffModel* model)
+{
+    return model->id;
+}
+
+void chuff_ctx_set_model(ChuffCtx* ctx, const ChuffModel* model)
+{
+    // The model is only read from, so sharing it between contexts is safe
+    ctx->model = (ChuffModel*)model;
+}
+
+int chuff_record_model_id(const void* src, size_t src_size, uint32_t* id)
+{
+    size_t raw_size;
+    return model_record_info(src, src_size, id, &raw_size);
+}
+
+size_t chuff_compress_bound(ChuffCtx* ctx, size_t src_size)
+{
+    if (ctx->model != NULL)
+    {
+        return model_compress_bound(ctx->model, src_size);
+    }
+    size_t num_blocks = (src_size + ctx->format.block_size - 1) / ctx->format.block_size;
+    size_t last_block = src_size - (num_blocks > 0 ? (num_blocks - 1) * ctx->format.block_size : 0);
+    size_t blocks_size = num_blocks > 0 ? (num_blocks - 1) * block_compress_bound(ctx->format.block_size) + block_compress_bound(last_block) : 0;
+    return STREAM_HEADER_SIZE + blocks_size + BLOCK_HEADER_SIZE + num_blocks * INDEX_ENTRY_SIZE + INDEX_TRAILER_SIZE;
+}
+
+long chuff_compress(ChuffCtx* ctx, const void* src, size_t src_size, void* dst, size_t dst_cap)
+{
+    const uint8_t* in = src;
+    uint8_t* out = dst;
+    if (ctx->model != NULL)
+    {
+        return model_compress(ctx->model, in, src_size, out, dst_cap);
+    }
+    if (dst_cap < STREAM_HEADER_SIZE)
+    {
+        return -1;
+    }
+    size_t comp_offset = stream_write_header(out, &ctx->format);
+    ctx->coder.order = ctx->format.order;
+    ctx->coder.num_streams = ctx->format.num_streams;
+    ctx->coder.checksums = ctx->format.checksums;
+    ctx->coder.words = ctx->format.words;
+    ctx->coder.block_types = ctx->format.block_types;
+    ctx->coder.ans = ctx->format.ans;
+    size_t block_size = ctx->format.block_size;
+
+    index_reset(&ctx->index);
+    for (size_t raw_offset = 0; raw_offset < src_size; raw_offset += block_size)
+    {
+        size_t raw_size = src_size - raw_offset < block_size ? src_size - raw_offset : block_size;
+        long comp_size = block_compress(&ctx->coder, in + raw_offset, raw_size, out + comp_offset, dst_cap - comp_offset);
+        if (comp_size < 0)
+        {
+            return -1;
+        }
+        index_add(&ctx->index, raw_offset, raw_size, comp_offset);
+        comp_offset += comp_size;
+    }
+
+    // End marker then index footer
+    if (dst_cap - comp_offset < BLOCK_HEADER_SIZE + index_size(&ctx->index))
+    {
+        return -1;
+    }
+    memset(out + comp_offset, 0, BLOCK_HEADER_SIZE);
+    comp_offset += BLOCK_HEADER_SIZE;
+    comp_offset += index_write_buffer(&ctx->index, out + comp_offset);
+    return comp_offset;
+}
+
+long chuff_decompressed_size(ChuffCtx* ctx, const void* src, size_t src_size)
+{
+    const uint8_t* in = src;
+    if (ctx->model != NULL)
+    {
+        uint32_t id;
+        size_t raw_size;
+        return model_record_info(in, src_size, &id, &raw_size) == 0 ? (long)raw_size : -1;
+    }
+    if (src_size < STREAM_HEADER_SIZE + INDEX_TRAILER_SIZE
+        || memcmp(in + src_size - 4, INDEX_MAGIC, 4) != 0)
+    {
+        return -1;
+    }
+    uint64_t raw_size = get_u64(in + src_size - INDEX_TRAILER_SIZE + 8);
+    if (raw_size > LONG_MAX)
+    {
+        return -1;
+    }
+    return raw_size;
+}
+
+long chuff_decompress(ChuffCtx* ctx, const void* src, size_t src_size, void* dst, size_t dst_cap)
+{
+    const uint8_t* in = src;
+    uint8_t* out = dst;
+    if (ctx->model != NULL)
+    {
+        return model_decompress(ctx->model, in, src_size, out, dst_cap);
+    }
+    StreamOptions format;
+    long header_size = stream_parse_header(in, src_size, &format);
+    if (header_size < 0)
+    {
+        return -1;
+    }
+    size_t block_size = format.block_size;
+    ctx->coder.order = format.order;
+    ctx->coder.num_streams = format.num_streams;
+    ctx->coder.checksums = format.checksums;
+    ctx->coder.words = format.words;
+    ctx->coder.block_types = format.block_types;
+
+    size_t comp_offset = header_size;
+    size_t raw_offset = 0;
+    while (true)
+    {
+        if (src_size - comp_offset < BLOCK_HEADER_SIZE)
+        {
+            return -1;
+        }
+        size_t raw_size = get_u32(in + comp_offset);
+        size_t rest_size = get_u32(in + comp_offset + 4);
+        if (raw_size == 0)
+        {
+            break;
+        }
+        if (raw_size > block_size)
+        {
+            return -1;
+        }
+        long decoded = block_decompress(&ctx->coder, in + comp_offset, src_size - comp_offset, out + raw_offset, dst_cap - raw_offset);
+        if (decoded < 0)
+        {
+            return -1;
+        }
+        raw_offset += decoded;
+        comp_offset += BLOCK_HEADER_SIZE + rest_size;
+    }
+    return raw_offset;
+}
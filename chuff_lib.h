@@ -0,0 +1,224 @@
+// chuff_lib.h
+// Ben Crabtree, 2021
+
+# ifndef CHUFF_LIB_H
+# define CHUFF_LIB_H
+
+# include <stddef.h>
+# include <stdint.h>
+
+/*
+libchuff: compress and decompress memory buffers without going through files
+Output is a complete chuff stream (header, blocks, end marker and index), the same as
+chuff -c writes, so either side can be done by the library or the command line tool.
+
+A ChuffCtx keeps its code tables, decode tables and index between calls,
+so once it has handled the biggest block it will see, calls make no allocations.
+A ChuffCtx must only be used by one thread at a time, but any number can be in use at once.
+
+For many small messages, train a model once (chuff train) and set it on the context.
+Calls then code each message as a record with the model's fixed code table:
+no counting pass, no code lengths header, just an 8 byte header holding the model ID and size.
+*/
+typedef struct ChuffCtx ChuffCtx;
+typedef struct ChuffModel ChuffModel;
+
+// Entropy coders for chuff_ctx_set_coder()
+# define CHUFF_CODER_HUFFMAN 0
+# define CHUFF_CODER_ANS 1
+
+/*
+Creates a ChuffCtx with the default block size and no code length limit
+Takes:
+- Nothing
+Returns:
+- A pointer to the new ChuffCtx, or NULL if memory runs out
+*/
+ChuffCtx* chuff_ctx_new(void);
+
+/*
+Frees a ChuffCtx and everything it holds
+Takes:
+- A pointer to the ChuffCtx (NULL is allowed)
+Returns:
+- Void
+*/
+void chuff_ctx_free(ChuffCtx* ctx);
+
+/*
+Sets the block size used by chuff_compress()
+Takes:
+- A pointer to the ChuffCtx
+- The block size, MIN_BLOCK_SIZE to MAX_BLOCK_SIZE (1K to 64M)
+Returns:
+- 0 on success, -1 if the block size is out of range
+*/
+int chuff_ctx_set_block_size(ChuffCtx* ctx, size_t block_size);
+
+/*
+Sets the context order chuff_compress() codes blocks with
+Order 1 picks each byte's code table by the byte before it: slower, but smaller for text and other structured data.
+Takes:
+- A pointer to the ChuffCtx
+- The order, 0 or 1
+Returns:
+- 0 on success, -1 if the order is out of range or word blocks are set
+*/
+int chuff_ctx_set_order(ChuffCtx* ctx, int order);
+
+/*
+Sets how many interleaved bitstreams chuff_compress() splits each block into
+More streams let chuff_decompress() decode several bytes at once, for a few bytes more per block.
+Takes:
+- A pointer to the ChuffCtx
+- The number of streams, 1 to 8 (4 by default)
+Returns:
+- 0 on success, -1 if the number is out of range
+*/
+int chuff_ctx_set_streams(ChuffCtx* ctx, int num_streams);
+
+/*
+Sets the longest code chuff_compress() may use
+Takes:
+- A pointer to the ChuffCtx
+- The maximum code length, 8 to 32, or 0 for no limit
+Returns:
+- 0 on success, -1 if the length is out of range
+*/
+int chuff_ctx_set_max_code_len(ChuffCtx* ctx, int max_code_len);
+
+/*
+Sets whether chuff_compress() ends each block with a CRC-32 of its raw data (it does by default)
+chuff_decompress() checks the CRC-32 of any block that has one.
+Takes:
+- A pointer to the ChuffCtx
+- 1 to add checksums, 0 to leave them out
+Returns:
+- Void
+*/
+void chuff_ctx_set_checksums(ChuffCtx* ctx, int checksums);
+
+/*
+Sets whether chuff_compress() codes blocks as words and separators rather than single bytes
+Each block gets a vocabulary of its commonest words with a code each, so text compresses better
+and decompresses a word per lookup. Blocks that don't gain from it are coded as bytes, as usual.
+Takes:
+- A pointer to the ChuffCtx
+- 1 for word blocks, 0 for byte blocks
+Returns:
+- 0 on success, -1 if the context order is 1 or the coder is tANS (word blocks are order-0 Huffman)
+*/
+int chuff_ctx_set_words(ChuffCtx* ctx, int words);
+
+/*
+Sets which entropy coder chuff_compress() codes order-0 byte blocks with (Huffman by default)
+tANS codes skewed data in fractions of a bit per byte, so a byte that makes up most of a block
+costs far less than the whole bit a Huffman code needs. Each block records its coder, so
+chuff_decompress() needs no setting.
+Takes:
+- A pointer to the ChuffCtx
+- CHUFF_CODER_HUFFMAN or CHUFF_CODER_ANS
+Returns:
+- 0 on success, -1 if the coder is unknown, or is tANS with order 1 or word blocks
+*/
+int chuff_ctx_set_coder(ChuffCtx* ctx, int coder);
+
+/*
+Loads a model file written by chuff train
+A loaded model is never changed, so one model can be shared by contexts on different threads.
+Takes:
+- The path of the model file
+Returns:
+- A pointer to the new ChuffModel, or NULL if the file can't be read or is not a model
+*/
+ChuffModel* chuff_model_load(const char* path);
+
+/*
+Frees a ChuffModel. No context may still be using it.
+Takes:
+- A pointer to the ChuffModel (NULL is allowed)
+Returns:
+- Void
+*/
+void chuff_model_free(ChuffModel* model);
+
+/*
+Gets the ID that records coded with a model are tagged with
+Takes:
+- A pointer to the ChuffModel
+Returns:
+- The model ID
+*/
+uint32_t chuff_model_id(const ChuffModel* model);
+
+/*
+Sets the model chuff_compress() and chuff_decompress() code records with
+Takes:
+- A pointer to the ChuffCtx
+- A pointer to the ChuffModel, which must outlive its use by ctx, or NULL to go back to chuff streams
+Returns:
+- Void
+*/
+void chuff_ctx_set_model(ChuffCtx* ctx, const ChuffModel* model);
+
+/*
+Reads the ID of the model a record was coded with, to pick which model to decompress it with
+Takes:
+- A pointer to the record
+- The size of the record
+- A pointer to where to put the model ID
+Returns:
+- 0 on success, -1 if src is too short to be a record
+*/
+int chuff_record_model_id(const void* src, size_t src_size, uint32_t* id);
+
+/*
+Gets the largest size chuff_compress() can produce
+Takes:
+- A pointer to the ChuffCtx (the bound depends on its block size or model)
+- The size of the data to compress
+Returns:
+- The maximum compressed size in bytes
+*/
+size_t chuff_compress_bound(ChuffCtx* ctx, size_t src_size);
+
+/*
+Compresses a buffer into a chuff stream, or a record if the context has a model
+Takes:
+- A pointer to the ChuffCtx
+- A pointer to the data to compress
+- The size of the data (at most 4G - 1 for a record)
+- A pointer to the buffer to write to
+- The size of that buffer (chuff_compress_bound() is always enough)
+Returns:
+- The compressed size in bytes, or -1 if dst is too small
+*/
+long chuff_compress(ChuffCtx* ctx, const void* src, size_t src_size, void* dst, size_t dst_cap);
+
+/*
+Gets the original size of a chuff stream from its index, or of a record from its header,
+without decompressing it
+Takes:
+- A pointer to the ChuffCtx (records are expected if it has a model)
+- A pointer to the chuff stream or record
+- The size of the stream or record
+Returns:
+- The decompressed size in bytes, or -1 if the stream has no valid index
+*/
+long chuff_decompressed_size(ChuffCtx* ctx, const void* src, size_t src_size);
+
+/*
+Decompresses a chuff stream, or a record if the context has a model, into a buffer
+Takes:
+- A pointer to the ChuffCtx
+- A pointer to the chuff stream or record
+- The size of the stream or record
+- A pointer to the buffer to write to
+- The size of that buffer (chuff_decompressed_size() is always enough)
+Returns:
+- The decompressed size in bytes, or -1 if the stream is corrupt, the record was coded
+  with a different model, or dst is too small
+*/
+long chuff_decompress(ChuffCtx* ctx, const void* src, size_t src_size, void* dst, size_t dst_cap);
+
+# endif
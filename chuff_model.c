@@ -0,0 +1,143 @@
+// chuff_model.c
+// Ben Crabtree, 2021
+
+# include "chuff_model.h"
+
+void model_init(ChuffModel* model)
+{
+    memset(model, 0, sizeof(ChuffModel));
+    dt_init(&model->decode_table);
+}
+
+void model_free(ChuffModel* model)
+{
+    dt_free(&model->decode_table);
+}
+
+int model_set_codes(ChuffModel* model)
+{
+    if (canonical_assign_codes(model->code_lengths, model->codes, NUM_SYMBOLS) != 0
+        || dt_build(&model->decode_table, model->codes, NUM_SYMBOLS) != 0)
+    {
+        return -1;
+    }
+    model->max_len = model->decode_table.max_len;
+
+    // FNV-1a hash of the code lengths, which are all that define the model
+    uint32_t id = 2166136261u;
+    for (int i = 0; i < NUM_SYMBOLS; i++)
+    {
+        id ^= (uint32_t)model->code_lengths[i];
+        id *= 16777619u;
+    }
+    model->id = id;
+    return 0;
+}
+
+int model_train(ChuffModel* model, uint64_t counts[], int max_code_len)
+{
+    BlockCoder coder;
+    block_coder_init(&coder);
+    coder.max_code_len = max_code_len;
+    for (int i = 0; i < NUM_SYMBOLS; i++)
+    {
+        coder.counts[i] = counts[i] + 1;
+    }
+    int result = block_set_codes(&coder);
+    memcpy(model->code_lengths, coder.code_lengths, sizeof(model->code_lengths));
+    block_coder_free(&coder);
+    if (result != 0)
+    {
+        return -1;
+    }
+    return model_set_codes(model);
+}
+
+int model_write(ChuffModel* model, FILE* out)
+{
+    uint8_t header[MODEL_HEADER_SIZE + CANONICAL_COUNT_SIZE + NUM_SYMBOLS];
+    memcpy(header, MODEL_MAGIC, 4);
+    header[4] = MODEL_VERSION;
+    put_u32(header + 5, model->id);
+    size_t size = MODEL_HEADER_SIZE + canonical_write_lengths(model->code_lengths, NUM_SYMBOLS, header + MODEL_HEADER_SIZE);
+    return fwrite(header, 1, size, out) == size ? 0 : -1;
+}
+
+int model_read(ChuffModel* model, FILE* in)
+{
+    uint8_t header[MODEL_HEADER_SIZE + CANONICAL_COUNT_SIZE + NUM_SYMBOLS];
+    size_t size = fread(header, 1, sizeof(header), in);
+    if (size < MODEL_HEADER_SIZE
+        || memcmp(header, MODEL_MAGIC, 4) != 0
+        || header[4] != MODEL_VERSION)
+    {
+        return -1;
+    }
+    if (canonical_read_lengths(header + MODEL_HEADER_SIZE, size - MODEL_HEADER_SIZE, model->code_lengths, NUM_SYMBOLS) < 0
+        || model_set_codes(model) != 0)
+    {
+        return -1;
+    }
+    // The ID is worked out from the lengths, so a mismatch means the file is damaged
+    return model->id == get_u32(header + 5) ? 0 : -1;
+}
+
+size_t model_compress_bound(ChuffModel* model, size_t raw_size)
+{
+    return MODEL_RECORD_HEADER_SIZE + bw_bytes_needed((uint64_t)raw_size * model->max_len);
+}
+
+long model_compress(ChuffModel* model, const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_cap)
+{
+    if (src_size > UINT32_MAX || dst_cap < MODEL_RECORD_HEADER_SIZE)
+    {
+        return -1;
+    }
+    uint64_t num_bits = 0;
+    for (size_t i = 0; i < src_size; i++)
+    {
+        num_bits += model->codes[src[i]].len;
+    }
+    if (bw_bytes_needed(num_bits) > dst_cap - MODEL_RECORD_HEADER_SIZE)
+    {
+        return -1;
+    }
+    put_u32(dst, model->id);
+    put_u32(dst + 4, (uint32_t)src_size);
+    BitWriter bw;
+    bw_init(&bw, dst + MODEL_RECORD_HEADER_SIZE);
+    for (size_t i = 0; i < src_size; i++)
+    {
+        bw_put_code(&bw, model->codes[src[i]]);
+    }
+    return MODEL_RECORD_HEADER_SIZE + bw_finish(&bw);
+}
+
+int model_record_info(const uint8_t* src, size_t src_size, uint32_t* id, size_t* raw_size)
+{
+    if (src_size < MODEL_RECORD_HEADER_SIZE)
+    {
+        return -1;
+    }
+    *id = get_u32(src);
+    *raw_size = get_u32(src + 4);
+    return 0;
+}
+
+long model_decompress(ChuffModel* model, const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_cap)
+{
+    uint32_t id;
+    size_t raw_size;
+    if (model_record_info(src, src_size, &id, &raw_size) != 0 || id != model->id || raw_size > dst_cap)
+    {
+        return -1;
+    }
+    BitReader br;
+    br_init(&br, src + MODEL_RECORD_HEADER_SIZE, src_size - MODEL_RECORD_HEADER_SIZE);
+    block_decode_run(&model->decode_table, &br, dst, raw_size);
+    if (br_overrun(&br))
+    {
+        return -1;
+    }
+    return raw_size;
+}
@@ -0,0 +1,143 @@
+// chuff_model.h
+// Ben Crabtree, 2021
+
+# ifndef CHUFF_MODEL_H
+# define CHUFF_MODEL_H
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdint.h>
+# include <string.h>
+
+# include "chuff_shared.h"
+# include "chuff_bitstream.h"
+# include "chuff_decode_table.h"
+# include "chuff_canonical.h"
+# include "chuff_block.h"
+
+# define MODEL_MAGIC "CHMD"
+# define MODEL_VERSION 1
+// Magic, version and model ID at the start of a model file, before the code lengths header
+# define MODEL_HEADER_SIZE 9
+// Model ID and raw size at the start of every record
+# define MODEL_RECORD_HEADER_SIZE 8
+
+/*
+A code table trained once on a sample corpus and then used for many small records
+Records coded with a model skip counting and carry no code lengths header, just:
+- 4 bytes model ID (big endian)
+- 4 bytes raw size (big endian)
+- Bit-packed payload
+Every byte value has a code, so a model can code any input, not only what it was trained on.
+The ID is a hash of the code lengths, so records from different models can't be confused.
+*/
+struct ChuffModel
+{
+    uint32_t id;
+    int max_len; // Longest code in the model
+    int code_lengths[NUM_SYMBOLS];
+    HuffCode codes[NUM_SYMBOLS];
+    DecodeTable decode_table;
+};
+
+typedef struct ChuffModel ChuffModel;
+
+/*
+Initialises an empty ChuffModel
+Takes:
+- A pointer to the ChuffModel
+Returns:
+- Void
+*/
+void model_init(ChuffModel* model);
+
+/*
+Frees memory held by a ChuffModel (but not the ChuffModel itself)
+Takes:
+- A pointer to the ChuffModel
+Returns:
+- Void
+*/
+void model_free(ChuffModel* model);
+
+/*
+Builds a model from byte counts of a training corpus
+Every count is bumped by one first so bytes missing from the corpus still get a code.
+Takes:
+- A pointer to an initialised ChuffModel
+- An array of counts indexed by byte value
+- The maximum code length, or 0 for no limit
+Returns:
+- 0 on success, -1 on error
+*/
+int model_train(ChuffModel* model, uint64_t counts[], int max_code_len);
+
+/*
+Writes a model file: MODEL_MAGIC, MODEL_VERSION, the model ID (big endian) then the code lengths header
+Takes:
+- A pointer to the ChuffModel
+- A pointer to the output FILE
+Returns:
+- 0 on success, -1 if writing fails
+*/
+int model_write(ChuffModel* model, FILE* out);
+
+/*
+Reads a model file written by model_write()
+Takes:
+- A pointer to an initialised ChuffModel
+- A pointer to the input FILE
+Returns:
+- 0 on success, -1 if the file is not a valid model
+*/
+int model_read(ChuffModel* model, FILE* in);
+
+/*
+Gets the largest size a record of raw_size bytes can have
+Takes:
+- A pointer to the ChuffModel
+- The raw size of the record
+Returns:
+- The maximum record size in bytes
+*/
+size_t model_compress_bound(ChuffModel* model, size_t raw_size);
+
+/*
+Compresses one record with a model
+Takes:
+- A pointer to the ChuffModel
+- A pointer to the data to compress
+- The size of the data, at most UINT32_MAX
+- A pointer to the buffer to write to
+- The size of that buffer
+Returns:
+- The record size in bytes, or -1 if dst is too small
+*/
+long model_compress(ChuffModel* model, const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_cap);
+
+/*
+Reads the model ID and raw size from the start of a record
+Takes:
+- A pointer to the record
+- The size of the record
+- A pointer to where to put the model ID
+- A pointer to where to put the raw size
+Returns:
+- 0 on success, -1 if the record is too short to have a header
+*/
+int model_record_info(const uint8_t* src, size_t src_size, uint32_t* id, size_t* raw_size);
+
+/*
+Decompresses one record with a model
+Takes:
+- A pointer to the ChuffModel, which must have the record's model ID
+- A pointer to the record
+- The size of the record
+- A pointer to the buffer to write to
+- The size of that buffer
+Returns:
+- The raw size in bytes, or -1 if the model ID doesn't match or dst is too small
+*/
+long model_decompress(ChuffModel* model, const uint8_t* src, size_t src_size, uint8_t* dst, size_t dst_cap);
+
+# endif
@@ -0,0 +1,127 @@
+// chuff_package_merge.c
+// Ben Crabtree, 2021
+
+# include "chuff_package_merge.h"
+
+struct PMLeaf
+{
+    uint64_t count;
+    int symbol;
+};
+
+typedef struct PMLeaf PMLeaf;
+
+int compare_leaves(const void* a, const void* b)
+{
+    const PMLeaf* leaf_a = a;
+    const PMLeaf* leaf_b = b;
+    if (leaf_a->count != leaf_b->count)
+    {
+        return leaf_a->count < leaf_b->count ? -1 : 1;
+    }
+    return leaf_a->symbol - leaf_b->symbol;
+}
+
+int package_merge_lengths(uint64_t counts[], int num_symbols, int max_len, int code_lengths[])
+{
+    memset(code_lengths, 0, num_symbols * sizeof(int));
+    PMLeaf* leaves = malloc( (num_symbols > 0 ? num_symbols : 1) * sizeof(PMLeaf) );
+    int n = 0;
+    for (int i = 0; i < num_symbols; i++)
+    {
+        if (counts[i] > 0)
+        {
+            leaves[n].count = counts[i];
+            leaves[n].symbol = i;
+            n++;
+        }
+    }
+    if (n <= 1)
+    {
+        // A lone symbol still needs a 1 bit code
+        if (n == 1)
+        {
+            code_lengths[leaves[0].symbol] = 1;
+        }
+        free(leaves);
+        return 0;
+    }
+    if (max_len < 1 || (max_len < 31 && (1 << max_len) < n))
+    {
+        free(leaves);
+        return -1;
+    }
+    qsort(leaves, n, sizeof(PMLeaf), compare_leaves);
+
+    // Level j holds the leaves merged with packages made from level j-1, in order of weight
+    uint64_t** weights = malloc( max_len * sizeof(uint64_t*) );
+    uint8_t** is_leaf = malloc( max_len * sizeof(uint8_t*) );
+    int* sizes = malloc( max_len * sizeof(int) );
+    weights[0] = malloc( n * sizeof(uint64_t) );
+    is_leaf[0] = malloc( n * sizeof(uint8_t) );
+    sizes[0] = n;
+    for (int i = 0; i < n; i++)
+    {
+        weights[0][i] = leaves[i].count;
+        is_leaf[0][i] = 1;
+    }
+    for (int j = 1; j < max_len; j++)
+    {
+        int num_packages = sizes[j - 1] / 2;
+        sizes[j] = n + num_packages;
+        weights[j] = malloc( sizes[j] * sizeof(uint64_t) );
+        is_leaf[j] = malloc( sizes[j] * sizeof(uint8_t) );
+        int leaf = 0;
+        int package = 0;
+        for (int i = 0; i < sizes[j]; i++)
+        {
+            uint64_t package_weight = 0;
+            if (package < num_packages)
+            {
+                package_weight = weights[j - 1][2 * package] + weights[j - 1][2 * package + 1];
+            }
+            // On a tie take the leaf
+            if (package >= num_packages || (leaf < n && leaves[leaf].count <= package_weight))
+            {
+                weights[j][i] = leaves[leaf].count;
+                is_leaf[j][i] = 1;
+                leaf++;
+            }
+            else
+            {
+                weights[j][i] = package_weight;
+                is_leaf[j][i] = 0;
+                package++;
+            }
+        }
+    }
+
+    // Walk back down from the top level. Leaves in any prefix of a level are always the
+    // lightest ones, so the first num_taken items include leaves 0 to leaves_taken-1,
+    // and each package among them means two more items are taken from the level below.
+    int num_taken = 2 * n - 2;
+    for (int j = max_len - 1; j >= 0; j--)
+    {
+        int leaves_taken = 0;
+        for (int i = 0; i < num_taken; i++)
+        {
+            leaves_taken += is_leaf[j][i];
+        }
+        for (int i = 0; i < leaves_taken; i++)
+        {
+            code_lengths[leaves[i].symbol]++;
+        }
+        num_taken = 2 * (num_taken - leaves_taken);
+    }
+
+    for (int j = 0; j < max_len; j++)
+    {
+        free(weights[j]);
+        free(is_leaf[j]);
+    }
+    free(weights);
+    free(is_leaf);
+    free(sizes);
+    free(leaves);
+    return 0;
+}
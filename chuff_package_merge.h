@@ -0,0 +1,31 @@
+// chuff_package_merge.h
+// Ben Crabtree, 2021
+
+# ifndef CHUFF_PACKAGE_MERGE_H
+# define CHUFF_PACKAGE_MERGE_H
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdint.h>
+# include <string.h>
+
+# include "chuff_shared.h"
+
+/*
+Works out optimal code lengths with no code longer than max_len bits, using package-merge:
+- Sort the symbols by count. Level 1 is just the sorted symbols (leaves)
+- For each level up to max_len, pair off the previous level's items in order into packages
+  (each weighing the sum of its pair) and merge the packages with the leaves, keeping it sorted
+- The cheapest 2n-2 items at level max_len make up the code: a symbol's code length is
+  the number of levels at which it ends up inside one of the chosen items
+Takes:
+- An array of counts indexed by symbol
+- The number of symbols in the array
+- The maximum code length
+- An int array of code lengths to fill in, indexed by symbol (0 for symbols with count 0)
+Returns:
+- 0 on success, -1 if 2^max_len is less than the number of symbols used
+*/
+int package_merge_lengths(uint64_t counts[], int num_symbols, int max_len, int code_lengths[]);
+
+# endif
@@ -0,0 +1,123 @@
+// chuff_pool.c
+// Ben Crabtree, 2021
+
+# include "chuff_pool.h"
+
+struct WorkerArg
+{
+    ThreadPool* pool;
+    int worker;
+};
+
+typedef struct WorkerArg WorkerArg;
+
+void* pool_worker(void* arg)
+{
+    WorkerArg* worker_arg = arg;
+    ThreadPool* pool = worker_arg->pool;
+    int worker = worker_arg->worker;
+    free(worker_arg);
+
+    pthread_mutex_lock(&pool->lock);
+    while (true)
+    {
+        while (pool->queue_head == NULL && !pool->shutdown)
+        {
+            pthread_cond_wait(&pool->job_ready, &pool->lock);
+        }
+        if (pool->queue_head == NULL)
+        {
+            break;
+        }
+        // Take the job from the front of the queue and run it without holding the lock
+        PoolJob* job = pool->queue_head;
+        pool->queue_head = job->next;
+        if (pool->queue_head == NULL)
+        {
+            pool->queue_tail = NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+        job->fn(job->arg, worker);
+        pthread_mutex_lock(&pool->lock);
+        job->done = true;
+        pthread_cond_broadcast(&pool->job_done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+ThreadPool* pool_create(int num_threads)
+{
+    if (num_threads < 1 || num_threads > MAX_THREADS)
+    {
+        return NULL;
+    }
+    ThreadPool* pool = malloc( sizeof(ThreadPool) );
+    pool->threads = malloc( num_threads * sizeof(pthread_t) );
+    pool->num_threads = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->job_ready, NULL);
+    pthread_cond_init(&pool->job_done, NULL);
+    pool->queue_head = NULL;
+    pool->queue_tail = NULL;
+    pool->shutdown = false;
+    for (int i = 0; i < num_threads; i++)
+    {
+        WorkerArg* worker_arg = malloc( sizeof(WorkerArg) );
+        worker_arg->pool = pool;
+        worker_arg->worker = i;
+        if (pthread_create(&pool->threads[i], NULL, pool_worker, worker_arg) != 0)
+        {
+            free(worker_arg);
+            pool_free(pool);
+            return NULL;
+        }
+        pool->num_threads++;
+    }
+    return pool;
+}
+
+void pool_submit(ThreadPool* pool, PoolJob* job)
+{
+    job->done = false;
+    job->next = NULL;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->queue_tail == NULL)
+    {
+        pool->queue_head = job;
+    }
+    else
+    {
+        pool->queue_tail->next = job;
+    }
+    pool->queue_tail = job;
+    pthread_cond_signal(&pool->job_ready);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_wait_job(ThreadPool* pool, PoolJob* job)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (!job->done)
+    {
+        pthread_cond_wait(&pool->job_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_free(ThreadPool* pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->job_ready);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->num_threads; i++)
+    {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_cond_destroy(&pool->job_done);
+    pthread_cond_destroy(&pool->job_ready);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool);
+}
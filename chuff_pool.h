@@ -0,0 +1,87 @@
+// chuff_pool.h
+// Ben Crabtree, 2021
+
+# ifndef CHUFF_POOL_H
+# define CHUFF_POOL_H
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdbool.h>
+# include <pthread.h>
+
+# define MAX_THREADS 256
+
+/*
+A unit of work for the pool
+The caller owns the PoolJob and must keep it alive until pool_wait_job() returns for it.
+fn is called with arg and the index (0 to num_threads-1) of the worker running it,
+so each worker can use its own scratch state without locking.
+*/
+struct PoolJob
+{
+    void (*fn)(void* arg, int worker);
+    void* arg;
+    bool done;
+    struct PoolJob* next;
+};
+
+typedef struct PoolJob PoolJob;
+
+/*
+A fixed set of worker threads taking jobs from a FIFO queue
+*/
+struct ThreadPool
+{
+    pthread_t* threads;
+    int num_threads;
+    pthread_mutex_t lock;
+    pthread_cond_t job_ready; // Signalled when a job is queued or the pool shuts down
+    pthread_cond_t job_done; // Broadcast when any job finishes
+    PoolJob* queue_head;
+    PoolJob* queue_tail;
+    bool shutdown;
+};
+
+typedef struct ThreadPool ThreadPool;
+
+/*
+Initialise a ThreadPool:
+- Allocates memory
+- Starts num_threads worker threads waiting for jobs
+Takes:
+- The number of worker threads, 1 to MAX_THREADS
+Returns:
+- A pointer to the ThreadPool, or NULL if the threads could not be started
+*/
+ThreadPool* pool_create(int num_threads);
+
+/*
+Queues a job to be run by the next free worker
+Takes:
+- A pointer to the ThreadPool
+- A pointer to the PoolJob with fn and arg set
+Returns:
+- Void
+*/
+void pool_submit(ThreadPool* pool, PoolJob* job);
+
+/*
+Waits until a submitted job has finished running
+Takes:
+- A pointer to the ThreadPool
+- A pointer to a PoolJob previously passed to pool_submit()
+Returns:
+- Void
+*/
+void pool_wait_job(ThreadPool* pool, PoolJob* job);
+
+/*
+Stops the workers once the queue is empty and frees the pool
+Takes:
+- A pointer to the ThreadPool
+Returns:
+- Void
+*/
+void pool_free(ThreadPool* pool);
+
+# endif
@@ -4,6 +4,81 @@
 # ifndef CHUFF_SHARED_H
 # define CHUFF_SHARED_H
 
-# define NUM_ASCII 200
+# include <stdint.h>
+# include <time.h>
 
-# endif
\ No newline at end of file
+// Every byte value can be coded, so any file can be compressed, not just ascii text
+# define NUM_SYMBOLS 256
+
+// A symbol of the alphabet being coded. Bytes for now, but wide enough for 16-bit samples or token ids
+typedef uint32_t Symbol;
+
+/*
+Gets a monotonic time for measuring how long things take
+Takes:
+- Nothing
+Returns:
+- The time in nanoseconds from an arbitrary starting point
+*/
+static inline uint64_t get_time_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+Writes a 32-bit int as 4 big endian bytes
+Takes:
+- A pointer to the destination
+- The value
+Returns:
+- Void
+*/
+static inline void put_u32(uint8_t* dst, uint32_t value)
+{
+    dst[0] = (uint8_t)(value >> 24);
+    dst[1] = (uint8_t)(value >> 16);
+    dst[2] = (uint8_t)(value >> 8);
+    dst[3] = (uint8_t)value;
+}
+
+/*
+Reads a 32-bit int from 4 big endian bytes
+Takes:
+- A pointer to the source
+Returns:
+- The value
+*/
+static inline uint32_t get_u32(const uint8_t* src)
+{
+    return ((uint32_t)src[0] << 24) | ((uint32_t)src[1] << 16) | ((uint32_t)src[2] << 8) | src[3];
+}
+
+/*
+Writes a 64-bit int as 8 big endian bytes
+Takes:
+- A pointer to the destination
+- The value
+Returns:
+- Void
+*/
+static inline void put_u64(uint8_t* dst, uint64_t value)
+{
+    put_u32(dst, (uint32_t)(value >> 32));
+    put_u32(dst + 4, (uint32_t)value);
+}
+
+/*
+Reads a 64-bit int from 8 big endian bytes
+Takes:
+- A pointer to the source
+Returns:
+- The value
+*/
+static inline uint64_t get_u64(const uint8_t* src)
+{
+    return ((uint64_t)get_u32(src) << 32) | get_u32(src + 4);
+}
+
+# endif
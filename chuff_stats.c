@@ -0,0 +1,122 @@
+// chuff_stats.c
+// Ben Crabtree, 2021
+
+# include <sys/resource.h>
+
+# include "chuff_stats.h"
+
+uint64_t num_allocations = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t num, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+// With --wrap, every call to malloc, calloc or realloc in chuff comes here first
+void* __wrap_malloc(size_t size)
+{
+    __atomic_fetch_add(&num_allocations, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t num, size_t size)
+{
+    __atomic_fetch_add(&num_allocations, 1, __ATOMIC_RELAXED);
+    return __real_calloc(num, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+    __atomic_fetch_add(&num_allocations, 1, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+uint64_t stats_num_allocations()
+{
+    return __atomic_load_n(&num_allocations, __ATOMIC_RELAXED);
+}
+
+// Names of the phases in StreamStats, in the order of PHASE_COUNT to PHASE_CHECKSUM
+const char* phase_names[NUM_BLOCK_PHASES] = {"count", "codes", "encode", "decode_table", "decode", "checksum"};
+
+void stats_print(StreamStats* stats, bool compress, uint64_t wall_ns, int format)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double user_s = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6;
+    double sys_s = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+    double wall_s = wall_ns * 1e-9;
+    uint64_t bytes_in = compress ? stats->raw_bytes : stats->comp_bytes;
+    uint64_t bytes_out = compress ? stats->comp_bytes : stats->raw_bytes;
+    double throughput = wall_s > 0 ? stats->raw_bytes / wall_s / 1e6 : 0;
+
+    // Compression efficiency, measured only over the blocks given order-0 Huffman codes, against each
+    // block's own order-0 entropy: the other models can beat it, and stored blocks don't try to
+    bool have_entropy = compress && stats->order0_raw_bytes > 0 && stats->order0_entropy_bits > 0;
+    double entropy = have_entropy ? stats->order0_entropy_bits / stats->order0_raw_bytes : 0;
+    double order0_bits_per_symbol = have_entropy ? 8.0 * stats->order0_body_bytes / stats->order0_raw_bytes : 0;
+    double order0_share = have_entropy ? 100.0 * stats->order0_raw_bytes / stats->raw_bytes : 0;
+    bool have_bits = compress && stats->raw_bytes > 0;
+    double bits_per_symbol = stats->raw_bytes > 0 ? 8.0 * stats->comp_bytes / stats->raw_bytes : 0;
+    double payload_bits_per_symbol = stats->raw_bytes > 0 ? (double)stats->payload_bits / stats->raw_bytes : 0;
+    double limit_loss = stats->unlimited_bits > 0 ? 100.0 * ((double)stats->payload_bits - (double)stats->unlimited_bits) / stats->unlimited_bits : 0;
+
+    if (format == STATS_JSON)
+    {
+        fprintf(stderr, "{\"mode\":\"%s\",\"bytes_in\":%llu,\"bytes_out\":%llu,\"blocks\":%llu,"
+            "\"wall_s\":%.6f,\"cpu_user_s\":%.6f,\"cpu_sys_s\":%.6f,\"throughput_mb_s\":%.3f,"
+            "\"allocations\":%llu,\"peak_rss_kb\":%ld",
+            compress ? "compress" : "decompress", (unsigned long long)bytes_in, (unsigned long long)bytes_out,
+            (unsigned long long)stats->num_blocks, wall_s, user_s, sys_s, throughput,
+            (unsigned long long)stats_num_allocations(), usage.ru_maxrss);
+        if (have_bits)
+        {
+            fprintf(stderr, ",\"bits_per_symbol\":%.6f,\"payload_bits_per_symbol\":%.6f,\"code_len_limit_loss_pct\":%.6f",
+                bits_per_symbol, payload_bits_per_symbol, limit_loss);
+        }
+        if (have_entropy)
+        {
+            fprintf(stderr, ",\"order0_share_pct\":%.6f,\"entropy_bits\":%.6f,\"order0_bits_per_symbol\":%.6f,\"gap_bits\":%.6f",
+                order0_share, entropy, order0_bits_per_symbol, order0_bits_per_symbol - entropy);
+        }
+        fprintf(stderr, ",\"phases_s\":{\"read\":%.6f,\"wait\":%.6f,\"write\":%.6f",
+            stats->read_ns * 1e-9, stats->wait_ns * 1e-9, stats->write_ns * 1e-9);
+        for (int i = 0; i < NUM_BLOCK_PHASES; i++)
+        {
+            fprintf(stderr, ",\"%s\":%.6f", phase_names[i], stats->phase_ns[i] * 1e-9);
+        }
+        fprintf(stderr, "}}\n");
+        return;
+    }
+
+    fprintf(stderr, "Mode:         %s\n", compress ? "compress" : "decompress");
+    fprintf(stderr, "Bytes in:     %llu\n", (unsigned long long)bytes_in);
+    fprintf(stderr, "Bytes out:    %llu\n", (unsigned long long)bytes_out);
+    fprintf(stderr, "Blocks:       %llu\n", (unsigned long long)stats->num_blocks);
+    fprintf(stderr, "Wall time:    %.4f s\n", wall_s);
+    fprintf(stderr, "CPU time:     %.4f s user, %.4f s sys\n", user_s, sys_s);
+    fprintf(stderr, "Throughput:   %.2f MB/s of original data\n", throughput);
+    fprintf(stderr, "Allocations:  %llu\n", (unsigned long long)stats_num_allocations());
+    fprintf(stderr, "Peak memory:  %ld KB\n", usage.ru_maxrss);
+    if (have_bits)
+    {
+        fprintf(stderr, "Achieved:     %.4f bits/symbol (%.4f in codes, the rest is headers)\n", bits_per_symbol, payload_bits_per_symbol);
+        if (stats->payload_bits != stats->unlimited_bits)
+        {
+            fprintf(stderr, "Length limit: %.4f%% more than unlimited code lengths\n", limit_loss);
+        }
+    }
+    if (have_entropy)
+    {
+        fprintf(stderr, "Order 0:      %.2f%% of the input given order-0 Huffman codes\n", order0_share);
+        fprintf(stderr, "Entropy:      %.4f bits/symbol (order 0, each block's own)\n", entropy);
+        fprintf(stderr, "Gap:          %.4f bits/symbol (%.4f achieved with code tables, %.2f%% efficient)\n",
+            order0_bits_per_symbol - entropy, order0_bits_per_symbol, 100.0 * entropy / order0_bits_per_symbol);
+    }
+    // Reading, waiting and writing happen on the calling thread, the rest on the workers
+    fprintf(stderr, "Phases (s):   read %.4f, wait %.4f, write %.4f", stats->read_ns * 1e-9, stats->wait_ns * 1e-9, stats->write_ns * 1e-9);
+    for (int i = 0; i < NUM_BLOCK_PHASES; i++)
+    {
+        fprintf(stderr, ", %s %.4f", phase_names[i], stats->phase_ns[i] * 1e-9);
+    }
+    fprintf(stderr, "\n");
+}
@@ -0,0 +1,48 @@
+// chuff_stats.h
+// Ben Crabtree, 2021
+
+# ifndef CHUFF_STATS_H
+# define CHUFF_STATS_H
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdbool.h>
+# include <stdint.h>
+# include <string.h>
+
+# include "chuff_shared.h"
+# include "chuff_stream.h"
+
+// What --stats prints
+# define STATS_NONE 0
+# define STATS_TEXT 1
+# define STATS_JSON 2
+
+/*
+Gets the number of malloc, calloc and realloc calls made so far
+These are only counted when linked with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc
+(as the chuff executable is), otherwise this is always 0.
+Takes:
+- Nothing
+Returns:
+- The number of allocations
+*/
+uint64_t stats_num_allocations();
+
+/*
+Prints a report of a compress or decompress run to stderr:
+bytes in and out, wall and CPU time, throughput, allocations, peak memory, time in each phase,
+and for compression the bits per symbol achieved, and how far the blocks given order-0 Huffman codes
+came from their own order-0 entropy.
+JSON is printed as a single object on one line for feeding into other tools.
+Takes:
+- A pointer to the StreamStats of the run
+- true if the run was compression
+- The wall time of the whole run in nanoseconds
+- STATS_TEXT or STATS_JSON
+Returns:
+- Void
+*/
+void stats_print(StreamStats* stats, bool compress, uint64_t wall_ns, int format);
+
+# endif
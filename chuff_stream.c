@@ -0,0 +1,751 @@
+// chuff_stream.c
+// Ben Crabtree, 2021
+
+# include "chuff_stream.h"
+
+/*
+A block making its way through the pool
+Slots are filled in turn and reused in the same order, so the oldest block
+still in flight is always the one in the slot about to be refilled.
+*/
+struct StreamSlot
+{
+    PoolJob job;
+    BlockCoder* coders; // One per worker, shared by all slots
+    uint8_t* raw;
+    const uint8_t* data; // Raw data to compress: raw, or part of the mapped input
+    size_t raw_size;
+    uint8_t* comp;
+    size_t comp_size;
+    size_t comp_cap;
+    long result; // Set by the worker, -1 on error
+    bool in_flight;
+};
+
+typedef struct StreamSlot StreamSlot;
+
+struct StreamPipeline
+{
+    ThreadPool* pool;
+    BlockCoder* coders;
+    int num_threads;
+    StreamSlot* slots;
+    int num_slots;
+    size_t block_size;
+    BlockIndex index; // Where each block written so far starts
+    uint64_t raw_offset; // Raw bytes written so far
+    uint64_t comp_offset; // Compressed bytes written so far
+    uint64_t read_ns;
+    uint64_t write_ns;
+    uint64_t wait_ns;
+    AsyncWriter writer; // Output is written from its own thread
+};
+
+typedef struct StreamPipeline StreamPipeline;
+
+void stream_options_init(StreamOptions* options)
+{
+    options->block_size = DEFAULT_BLOCK_SIZE;
+    options->num_threads = 1;
+    options->max_code_len = 0;
+    options->adaptive = false;
+    options->order = 0;
+    options->num_streams = DEFAULT_NUM_STREAMS;
+    options->checksums = true;
+    options->words = false;
+    options->block_types = true;
+    options->ans = false;
+}
+
+size_t stream_write_header(uint8_t* header, const StreamOptions* options)
+{
+    memcpy(header, STREAM_MAGIC, 4);
+    header[4] = STREAM_VERSION;
+    put_u32(header + 5, (uint32_t)options->block_size);
+    header[9] = (uint8_t)options->order;
+    header[10] = (uint8_t)options->num_streams;
+    header[11] = (options->checksums ? STREAM_FLAG_CHECKSUMS : 0) | (options->words ? STREAM_FLAG_WORDS : 0)
+        | (options->block_types ? STREAM_FLAG_BLOCK_TYPES : 0);
+    return STREAM_HEADER_SIZE;
+}
+
+long stream_parse_header(const uint8_t* header, size_t size, StreamOptions* options)
+{
+    if (size < STREAM_V3_HEADER_SIZE || memcmp(header, STREAM_MAGIC, 4) != 0
+        || header[4] < STREAM_MIN_VERSION || header[4] > STREAM_VERSION)
+    {
+        return -1;
+    }
+    int version = header[4];
+    size_t header_size = STREAM_V3_HEADER_SIZE + (version - 3);
+    if (size < header_size)
+    {
+        return -1;
+    }
+    options->block_size = get_u32(header + 5);
+    options->order = version >= 4 ? header[9] : 0;
+    options->num_streams = version >= 5 ? header[10] : 1;
+    int flags = version >= 6 ? header[11] : 0;
+    options->checksums = (flags & STREAM_FLAG_CHECKSUMS) != 0;
+    options->words = (flags & STREAM_FLAG_WORDS) != 0;
+    options->block_types = (flags & STREAM_FLAG_BLOCK_TYPES) != 0;
+    if (options->block_size < MIN_BLOCK_SIZE || options->block_size > MAX_BLOCK_SIZE
+        || options->order > BLOCK_MAX_ORDER
+        || options->num_streams < 1 || options->num_streams > BLOCK_MAX_STREAMS
+        || (flags & ~(STREAM_FLAG_CHECKSUMS | STREAM_FLAG_WORDS | STREAM_FLAG_BLOCK_TYPES)) != 0
+        || (options->words && options->order != 0))
+    {
+        return -1;
+    }
+    return header_size;
+}
+
+int pipeline_init(StreamPipeline* pipeline, StreamOptions* options)
+{
+    int num_threads = options->num_threads;
+    pipeline->pool = pool_create(num_threads);
+    if (pipeline->pool == NULL)
+    {
+        fprintf(stderr, "Could not start %d threads.\n", num_threads);
+        return -1;
+    }
+    pipeline->num_threads = num_threads;
+    size_t block_size = options->block_size;
+    pipeline->block_size = block_size;
+    pipeline->coders = malloc( num_threads * sizeof(BlockCoder) );
+    for (int i = 0; i < num_threads; i++)
+    {
+        block_coder_init(&pipeline->coders[i]);
+        pipeline->coders[i].max_code_len = options->max_code_len;
+        pipeline->coders[i].order = options->order;
+        pipeline->coders[i].num_streams = options->num_streams;
+        pipeline->coders[i].checksums = options->checksums;
+        pipeline->coders[i].words = options->words;
+        pipeline->coders[i].block_types = options->block_types;
+        pipeline->coders[i].ans = options->ans;
+    }
+    // Two slots per worker so the next block can be read while every worker is busy
+    pipeline->num_slots = 2 * num_threads;
+    pipeline->slots = malloc( pipeline->num_slots * sizeof(StreamSlot) );
+    for (int i = 0; i < pipeline->num_slots; i++)
+    {
+        StreamSlot* slot = &pipeline->slots[i];
+        slot->job.arg = slot;
+        slot->coders = pipeline->coders;
+        slot->raw = malloc(block_size);
+        slot->raw_size = 0;
+        slot->comp_cap = block_compress_bound(block_size);
+        slot->comp = malloc(slot->comp_cap);
+        slot->comp_size = 0;
+        slot->result = 0;
+        slot->in_flight = false;
+    }
+    index_init(&pipeline->index);
+    pipeline->raw_offset = 0;
+    pipeline->comp_offset = 0;
+    pipeline->read_ns = 0;
+    pipeline->write_ns = 0;
+    pipeline->wait_ns = 0;
+    return 0;
+}
+
+void pipeline_get_stats(StreamPipeline* pipeline, StreamStats* stats)
+{
+    memset(stats, 0, sizeof(StreamStats));
+    stats->raw_bytes = pipeline->raw_offset;
+    stats->comp_bytes = pipeline->comp_offset;
+    stats->read_ns = pipeline->read_ns;
+    stats->write_ns = pipeline->write_ns;
+    stats->wait_ns = pipeline->wait_ns;
+    for (int i = 0; i < pipeline->num_threads; i++)
+    {
+        BlockCoder* coder = &pipeline->coders[i];
+        stats->payload_bits += coder->payload_bits;
+        stats->unlimited_bits += coder->unlimited_bits;
+        stats->order0_entropy_bits += coder->order0_entropy_bits;
+        stats->order0_raw_bytes += coder->order0_raw_bytes;
+        stats->order0_body_bytes += coder->order0_body_bytes;
+        for (int j = 0; j < NUM_BLOCK_PHASES; j++)
+        {
+            stats->phase_ns[j] += coder->phase_ns[j];
+        }
+    }
+}
+
+void pipeline_free(StreamPipeline* pipeline)
+{
+    // Workers finish any queued jobs before the pool stops, so the slots are safe to free afterwards
+    if (pipeline->pool != NULL)
+    {
+        pool_free(pipeline->pool);
+    }
+    for (int i = 0; i < pipeline->num_slots; i++)
+    {
+        free(pipeline->slots[i].raw);
+        free(pipeline->slots[i].comp);
+    }
+    free(pipeline->slots);
+    for (int i = 0; i < pipeline->num_threads; i++)
+    {
+        block_coder_free(&pipeline->coders[i]);
+    }
+    free(pipeline->coders);
+    index_free(&pipeline->index);
+}
+
+void compress_slot(void* arg, int worker)
+{
+    StreamSlot* slot = arg;
+    slot->result = block_compress(&slot->coders[worker], slot->data, slot->raw_size, slot->comp, slot->comp_cap);
+}
+
+void decompress_slot(void* arg, int worker)
+{
+    StreamSlot* slot = arg;
+    slot->result = block_decompress(&slot->coders[worker], slot->comp, slot->comp_size, slot->raw, slot->raw_size);
+}
+
+int finish_compress_slot(StreamPipeline* pipeline, StreamSlot* slot)
+{
+    uint64_t start = get_time_ns();
+    pool_wait_job(pipeline->pool, &slot->job);
+    uint64_t done = get_time_ns();
+    pipeline->wait_ns += done - start;
+    slot->in_flight = false;
+    if (slot->result < 0)
+    {
+        fprintf(stderr, "Could not compress block.\n");
+        return -1;
+    }
+    if (writer_write(&pipeline->writer, slot->comp, slot->result) != 0)
+    {
+        fprintf(stderr, "Could not write output.\n");
+        return -1;
+    }
+    pipeline->write_ns += get_time_ns() - done;
+    index_add(&pipeline->index, pipeline->raw_offset, slot->raw_size, pipeline->comp_offset);
+    pipeline->raw_offset += slot->raw_size;
+    pipeline->comp_offset += slot->result;
+    return 0;
+}
+
+int finish_decompress_slot(StreamPipeline* pipeline, StreamSlot* slot)
+{
+    uint64_t start = get_time_ns();
+    pool_wait_job(pipeline->pool, &slot->job);
+    uint64_t done = get_time_ns();
+    pipeline->wait_ns += done - start;
+    slot->in_flight = false;
+    if (slot->result < 0)
+    {
+        fprintf(stderr, "Could not decompress block: it is corrupt or fails its checksum.\n");
+        return -1;
+    }
+    if (writer_write(&pipeline->writer, slot->raw, slot->result) != 0)
+    {
+        fprintf(stderr, "Could not write output.\n");
+        return -1;
+    }
+    pipeline->write_ns += get_time_ns() - done;
+    pipeline->raw_offset += slot->result;
+    return 0;
+}
+
+/*
+Compresses everything read from in into blocks after those the pipeline has already written,
+then writes the end marker and index footer and closes the writer
+Takes:
+- A pointer to the StreamPipeline, with its writer open and its index and offsets covering any blocks before
+- A pointer to the input FILE
+Returns:
+- 0 on success, -1 on error (after printing a message to stderr)
+*/
+int compress_blocks(StreamPipeline* pipeline, FILE* in)
+{
+    size_t block_size = pipeline->block_size;
+    int result = 0;
+
+    // Regular files are compressed straight from a mapping, anything else is read into the slots
+    InputMap map;
+    bool mapped = input_map(in, &map) == 0;
+    size_t map_pos = 0;
+
+    int next = 0;
+    bool end_of_input = false;
+    while (!end_of_input)
+    {
+        StreamSlot* slot = &pipeline->slots[next];
+        if (slot->in_flight)
+        {
+            if (finish_compress_slot(pipeline, slot) != 0)
+            {
+                result = -1;
+                break;
+            }
+            // Blocks finish in order, so everything up to the end of this one is done with
+            if (mapped)
+            {
+                input_release(&map, slot->data + slot->raw_size - map.data);
+            }
+        }
+        uint64_t start = get_time_ns();
+        if (mapped)
+        {
+            slot->data = map.data + map_pos;
+            slot->raw_size = map.size - map_pos < block_size ? map.size - map_pos : block_size;
+            map_pos += slot->raw_size;
+            end_of_input = map_pos == map.size;
+        }
+        else
+        {
+            // fread only comes up short at the end of the input
+            slot->data = slot->raw;
+            slot->raw_size = fread(slot->raw, 1, block_size, in);
+            end_of_input = slot->raw_size < block_size;
+        }
+        pipeline->read_ns += get_time_ns() - start;
+        if (slot->raw_size > 0)
+        {
+            slot->job.fn = compress_slot;
+            slot->in_flight = true;
+            pool_submit(pipeline->pool, &slot->job);
+        }
+        next = (next + 1) % pipeline->num_slots;
+    }
+    // Write out the blocks still in flight, oldest first (pipeline_free() waits for them after an error)
+    for (int i = 0; i < pipeline->num_slots; i++)
+    {
+        StreamSlot* slot = &pipeline->slots[(next + i) % pipeline->num_slots];
+        if (result == 0 && slot->in_flight && finish_compress_slot(pipeline, slot) != 0)
+        {
+            result = -1;
+        }
+    }
+    if (ferror(in))
+    {
+        fprintf(stderr, "Could not read input.\n");
+        result = -1;
+    }
+
+    // End marker then index footer
+    uint64_t start = get_time_ns();
+    size_t footer_size = BLOCK_HEADER_SIZE + index_size(&pipeline->index);
+    uint8_t* footer = calloc(footer_size, 1);
+    index_write_buffer(&pipeline->index, footer + BLOCK_HEADER_SIZE);
+    writer_write(&pipeline->writer, footer, footer_size);
+    free(footer);
+    pipeline->comp_offset += footer_size;
+    // Workers must finish with the mapping before it goes
+    pool_free(pipeline->pool);
+    pipeline->pool = NULL;
+    if (mapped)
+    {
+        input_unmap(&map);
+    }
+    if (writer_close(&pipeline->writer) != 0 && result == 0)
+    {
+        fprintf(stderr, "Could not write output.\n");
+        result = -1;
+    }
+    pipeline->write_ns += get_time_ns() - start;
+    return result;
+}
+
+int stream_compress(FILE* in, FILE* out, StreamOptions* options, StreamStats* stats)
+{
+    if (options->adaptive)
+    {
+        StreamStats adaptive_stats;
+        memset(&adaptive_stats, 0, sizeof(StreamStats));
+        int result = adaptive_compress(in, out, &adaptive_stats.raw_bytes, &adaptive_stats.comp_bytes);
+        if (stats != NULL)
+        {
+            *stats = adaptive_stats;
+        }
+        return result;
+    }
+
+    StreamPipeline pipeline;
+    if (pipeline_init(&pipeline, options) != 0)
+    {
+        return -1;
+    }
+    if (writer_open(&pipeline.writer, out) != 0)
+    {
+        fprintf(stderr, "Could not start writing output.\n");
+        pipeline_free(&pipeline);
+        return -1;
+    }
+
+    uint8_t header[STREAM_HEADER_SIZE];
+    pipeline.comp_offset = stream_write_header(header, options);
+    writer_write(&pipeline.writer, header, pipeline.comp_offset);
+    int result = compress_blocks(&pipeline, in);
+
+    if (stats != NULL)
+    {
+        pipeline_get_stats(&pipeline, stats);
+        stats->num_blocks = pipeline.index.num_entries;
+    }
+    pipeline_free(&pipeline);
+    return result;
+}
+
+/*
+Reads the header at the start of a chuff stream
+Takes:
+- A pointer to the input FILE
+- A pointer to StreamOptions whose block size, order and number of streams are filled in
+- A pointer to a flag set if the stream is adaptive (and only its magic has been read)
+Returns:
+- The number of header bytes read, or -1 on error (after printing a message to stderr)
+*/
+long read_stream_header(FILE* in, StreamOptions* format, bool* adaptive)
+{
+    uint8_t header[STREAM_HEADER_SIZE];
+    *adaptive = false;
+    if (fread(header, 1, 4, in) != 4)
+    {
+        fprintf(stderr, "Not a chuff stream.\n");
+        return -1;
+    }
+    // An adaptive stream has no block size, so leave the rest for adaptive_decompress()
+    if (memcmp(header, ADAPTIVE_MAGIC, 4) == 0)
+    {
+        *adaptive = true;
+        return 4;
+    }
+    if (fread(header + 4, 1, STREAM_V3_HEADER_SIZE - 4, in) != STREAM_V3_HEADER_SIZE - 4
+        || memcmp(header, STREAM_MAGIC, 4) != 0)
+    {
+        fprintf(stderr, "Not a chuff stream.\n");
+        return -1;
+    }
+    if (header[4] < STREAM_MIN_VERSION || header[4] > STREAM_VERSION)
+    {
+        fprintf(stderr, "Unsupported chuff stream version %d.\n", header[4]);
+        return -1;
+    }
+    // Each version after 3 adds a byte to the header
+    size_t size = STREAM_V3_HEADER_SIZE;
+    size += fread(header + size, 1, header[4] - 3, in);
+    long header_size = stream_parse_header(header, size, format);
+    if (header_size < 0)
+    {
+        fprintf(stderr, "Bad stream header.\n");
+    }
+    return header_size;
+}
+
+/*
+Finds where the end marker of a seekable chuff file is, checking it against the index
+The index has to agree with the last block, or new blocks could end up after the wrong end.
+Takes:
+- A pointer to the FILE
+- The size of the stream header
+- A pointer to the BlockIndex read from the file
+Returns:
+- The offset of the end marker, or -1 if the file doesn't end with an end marker and index after its last block
+*/
+off_t find_end_marker(FILE* file, long header_size, BlockIndex* index)
+{
+    if (fseeko(file, 0, SEEK_END) != 0)
+    {
+        return -1;
+    }
+    off_t end_offset = ftello(file) - (off_t)index_size(index) - BLOCK_HEADER_SIZE;
+    uint8_t block_header[BLOCK_HEADER_SIZE];
+    if (end_offset < header_size || fseeko(file, end_offset, SEEK_SET) != 0
+        || fread(block_header, 1, BLOCK_HEADER_SIZE, file) != BLOCK_HEADER_SIZE || get_u32(block_header) != 0)
+    {
+        return -1;
+    }
+    if (index->num_entries == 0)
+    {
+        return end_offset == header_size && index->raw_size == 0 ? end_offset : -1;
+    }
+    IndexEntry* last = &index->entries[index->num_entries - 1];
+    if (fseeko(file, last->comp_offset, SEEK_SET) != 0
+        || fread(block_header, 1, BLOCK_HEADER_SIZE, file) != BLOCK_HEADER_SIZE
+        || last->comp_offset + BLOCK_HEADER_SIZE + get_u32(block_header + 4) != (uint64_t)end_offset
+        || last->raw_offset + get_u32(block_header) != index->raw_size)
+    {
+        return -1;
+    }
+    return end_offset;
+}
+
+int stream_append(FILE* in, FILE* file, StreamOptions* options, StreamStats* stats)
+{
+    // New blocks have to match the ones already there, so only the threads, code length limit and coder come from the options
+    StreamOptions format = *options;
+    bool adaptive;
+    long header_size = read_stream_header(file, &format, &adaptive);
+    if (header_size < 0)
+    {
+        return -1;
+    }
+    if (adaptive)
+    {
+        fprintf(stderr, "Adaptive streams have no block index, so they can't be appended to.\n");
+        return -1;
+    }
+    if (format.ans && (!format.block_types || format.order != 0 || format.words))
+    {
+        fprintf(stderr, "tANS blocks can only be appended to order-0 byte streams from this version on.\n");
+        return -1;
+    }
+    BlockIndex index;
+    if (index_read(&index, file) != 0)
+    {
+        fprintf(stderr, "Stream has no block index (it must be a seekable chuff file).\n");
+        return -1;
+    }
+    off_t end_offset = find_end_marker(file, header_size, &index);
+    if (end_offset < 0 || fseeko(file, end_offset, SEEK_SET) != 0)
+    {
+        fprintf(stderr, "Stream's index doesn't match its blocks.\n");
+        index_free(&index);
+        return -1;
+    }
+
+    StreamPipeline pipeline;
+    if (pipeline_init(&pipeline, &format) != 0)
+    {
+        index_free(&index);
+        return -1;
+    }
+    // The new blocks and footer go over the old end marker and index, so only the new data is coded
+    index_free(&pipeline.index);
+    pipeline.index = index;
+    pipeline.raw_offset = index.raw_size;
+    pipeline.comp_offset = end_offset;
+    size_t old_blocks = index.num_entries;
+    if (writer_open(&pipeline.writer, file) != 0)
+    {
+        fprintf(stderr, "Could not start writing output.\n");
+        pipeline_free(&pipeline);
+        return -1;
+    }
+    int result = compress_blocks(&pipeline, in);
+
+    if (stats != NULL)
+    {
+        pipeline_get_stats(&pipeline, stats);
+        stats->raw_bytes -= index.raw_size;
+        stats->comp_bytes -= end_offset;
+        stats->num_blocks = pipeline.index.num_entries - old_blocks;
+    }
+    pipeline_free(&pipeline);
+    return result;
+}
+
+int stream_decompress(FILE* in, FILE* out, StreamOptions* options, StreamStats* stats)
+{
+    // The format comes from the stream, only the number of threads from the options
+    StreamOptions format = *options;
+    bool adaptive;
+    long header_size = read_stream_header(in, &format, &adaptive);
+    if (header_size < 0)
+    {
+        return -1;
+    }
+    if (adaptive)
+    {
+        StreamStats adaptive_stats;
+        memset(&adaptive_stats, 0, sizeof(StreamStats));
+        int result = adaptive_decompress(in, out, &adaptive_stats.raw_bytes, &adaptive_stats.comp_bytes);
+        if (stats != NULL)
+        {
+            *stats = adaptive_stats;
+        }
+        return result;
+    }
+
+    StreamPipeline pipeline;
+    size_t block_size = format.block_size;
+    if (pipeline_init(&pipeline, &format) != 0)
+    {
+        return -1;
+    }
+    if (writer_open(&pipeline.writer, out) != 0)
+    {
+        fprintf(stderr, "Could not start writing output.\n");
+        pipeline_free(&pipeline);
+        return -1;
+    }
+    int result = 0;
+    pipeline.comp_offset = header_size;
+    uint64_t num_blocks = 0;
+
+    int next = 0;
+    while (true)
+    {
+        StreamSlot* slot = &pipeline.slots[next];
+        if (slot->in_flight && finish_decompress_slot(&pipeline, slot) != 0)
+        {
+            result = -1;
+            break;
+        }
+        uint64_t start = get_time_ns();
+        size_t header_size = fread(slot->comp, 1, BLOCK_HEADER_SIZE, in);
+        pipeline.read_ns += get_time_ns() - start;
+        if (header_size != BLOCK_HEADER_SIZE)
+        {
+            fprintf(stderr, "Stream is truncated.\n");
+            result = -1;
+            break;
+        }
+        size_t raw_size = get_u32(slot->comp);
+        size_t rest_size = get_u32(slot->comp + 4);
+        if (raw_size == 0)
+        {
+            break;
+        }
+        if (raw_size > block_size || rest_size > slot->comp_cap - BLOCK_HEADER_SIZE)
+        {
+            fprintf(stderr, "Bad block header.\n");
+            result = -1;
+            break;
+        }
+        start = get_time_ns();
+        size_t num_read = fread(slot->comp + BLOCK_HEADER_SIZE, 1, rest_size, in);
+        pipeline.read_ns += get_time_ns() - start;
+        if (num_read != rest_size)
+        {
+            fprintf(stderr, "Stream is truncated.\n");
+            result = -1;
+            break;
+        }
+        pipeline.comp_offset += BLOCK_HEADER_SIZE + rest_size;
+        num_blocks++;
+        slot->raw_size = raw_size;
+        slot->comp_size = BLOCK_HEADER_SIZE + rest_size;
+        slot->job.fn = decompress_slot;
+        slot->in_flight = true;
+        pool_submit(pipeline.pool, &slot->job);
+        next = (next + 1) % pipeline.num_slots;
+    }
+    // Write out the blocks still in flight, oldest first (pipeline_free() waits for them after an error)
+    for (int i = 0; i < pipeline.num_slots; i++)
+    {
+        StreamSlot* slot = &pipeline.slots[(next + i) % pipeline.num_slots];
+        if (result == 0 && slot->in_flight && finish_decompress_slot(&pipeline, slot) != 0)
+        {
+            result = -1;
+        }
+    }
+    // Workers must be done with the slots before the last of the output is written
+    pool_free(pipeline.pool);
+    pipeline.pool = NULL;
+    if (writer_close(&pipeline.writer) != 0 && result == 0)
+    {
+        fprintf(stderr, "Could not write output.\n");
+        result = -1;
+    }
+
+    if (stats != NULL)
+    {
+        pipeline_get_stats(&pipeline, stats);
+        // The end marker was read too, but not the index after it
+        stats->comp_bytes += BLOCK_HEADER_SIZE;
+        stats->num_blocks = num_blocks;
+    }
+    pipeline_free(&pipeline);
+    return result;
+}
+
+int stream_decompress_range(FILE* in, FILE* out, uint64_t offset, uint64_t length)
+{
+    StreamOptions format;
+    stream_options_init(&format);
+    bool adaptive;
+    if (read_stream_header(in, &format, &adaptive) < 0)
+    {
+        return -1;
+    }
+    if (adaptive)
+    {
+        fprintf(stderr, "Adaptive streams have no block index, so --range can't be used.\n");
+        return -1;
+    }
+    BlockIndex index;
+    if (index_read(&index, in) != 0)
+    {
+        fprintf(stderr, "Stream has no block index (input must be a seekable chuff file).\n");
+        return -1;
+    }
+    if (offset > index.raw_size)
+    {
+        fprintf(stderr, "Range starts after the end of the data (%llu bytes).\n", (unsigned long long)index.raw_size);
+        index_free(&index);
+        return -1;
+    }
+    if (length > index.raw_size - offset)
+    {
+        length = index.raw_size - offset;
+    }
+
+    size_t block_size = format.block_size;
+    uint8_t* raw = malloc(block_size);
+    size_t comp_cap = block_compress_bound(block_size);
+    uint8_t* comp = malloc(comp_cap);
+    BlockCoder coder;
+    block_coder_init(&coder);
+    coder.order = format.order;
+    coder.num_streams = format.num_streams;
+    coder.checksums = format.checksums;
+    coder.words = format.words;
+    coder.block_types = format.block_types;
+    int result = 0;
+
+    // Only decode the blocks overlapping [offset, offset + length)
+    uint64_t end = offset + length;
+    size_t i = length > 0 ? index_find(&index, offset) : index.num_entries;
+    for ( ; i < index.num_entries && index.entries[i].raw_offset < end; i++)
+    {
+        IndexEntry* entry = &index.entries[i];
+        if (fseeko(in, entry->comp_offset, SEEK_SET) != 0
+            || fread(comp, 1, BLOCK_HEADER_SIZE, in) != BLOCK_HEADER_SIZE)
+        {
+            fprintf(stderr, "Stream is truncated.\n");
+            result = -1;
+            break;
+        }
+        size_t rest_size = get_u32(comp + 4);
+        if (rest_size > comp_cap - BLOCK_HEADER_SIZE
+            || fread(comp + BLOCK_HEADER_SIZE, 1, rest_size, in) != rest_size)
+        {
+            fprintf(stderr, "Bad block at offset %llu.\n", (unsigned long long)entry->comp_offset);
+            result = -1;
+            break;
+        }
+        long raw_size = block_decompress(&coder, comp, BLOCK_HEADER_SIZE + rest_size, raw, block_size);
+        if (raw_size < 0)
+        {
+            fprintf(stderr, "Could not decompress block: it is corrupt or fails its checksum.\n");
+            result = -1;
+            break;
+        }
+        // Cut the requested bytes out of the block
+        uint64_t block_start = entry->raw_offset;
+        uint64_t block_end = block_start + raw_size;
+        uint64_t from = offset > block_start ? offset : block_start;
+        uint64_t to = end < block_end ? end : block_end;
+        if (to > from)
+        {
+            fwrite(raw + (from - block_start), 1, to - from, out);
+        }
+    }
+    if (fflush(out) != 0 || ferror(out))
+    {
+        fprintf(stderr, "Could not write output.\n");
+        result = -1;
+    }
+
+    block_coder_free(&coder);
+    free(comp);
+    free(raw);
+    index_free(&index);
+    return result;
+}
@@ -0,0 +1,191 @@
+// chuff_stream.h
+// Ben Crabtree, 2021
+
+# ifndef CHUFF_STREAM_H
+# define CHUFF_STREAM_H
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdbool.h>
+# include <stdint.h>
+# include <string.h>
+
+# include "chuff_shared.h"
+# include "chuff_block.h"
+# include "chuff_pool.h"
+# include "chuff_index.h"
+# include "chuff_adaptive.h"
+# include "chuff_io.h"
+
+# define STREAM_MAGIC "CHUF"
+# define STREAM_VERSION 6
+// Oldest stream version this build can still decompress
+# define STREAM_MIN_VERSION 3
+// Magic, version, block size, context order, streams per block and flags
+# define STREAM_HEADER_SIZE 12
+// Version 3 headers stop after the block size, and each later version adds a byte
+// (version 3 blocks are order 0, versions 3 and 4 have one stream per block
+// and versions before 6 have no flags)
+# define STREAM_V3_HEADER_SIZE 9
+
+// Header flag: every block ends with a CRC-32 of its raw data
+# define STREAM_FLAG_CHECKSUMS 1
+// Header flag: blocks are coded as words and separators (see chuff_words.h), with order 0
+# define STREAM_FLAG_WORDS 2
+// Header flag: every block starts with a type byte, so blocks that don't shrink are stored as they are
+# define STREAM_FLAG_BLOCK_TYPES 4
+
+# define DEFAULT_BLOCK_SIZE (1 << 20)
+# define MIN_BLOCK_SIZE (1 << 10)
+# define MAX_BLOCK_SIZE (1 << 26)
+
+// Range allowed for --max-code-len. Every byte value needs a code, so 8 bits is the least that works
+# define MIN_CODE_LEN_LIMIT 8
+# define MAX_CODE_LEN_LIMIT 32
+
+/*
+Settings for compressing and decompressing a stream
+*/
+struct StreamOptions
+{
+    size_t block_size; // MIN_BLOCK_SIZE to MAX_BLOCK_SIZE
+    int num_threads; // 1 to MAX_THREADS
+    int max_code_len; // MIN_CODE_LEN_LIMIT to MAX_CODE_LEN_LIMIT, or 0 for no limit
+    bool adaptive; // Compress in one pass with adaptive codes instead of blocks
+    int order; // Context order of the blocks, 0 to BLOCK_MAX_ORDER
+    int num_streams; // Interleaved bitstreams per block, 1 to BLOCK_MAX_STREAMS
+    bool checksums; // Whether blocks end with a CRC-32 of their raw data
+    bool words; // Whether blocks are coded as words and separators rather than bytes (order 0 only)
+    bool block_types; // Whether blocks start with a type byte, so those that don't shrink can be stored
+    bool ans; // Whether order-0 byte blocks are coded with tANS rather than Huffman codes (needs block_types)
+};
+
+typedef struct StreamOptions StreamOptions;
+
+/*
+Totals gathered while compressing or decompressing a stream
+Times in phase_ns are summed over the worker threads, the rest are for the calling thread.
+*/
+struct StreamStats
+{
+    uint64_t raw_bytes;
+    uint64_t comp_bytes; // Including headers and the index footer
+    uint64_t num_blocks;
+    uint64_t payload_bits; // Bits of codes written
+    uint64_t unlimited_bits; // Bits the codes would have taken with no code length limit
+    // Blocks given order-0 Huffman codes (compression only, see BlockCoder)
+    double order0_entropy_bits;
+    uint64_t order0_raw_bytes;
+    uint64_t order0_body_bytes;
+    uint64_t phase_ns[NUM_BLOCK_PHASES]; // Time spent in each BlockCoder phase
+    uint64_t read_ns; // Time spent reading input
+    uint64_t write_ns; // Time spent writing output
+    uint64_t wait_ns; // Time spent waiting for workers to finish blocks
+};
+
+typedef struct StreamStats StreamStats;
+
+/*
+Sets StreamOptions to the defaults: DEFAULT_BLOCK_SIZE, 1 thread, no code length limit
+and order-0 byte blocks of DEFAULT_NUM_STREAMS streams with checksums
+Takes:
+- A pointer to the StreamOptions
+Returns:
+- Void
+*/
+void stream_options_init(StreamOptions* options);
+
+/*
+Writes a stream header
+Takes:
+- A pointer to a buffer of at least STREAM_HEADER_SIZE bytes
+- A pointer to the StreamOptions giving the block size, order, number of streams, checksums, words and block types
+Returns:
+- The number of bytes written (STREAM_HEADER_SIZE)
+*/
+size_t stream_write_header(uint8_t* header, const StreamOptions* options);
+
+/*
+Reads a stream header of any supported version
+Takes:
+- A pointer to the header
+- The number of bytes available
+- A pointer to StreamOptions whose block size, order, number of streams, checksums, words and block types are filled in
+Returns:
+- The size of the header in bytes, or -1 if it is truncated, not a chuff stream or an unsupported version
+*/
+long stream_parse_header(const uint8_t* header, size_t size, StreamOptions* options);
+
+/*
+Compresses everything read from in and writes it to out as a chuff stream:
+- Stream header: magic "CHUF", version byte, block size (4 bytes big endian), context order byte,
+  streams per block byte, flags byte
+- One compressed block (see chuff_block.h) per block_size bytes of input
+- An end marker: a block header with raw size 0
+- A block index footer (see chuff_index.h) for random access
+Input is read in a single pass without seeking, so in can be a pipe. A regular file is
+mapped into memory instead, so blocks are compressed without being copied first.
+Blocks are compressed on a pool of num_threads workers, each with its own BlockCoder,
+while the calling thread reads input and hands finished blocks, in order, to an AsyncWriter
+that writes them out from its own thread.
+Memory use depends only on block_size and num_threads (2 * num_threads blocks in flight),
+not on how much input there is.
+If options->adaptive is set, an adaptive stream (see chuff_adaptive.h) is written instead.
+Takes:
+- A pointer to the input FILE
+- A pointer to the output FILE
+- A pointer to the StreamOptions to compress with
+- A pointer to StreamStats to fill in, or NULL
+Returns:
+- 0 on success, -1 on error (after printing a message to stderr)
+*/
+int stream_compress(FILE* in, FILE* out, StreamOptions* options, StreamStats* stats);
+
+/*
+Compresses everything read from in and adds it to the end of an existing chuff file:
+- Reads the file's header and index, and checks the index ends at the end marker after the last block
+- Compresses the new data into blocks starting where the end marker was
+- Writes a new end marker and an index covering the old blocks and the new ones over the old footer
+Only the new data is read and coded, and the old blocks are left as they are, so appending costs
+the same however big the file is. The block size, order, streams, checksums and words come from
+the file, so the new blocks match the old ones. Each block records its own coder, so new blocks
+can use tANS (or not) whichever the old ones used.
+Takes:
+- A pointer to the input FILE
+- A pointer to the chuff file, opened for reading and writing ("r+b")
+- A pointer to the StreamOptions giving the number of threads, code length limit and coder
+- A pointer to StreamStats to fill in for the new data, or NULL
+Returns:
+- 0 on success, -1 on error (after printing a message to stderr)
+*/
+int stream_append(FILE* in, FILE* file, StreamOptions* options, StreamStats* stats);
+
+/*
+Decompresses a chuff stream read from in and writes the original data to out
+Blocks are decoded on a pool of num_threads workers and written out in order,
+so memory use depends only on the stream's block size and num_threads.
+Adaptive streams are recognised by their magic and decoded in one thread as they are read.
+Takes:
+- A pointer to the input FILE
+- A pointer to the output FILE
+- A pointer to the StreamOptions (only num_threads is used, the rest comes from the stream)
+- A pointer to StreamStats to fill in, or NULL
+Returns:
+- 0 on success, -1 on error (after printing a message to stderr)
+*/
+int stream_decompress(FILE* in, FILE* out, StreamOptions* options, StreamStats* stats);
+
+/*
+Decompresses just part of the original data from a chuff file
+Uses the block index footer to find and decode only the blocks covering the requested bytes.
+Takes:
+- A pointer to the input FILE, which must be seekable
+- A pointer to the output FILE
+- The offset of the first byte wanted in the original data
+- The number of bytes wanted (cut short at the end of the data)
+Returns:
+- 0 on success, -1 on error (after printing a message to stderr)
+*/
+int stream_decompress_range(FILE* in, FILE* out, uint64_t offset, uint64_t length);
+
+# endif
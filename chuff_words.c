@@ -0,0 +1,759 @@
+// chuff_words.c
+// Ben Crabtree, 2021
+
+# include <math.h>
+
+# include "chuff_words.h"
+
+int compare_word_candidates(const void* a, const void* b)
+{
+    const WordCandidate* candidate_a = a;
+    const WordCandidate* candidate_b = b;
+    if (candidate_a->gain != candidate_b->gain)
+    {
+        return candidate_a->gain > candidate_b->gain ? -1 : 1;
+    }
+    return candidate_a->entry < candidate_b->entry ? -1 : 1;
+}
+
+WordCoder* words_coder_new()
+{
+    WordCoder* words = malloc( sizeof(WordCoder) );
+    if (words == NULL)
+    {
+        return NULL;
+    }
+    memset(words, 0, sizeof(WordCoder));
+    dt_init(&words->decode_table);
+    return words;
+}
+
+void words_coder_free(WordCoder* words)
+{
+    if (words == NULL)
+    {
+        return;
+    }
+    free(words->slots);
+    free(words->entries);
+    free(words->candidates);
+    dt_free(&words->decode_table);
+    free(words);
+}
+
+/*
+Checks whether a byte belongs in words (letters, digits and UTF-8) or in the separators between them
+Takes:
+- The byte
+Returns:
+- true for a word byte, false for a separator byte
+*/
+bool words_is_word_byte(uint8_t byte)
+{
+    return (byte >= '0' && byte <= '9') || ((byte | 0x20) >= 'a' && (byte | 0x20) <= 'z') || byte >= 0x80;
+}
+
+/*
+Finds the length of the token starting at pos: the run of bytes of the same kind as the first,
+and for a word the space after it, up to WORDS_MAX_TOKEN_LEN
+Takes:
+- A pointer to the block
+- The position of the token
+- The size of the block
+Returns:
+- The length of the token, at least 1
+*/
+size_t words_token_len(const uint8_t* src, size_t pos, size_t size)
+{
+    bool word = words_is_word_byte(src[pos]);
+    size_t end = size - pos < WORDS_MAX_TOKEN_LEN ? size : pos + WORDS_MAX_TOKEN_LEN;
+    size_t i = pos + 1;
+    while (i < end && words_is_word_byte(src[i]) == word)
+    {
+        i++;
+    }
+    // Words are nearly always followed by a single space, so it goes in with the word
+    if (word && i < end && src[i] == ' ')
+    {
+        i++;
+    }
+    return i - pos;
+}
+
+/*
+Hashes a token with FNV-1a
+Takes:
+- A pointer to the token
+- The length of the token
+Returns:
+- The hash
+*/
+uint32_t words_hash(const uint8_t* token, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= token[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+Finds the slot holding a token, or the empty slot where it would go
+Takes:
+- A pointer to the WordCoder
+- A pointer to the block the entries point into
+- A pointer to the token
+- The length of the token
+- The token's hash
+Returns:
+- The slot index
+*/
+size_t words_find_slot(const WordCoder* words, const uint8_t* src, const uint8_t* token, size_t len, uint32_t hash)
+{
+    size_t mask = words->num_slots - 1;
+    size_t slot = hash & mask;
+    while (words->slots[slot] != 0)
+    {
+        const WordEntry* entry = &words->entries[words->slots[slot] - 1];
+        if (entry->hash == hash && entry->len == len && memcmp(src + entry->offset, token, len) == 0)
+        {
+            return slot;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/*
+Makes room in the hash table for one more entry, doubling the slots when it would be over half full
+Takes:
+- A pointer to the WordCoder
+Returns:
+- 0 on success, -1 if memory runs out
+*/
+int words_grow(WordCoder* words)
+{
+    if (words->num_entries == words->entries_cap)
+    {
+        size_t cap = words->entries_cap == 0 ? WORDS_MIN_SLOTS / 2 : words->entries_cap * 2;
+        WordEntry* entries = realloc(words->entries, cap * sizeof(WordEntry));
+        if (entries == NULL)
+        {
+            return -1;
+        }
+        words->entries = entries;
+        WordCandidate* candidates = realloc(words->candidates, cap * sizeof(WordCandidate));
+        if (candidates == NULL)
+        {
+            return -1;
+        }
+        words->candidates = candidates;
+        words->entries_cap = cap;
+    }
+    if ((words->num_entries + 1) * 2 <= words->num_slots)
+    {
+        return 0;
+    }
+    size_t num_slots = words->num_slots == 0 ? WORDS_MIN_SLOTS : words->num_slots * 2;
+    uint32_t* slots = calloc(num_slots, sizeof(uint32_t));
+    if (slots == NULL)
+    {
+        return -1;
+    }
+    // Entries are only ever added, never moved, so they go back in by their stored hashes
+    for (size_t i = 0; i < words->num_entries; i++)
+    {
+        size_t slot = words->entries[i].hash & (num_slots - 1);
+        while (slots[slot] != 0)
+        {
+            slot = (slot + 1) & (num_slots - 1);
+        }
+        slots[slot] = (uint32_t)(i + 1);
+    }
+    free(words->slots);
+    words->slots = slots;
+    words->num_slots = num_slots;
+    return 0;
+}
+
+/*
+Counts every token of two or more bytes in a block into the hash table
+Takes:
+- A pointer to the WordCoder
+- A pointer to the block
+- The size of the block
+Returns:
+- The number of tokens in the block (including single bytes), or -1 if memory runs out
+*/
+long words_count_tokens(WordCoder* words, const uint8_t* src, size_t src_size)
+{
+    if (words->num_slots > 0)
+    {
+        memset(words->slots, 0, words->num_slots * sizeof(uint32_t));
+    }
+    words->num_entries = 0;
+    long num_tokens = 0;
+    size_t pos = 0;
+    while (pos < src_size)
+    {
+        size_t len = words_token_len(src, pos, src_size);
+        num_tokens++;
+        if (len > 1)
+        {
+            uint32_t hash = words_hash(src + pos, len);
+            size_t slot = words->num_slots > 0 ? words_find_slot(words, src, src + pos, len, hash) : 0;
+            if (words->num_slots > 0 && words->slots[slot] != 0)
+            {
+                words->entries[words->slots[slot] - 1].count++;
+            }
+            else if (words->num_entries < WORDS_MAX_ENTRIES)
+            {
+                if (words_grow(words) != 0)
+                {
+                    return -1;
+                }
+                // Growing can move everything to new slots
+                slot = words_find_slot(words, src, src + pos, len, hash);
+                WordEntry* entry = &words->entries[words->num_entries];
+                entry->offset = (uint32_t)pos;
+                entry->count = 1;
+                entry->hash = hash;
+                entry->len = (uint8_t)len;
+                entry->symbol = -1;
+                words->num_entries++;
+                words->slots[slot] = (uint32_t)words->num_entries;
+            }
+        }
+        pos += len;
+    }
+    return num_tokens;
+}
+
+/*
+Picks the block's vocabulary: the tokens seen more than once that save the most bits
+A token's bytes are costed at the entropy of the block's byte counts and its own code at the
+entropy of its share of the tokens, less what it costs to list it in the header.
+Symbols 256 up are given to the tokens picked, best first, and their bytes are taken off the byte counts.
+Takes:
+- A pointer to the WordCoder with the tokens counted and the byte counts in counts
+- A pointer to the block
+- The number of tokens in the block
+- The most tokens the vocabulary may have
+Returns:
+- The vocabulary size
+*/
+int words_pick_vocab(WordCoder* words, const uint8_t* src, long num_tokens, int max_vocab)
+{
+    uint64_t num_bytes = 0;
+    for (int i = 0; i < NUM_SYMBOLS; i++)
+    {
+        num_bytes += words->counts[i];
+    }
+    double byte_bits[NUM_SYMBOLS];
+    for (int i = 0; i < NUM_SYMBOLS; i++)
+    {
+        byte_bits[i] = words->counts[i] > 0 ? log2((double)num_bytes / (double)words->counts[i]) : 0;
+    }
+    size_t num_candidates = 0;
+    for (size_t i = 0; i < words->num_entries; i++)
+    {
+        WordEntry* entry = &words->entries[i];
+        if (entry->count < 2)
+        {
+            continue;
+        }
+        double spelt_bits = 0;
+        for (int j = 0; j < entry->len; j++)
+        {
+            spelt_bits += byte_bits[src[entry->offset + j]];
+        }
+        double code_bits = log2((double)num_tokens / (double)entry->count);
+        // The token's bytes, its length byte and its code length in the header
+        double gain = entry->count * (spelt_bits - code_bits) - 8.0 * (entry->len + 2);
+        if (gain > 0)
+        {
+            words->candidates[num_candidates].gain = gain;
+            words->candidates[num_candidates].entry = (uint32_t)i;
+            num_candidates++;
+        }
+    }
+    qsort(words->candidates, num_candidates, sizeof(WordCandidate), compare_word_candidates);
+    int vocab_size = num_candidates < (size_t)max_vocab ? (int)num_candidates : max_vocab;
+    for (int v = 0; v < vocab_size; v++)
+    {
+        WordEntry* entry = &words->entries[words->candidates[v].entry];
+        entry->symbol = NUM_SYMBOLS + v;
+        words->counts[NUM_SYMBOLS + v] = entry->count;
+        for (int j = 0; j < entry->len; j++)
+        {
+            words->counts[src[entry->offset + j]] -= entry->count;
+        }
+    }
+    return vocab_size;
+}
+
+/*
+Works out the body size plain order-0 coding would give a block, to check the vocabulary pays for itself
+Takes:
+- A pointer to the BlockCoder
+- An array of NUM_SYMBOLS byte counts for the block
+Returns:
+- The body size in bytes, or 0 if it can't be worked out
+*/
+size_t words_plain_size(BlockCoder* coder, uint64_t byte_counts[])
+{
+    int code_lengths[NUM_SYMBOLS];
+    // Only an estimate, so it is kept out of the coder's stats
+    uint64_t unlimited_bits = coder->unlimited_bits;
+    int result = block_set_lengths(coder, byte_counts, NUM_SYMBOLS, code_lengths, coder->max_code_len);
+    coder->unlimited_bits = unlimited_bits;
+    if (result != 0)
+    {
+        return 0;
+    }
+    uint64_t num_bits = 0;
+    for (int i = 0; i < NUM_SYMBOLS; i++)
+    {
+        num_bits += byte_counts[i] * code_lengths[i];
+    }
+    return 1 + canonical_header_size(code_lengths, NUM_SYMBOLS) + (num_bits + 7) / 8;
+}
+
+/*
+Writes a block body with one byte of kind and then an order-0 body
+Takes:
+- A pointer to the BlockCoder
+- A pointer to the raw data
+- The size of the raw data
+- A pointer to where the body goes
+- The room left for the body
+Returns:
+- The body size in bytes, or -1 if there isn't room
+*/
+long words_compress_plain(BlockCoder* coder, const uint8_t* src, size_t src_size, uint8_t* body, size_t body_cap)
+{
+    if (body_cap < 1)
+    {
+        return -1;
+    }
+    body[0] = WORDS_BODY_BYTES;
+    long body_size = block_compress_body(coder, src, src_size, body + 1, body_cap - 1);
+    return body_size < 0 ? -1 : body_size + 1;
+}
+
+/*
+Writes the code for the token at pos: its own symbol if it is in the vocabulary, otherwise its bytes
+Takes:
+- A pointer to the WordCoder with the vocabulary's hash table and codes set
+- A pointer to the BitWriter
+- A pointer to the block
+- The position of the token
+- The size of the block
+Returns:
+- The length of the token
+*/
+size_t words_put_token(const WordCoder* words, BitWriter* bw, const uint8_t* src, size_t pos, size_t src_size)
+{
+    size_t len = words_token_len(src, pos, src_size);
+    if (len > 1)
+    {
+        uint32_t hash = words_hash(src + pos, len);
+        uint32_t index = words->slots[words_find_slot(words, src, src + pos, len, hash)];
+        if (index != 0 && words->entries[index - 1].symbol >= 0)
+        {
+            bw_put_code(bw, words->codes[words->entries[index - 1].symbol]);
+            return len;
+        }
+    }
+    for (size_t j = 0; j < len; j++)
+    {
+        bw_put_code(bw, words->codes[src[pos + j]]);
+    }
+    return len;
+}
+
+long words_compress(BlockCoder* coder, const uint8_t* src, size_t src_size, uint8_t* body, size_t body_cap)
+{
+    WordCoder* words = coder->word_coder;
+    uint64_t start = get_time_ns();
+    long num_tokens = words_count_tokens(words, src, src_size);
+    if (num_tokens < 0)
+    {
+        return -1;
+    }
+    memset(words->counts, 0, sizeof(words->counts));
+    histogram_count(src, src_size, words->counts);
+    uint64_t byte_counts[NUM_SYMBOLS];
+    memcpy(byte_counts, words->counts, sizeof(byte_counts));
+    uint64_t counted = get_time_ns();
+    coder->phase_ns[PHASE_COUNT] += counted - start;
+
+    int max_len = WORDS_MAX_CODE_LEN;
+    if (coder->max_code_len > 0 && coder->max_code_len < max_len)
+    {
+        max_len = coder->max_code_len;
+    }
+    // Every symbol has to fit in the code length limit
+    int max_vocab = (1 << max_len) - NUM_SYMBOLS;
+    if (max_vocab > WORDS_MAX_VOCAB)
+    {
+        max_vocab = WORDS_MAX_VOCAB;
+    }
+    int vocab_size = words_pick_vocab(words, src, num_tokens, max_vocab);
+    if (vocab_size == 0)
+    {
+        coder->phase_ns[PHASE_CODES] += get_time_ns() - counted;
+        return words_compress_plain(coder, src, src_size, body, body_cap);
+    }
+    int num_symbols = NUM_SYMBOLS + vocab_size;
+    uint64_t unlimited_bits = coder->unlimited_bits;
+    if (block_set_lengths(coder, words->counts, num_symbols, words->code_lengths, max_len) != 0 ||
+        canonical_assign_codes(words->code_lengths, words->codes, num_symbols) != 0)
+    {
+        return -1;
+    }
+    size_t vocab_bytes = 4;
+    for (int v = 0; v < vocab_size; v++)
+    {
+        vocab_bytes += 1 + words->entries[words->candidates[v].entry].len;
+    }
+    uint64_t num_bits = 0;
+    for (int i = 0; i < num_symbols; i++)
+    {
+        num_bits += words->counts[i] * words->code_lengths[i];
+    }
+    int num_streams = coder->num_streams;
+    size_t table_size = canonical_header_size(words->code_lengths, num_symbols);
+    size_t segments_size = (num_streams - 1) * BLOCK_JUMP_ENTRY_SIZE;
+    size_t jump_size = (num_streams - 1) * BLOCK_JUMP_ENTRY_SIZE;
+    size_t body_size = 1 + vocab_bytes + table_size + segments_size + jump_size + bw_bytes_needed(num_bits) + num_streams - 1;
+    uint64_t coded = get_time_ns();
+    coder->phase_ns[PHASE_CODES] += coded - counted;
+    if (body_size > body_cap || body_size >= words_plain_size(coder, byte_counts))
+    {
+        coder->unlimited_bits = unlimited_bits;
+        return words_compress_plain(coder, src, src_size, body, body_cap);
+    }
+
+    body[0] = WORDS_BODY_TOKENS;
+    put_u32(body + 1, (uint32_t)vocab_size);
+    size_t pos = 5;
+    for (int v = 0; v < vocab_size; v++)
+    {
+        WordEntry* entry = &words->entries[words->candidates[v].entry];
+        body[pos] = entry->len;
+        memcpy(body + pos + 1, src + entry->offset, entry->len);
+        pos += 1 + entry->len;
+    }
+    pos += canonical_write_lengths(words->code_lengths, num_symbols, body + pos);
+    uint8_t* segments = body + pos;
+    uint8_t* payload = segments + segments_size;
+    size_t payload_size = jump_size;
+    size_t segment_size = block_segment_size(src_size, num_streams);
+    size_t i = 0;
+    for (int s = 0; s < num_streams; s++)
+    {
+        // Tokens can't be split, so each segment runs on to the first token boundary after its share
+        size_t target = s < num_streams - 1 && (s + 1) * segment_size < src_size ? (s + 1) * segment_size : src_size;
+        size_t start = i;
+        BitWriter bw;
+        bw_init(&bw, payload + payload_size);
+        while (i < target)
+        {
+            i += words_put_token(words, &bw, src, i, src_size);
+        }
+        size_t stream_size = bw_finish(&bw);
+        if (s < num_streams - 1)
+        {
+            put_u32(segments + s * BLOCK_JUMP_ENTRY_SIZE, (uint32_t)(i - start));
+            put_u32(payload + s * BLOCK_JUMP_ENTRY_SIZE, (uint32_t)stream_size);
+        }
+        payload_size += stream_size;
+    }
+    coder->payload_bits += num_bits;
+    coder->phase_ns[PHASE_ENCODE] += get_time_ns() - coded;
+    return pos + segments_size + payload_size;
+}
+
+/*
+Decodes tokens from one bitstream until size bytes have been written
+Takes:
+- A pointer to the WordCoder with its decode table built
+- A pointer to the BitReader
+- A pointer to the destination buffer
+- The number of bytes to decode
+Returns:
+- 0 on success, -1 if the stream is corrupt (a token is WORDS_BAD_TOKEN or the last one would run past size)
+*/
+int words_decode_run(const WordCoder* words, BitReader* br, uint8_t* dst, size_t size)
+{
+    const DecodeTable* table = &words->decode_table;
+    const uint8_t* token_bytes = words->token_bytes;
+    size_t per_refill = 57 / table->max_len;
+    size_t num_decoded = 0;
+    // While there is room, every token is copied as a whole WORDS_MAX_TOKEN_LEN bytes, which
+    // compiles to a couple of fixed size moves, and the next one written over the spare end
+    while (size - num_decoded >= per_refill * WORDS_MAX_TOKEN_LEN)
+    {
+        size_t group_start = num_decoded;
+        br_refill(br);
+        for (size_t k = 0; k < per_refill; k++)
+        {
+            uint32_t token = dt_decode_symbol(table, br);
+            memcpy(dst + num_decoded, token_bytes + (token >> 8), WORDS_MAX_TOKEN_LEN);
+            num_decoded += token & 0xFF;
+        }
+        // Only WORDS_BAD_TOKEN is empty, so a refill's worth of tokens writing nothing means a corrupt code
+        if (num_decoded == group_start)
+        {
+            return -1;
+        }
+    }
+    while (num_decoded < size)
+    {
+        br_refill(br);
+        uint32_t token = dt_decode_symbol(table, br);
+        size_t len = token & 0xFF;
+        if (len == 0 || len > size - num_decoded)
+        {
+            return -1;
+        }
+        memcpy(dst + num_decoded, token_bytes + (token >> 8), len);
+        num_decoded += len;
+    }
+    return 0;
+}
+
+/*
+Decodes four bitstreams side by side while every segment has room for whole token copies
+Each reader and position is copied to a local so the compiler can keep them all in registers.
+Takes:
+- A pointer to the WordCoder with its decode table built
+- An array of four BitReaders
+- A pointer to the destination buffer
+- An array of four positions in dst to write each stream's tokens at, moved on as they are written
+- An array of four positions each stream's segment ends at
+Returns:
+- 0 on success, -1 if a refill's worth of tokens from any stream wrote nothing (see words_decode_run())
+*/
+int words_decode_4(const WordCoder* words, BitReader readers[], uint8_t* dst, size_t outs[], const size_t ends[])
+{
+    const DecodeTable* table = &words->decode_table;
+    const uint8_t* token_bytes = words->token_bytes;
+    BitReader br0 = readers[0];
+    BitReader br1 = readers[1];
+    BitReader br2 = readers[2];
+    BitReader br3 = readers[3];
+    uint8_t* out0 = dst + outs[0];
+    uint8_t* out1 = dst + outs[1];
+    uint8_t* out2 = dst + outs[2];
+    uint8_t* out3 = dst + outs[3];
+    uint8_t* end0 = dst + ends[0];
+    uint8_t* end1 = dst + ends[1];
+    uint8_t* end2 = dst + ends[2];
+    uint8_t* end3 = dst + ends[3];
+    size_t per_refill = 57 / table->max_len;
+    size_t room = per_refill * WORDS_MAX_TOKEN_LEN;
+    while ((size_t)(end0 - out0) >= room && (size_t)(end1 - out1) >= room
+        && (size_t)(end2 - out2) >= room && (size_t)(end3 - out3) >= room)
+    {
+        br_refill(&br0);
+        br_refill(&br1);
+        br_refill(&br2);
+        br_refill(&br3);
+        const uint8_t* starts[4] = {out0, out1, out2, out3};
+        for (size_t k = 0; k < per_refill; k++)
+        {
+            uint32_t token0 = dt_decode_symbol(table, &br0);
+            uint32_t token1 = dt_decode_symbol(table, &br1);
+            uint32_t token2 = dt_decode_symbol(table, &br2);
+            uint32_t token3 = dt_decode_symbol(table, &br3);
+            memcpy(out0, token_bytes + (token0 >> 8), WORDS_MAX_TOKEN_LEN);
+            memcpy(out1, token_bytes + (token1 >> 8), WORDS_MAX_TOKEN_LEN);
+            memcpy(out2, token_bytes + (token2 >> 8), WORDS_MAX_TOKEN_LEN);
+            memcpy(out3, token_bytes + (token3 >> 8), WORDS_MAX_TOKEN_LEN);
+            out0 += token0 & 0xFF;
+            out1 += token1 & 0xFF;
+            out2 += token2 & 0xFF;
+            out3 += token3 & 0xFF;
+        }
+        if (out0 == starts[0] || out1 == starts[1] || out2 == starts[2] || out3 == starts[3])
+        {
+            return -1;
+        }
+    }
+    readers[0] = br0;
+    readers[1] = br1;
+    readers[2] = br2;
+    readers[3] = br3;
+    outs[0] = out0 - dst;
+    outs[1] = out1 - dst;
+    outs[2] = out2 - dst;
+    outs[3] = out3 - dst;
+    return 0;
+}
+
+int words_decompress(BlockCoder* coder, const uint8_t* body, size_t body_size, uint8_t* dst, size_t raw_size)
+{
+    if (body_size < 1)
+    {
+        return -1;
+    }
+    if (body[0] == WORDS_BODY_BYTES)
+    {
+        return block_decompress_body(coder, body + 1, body_size - 1, dst, raw_size);
+    }
+    if (body[0] != WORDS_BODY_TOKENS || body_size < 5)
+    {
+        return -1;
+    }
+    WordCoder* words = coder->word_coder;
+    uint64_t start = get_time_ns();
+    size_t vocab_size = get_u32(body + 1);
+    if (vocab_size > WORDS_MAX_VOCAB)
+    {
+        return -1;
+    }
+    // Byte symbols are tokens of one byte, followed by the vocabulary
+    for (int b = 0; b < NUM_SYMBOLS; b++)
+    {
+        words->token_bytes[b] = (uint8_t)b;
+        words->tokens[b] = (uint32_t)b << 8 | 1;
+    }
+    size_t pos = 5;
+    size_t bytes_pos = NUM_SYMBOLS;
+    for (size_t v = 0; v < vocab_size; v++)
+    {
+        if (pos >= body_size)
+        {
+            return -1;
+        }
+        size_t len = body[pos];
+        if (len < 2 || len > WORDS_MAX_TOKEN_LEN || len > body_size - pos - 1)
+        {
+            return -1;
+        }
+        memcpy(words->token_bytes + bytes_pos, body + pos + 1, len);
+        words->tokens[NUM_SYMBOLS + v] = (uint32_t)bytes_pos << 8 | (uint32_t)len;
+        bytes_pos += len;
+        pos += 1 + len;
+    }
+    memset(words->token_bytes + bytes_pos, 0, WORDS_MAX_TOKEN_LEN);
+    int num_symbols = NUM_SYMBOLS + (int)vocab_size;
+    long table_size = canonical_read_lengths(body + pos, body_size - pos, words->code_lengths, num_symbols);
+    if (table_size < 0 ||
+        canonical_assign_codes(words->code_lengths, words->codes, num_symbols) != 0 ||
+        dt_build(&words->decode_table, words->codes, num_symbols) != 0)
+    {
+        return -1;
+    }
+    pos += table_size;
+    // Symbols are only needed to find their tokens, so the table hands back the token itself.
+    // A corrupt header can give an incomplete code, whose unfilled entries (neither a symbol nor
+    // a link) would otherwise decode as a token of 0 bytes without consuming any bits, forever
+    DecodeTable* table = &words->decode_table;
+    int num_primary = 1 << table->primary_bits;
+    for (int e = 0; e < table->num_entries; e++)
+    {
+        DecodeEntry* entry = &table->entries[e];
+        if (entry->len > 0)
+        {
+            entry->value = words->tokens[entry->value];
+        }
+        else if (e >= num_primary || entry->sub_bits == 0)
+        {
+            entry->value = WORDS_BAD_TOKEN;
+            entry->len = 1;
+        }
+    }
+    uint64_t built = get_time_ns();
+    coder->phase_ns[PHASE_DECODE_TABLE] += built - start;
+
+    int num_streams = coder->num_streams;
+    size_t segments_size = (num_streams - 1) * BLOCK_JUMP_ENTRY_SIZE;
+    if (segments_size > body_size - pos)
+    {
+        return -1;
+    }
+    size_t outs[BLOCK_MAX_STREAMS];
+    size_t ends[BLOCK_MAX_STREAMS];
+    size_t segment_start = 0;
+    for (int s = 0; s < num_streams; s++)
+    {
+        size_t size = s < num_streams - 1 ? get_u32(body + pos + s * BLOCK_JUMP_ENTRY_SIZE) : raw_size - segment_start;
+        if (size > raw_size - segment_start)
+        {
+            return -1;
+        }
+        outs[s] = segment_start;
+        ends[s] = segment_start + size;
+        segment_start += size;
+    }
+    pos += segments_size;
+    BitReader readers[BLOCK_MAX_STREAMS];
+    if (block_open_streams(body + pos, body_size - pos, num_streams, readers) != 0)
+    {
+        return -1;
+    }
+
+    const uint8_t* token_bytes = words->token_bytes;
+    size_t per_refill = 57 / table->max_len;
+    size_t room = per_refill * WORDS_MAX_TOKEN_LEN;
+    if (num_streams == 4)
+    {
+        if (words_decode_4(words, readers, dst, outs, ends) != 0)
+        {
+            return -1;
+        }
+    }
+    else if (num_streams > 1)
+    {
+        // Decode the streams side by side while every segment has room for whole token copies
+        bool room_left = true;
+        while (room_left)
+        {
+            for (int s = 0; s < num_streams; s++)
+            {
+                room_left = room_left && ends[s] - outs[s] >= room;
+            }
+            if (!room_left)
+            {
+                break;
+            }
+            size_t starts[BLOCK_MAX_STREAMS];
+            for (int s = 0; s < num_streams; s++)
+            {
+                br_refill(&readers[s]);
+                starts[s] = outs[s];
+            }
+            for (size_t k = 0; k < per_refill; k++)
+            {
+                for (int s = 0; s < num_streams; s++)
+                {
+                    uint32_t token = dt_decode_symbol(table, &readers[s]);
+                    memcpy(dst + outs[s], token_bytes + (token >> 8), WORDS_MAX_TOKEN_LEN);
+                    outs[s] += token & 0xFF;
+                }
+            }
+            for (int s = 0; s < num_streams; s++)
+            {
+                if (outs[s] == starts[s])
+                {
+                    return -1;
+                }
+            }
+        }
+    }
+    // Then each stream finishes its own segment
+    for (int s = 0; s < num_streams; s++)
+    {
+        if (words_decode_run(words, &readers[s], dst + outs[s], ends[s] - outs[s]) != 0)
+        {
+            return -1;
+        }
+    }
+    coder->phase_ns[PHASE_DECODE] += get_time_ns() - built;
+    return 0;
+}
@@ -0,0 +1,153 @@
+// chuff_words.h
+// Ben Crabtree, 2021
+
+# ifndef CHUFF_WORDS_H
+# define CHUFF_WORDS_H
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdbool.h>
+# include <stdint.h>
+# include <string.h>
+
+# include "chuff_shared.h"
+# include "chuff_bitstream.h"
+# include "chuff_decode_table.h"
+# include "chuff_canonical.h"
+# include "chuff_histogram.h"
+# include "chuff_block.h"
+
+// Longest token: longer runs of word or separator bytes are cut into pieces this long
+# define WORDS_MAX_TOKEN_LEN 32
+// Most tokens a block's vocabulary can have
+# define WORDS_MAX_VOCAB 16384
+// Bytes and vocabulary tokens
+# define WORDS_MAX_SYMBOLS (NUM_SYMBOLS + WORDS_MAX_VOCAB)
+// Codes are kept to this length (or max_code_len if lower) so the decode table stays small
+# define WORDS_MAX_CODE_LEN 20
+// Most different tokens counted in one block; any after that are coded as bytes
+# define WORDS_MAX_ENTRIES (1 << 20)
+// Hash table slots a WordCoder starts with, doubled whenever it gets half full
+# define WORDS_MIN_SLOTS 4096
+// First byte of a word block body: how the rest of it is coded
+# define WORDS_BODY_BYTES 0
+# define WORDS_BODY_TOKENS 1
+// Token a corrupt code's unfilled decode table entries give: 0 bytes long, which no real token is
+# define WORDS_BAD_TOKEN 0
+
+/*
+One distinct token seen in a block
+*/
+struct WordEntry
+{
+    uint32_t offset; // Where the token first appears in the block
+    uint32_t count;
+    uint32_t hash;
+    uint8_t len;
+    int32_t symbol; // Symbol the token is coded as, or -1 if it is left out of the vocabulary
+};
+
+typedef struct WordEntry WordEntry;
+
+/*
+A token that might go in the vocabulary, and roughly how many bits giving it a code would save
+*/
+struct WordCandidate
+{
+    double gain;
+    uint32_t entry;
+};
+
+typedef struct WordCandidate WordCandidate;
+
+/*
+Semi-static word model: each block is cut into tokens, runs of letters and digits (and bytes
+of 0x80 and up, so UTF-8 text stays in its words) or runs of everything else, and the tokens
+worth a code of their own make up the block's vocabulary. Each token in the vocabulary is one
+symbol, and every other token is spelt out with byte symbols, which double as the escape for
+rare words. One Huffman code covers the 256 bytes and the vocabulary together, so the decoder
+writes out a whole token for each code it looks up.
+
+A word block is laid out as:
+- Block header (see chuff_block.h)
+- 1 byte body kind: WORDS_BODY_TOKENS, or WORDS_BODY_BYTES if no vocabulary pays for itself
+  (binary data, say), in which case the rest is an order-0 body (see block_compress_body())
+- 4 bytes vocabulary size V (big endian)
+- V tokens, each a length byte then that many bytes; token i is symbol 256 + i
+- Code lengths header (see canonical_write_lengths()) for the 256 + V symbols
+- Segment table: the raw size of every segment but the last (4 bytes each, big endian)
+- Bit-packed payload, split into streams as for an order-0 block (see chuff_block.h)
+- Checksum, if the stream has them
+As tokens can't be split, each segment runs on from its share of the block to the end of the
+token there, so the segment sizes are stored rather than worked out from the raw size.
+Whole tokens are copied WORDS_MAX_TOKEN_LEN bytes at a time while a segment has room.
+*/
+struct WordCoder
+{
+    // Hash table of every distinct token in the block, kept between blocks
+    uint32_t* slots; // Index + 1 of the entry in each slot, 0 if the slot is empty
+    size_t num_slots;
+    WordEntry* entries;
+    size_t num_entries;
+    size_t entries_cap;
+    WordCandidate* candidates; // Scratch space for picking the vocabulary, entries_cap long
+    // Code table over bytes and vocabulary
+    uint64_t counts[WORDS_MAX_SYMBOLS];
+    int code_lengths[WORDS_MAX_SYMBOLS];
+    HuffCode codes[WORDS_MAX_SYMBOLS];
+    DecodeTable decode_table;
+    // Where each symbol's bytes are in token_bytes (offset << 8 | length), for decoding
+    uint32_t tokens[WORDS_MAX_SYMBOLS];
+    // The 256 bytes then the vocabulary's tokens, with room to copy a whole WORDS_MAX_TOKEN_LEN from the last one
+    uint8_t token_bytes[NUM_SYMBOLS + (WORDS_MAX_VOCAB + 1) * WORDS_MAX_TOKEN_LEN];
+};
+
+typedef struct WordCoder WordCoder;
+
+/*
+Allocates and initialises a WordCoder
+Takes:
+- Nothing
+Returns:
+- A pointer to the new WordCoder, or NULL if memory runs out
+*/
+WordCoder* words_coder_new();
+
+/*
+Frees a WordCoder, its hash table and its decode table
+Takes:
+- A pointer to the WordCoder (NULL is allowed)
+Returns:
+- Void
+*/
+void words_coder_free(WordCoder* words);
+
+/*
+Compresses one block's body (everything after the block header) with the word model,
+using the BlockCoder's WordCoder, code length limit and tree, and adding to its stats
+block_compress() calls this and writes the block header and checksum around it.
+Takes:
+- A pointer to a BlockCoder with a WordCoder
+- A pointer to the raw data
+- The size of the raw data (1 to UINT32_MAX bytes)
+- A pointer to where the body goes
+- The room left for the body
+Returns:
+- The body size in bytes, or -1 if there isn't room or memory runs out
+*/
+long words_compress(BlockCoder* coder, const uint8_t* src, size_t src_size, uint8_t* body, size_t body_cap);
+
+/*
+Decompresses one block body written by words_compress()
+Takes:
+- A pointer to a BlockCoder with a WordCoder
+- A pointer to the body, just after the block header
+- The size of the body, not counting any checksum
+- A pointer to the destination buffer
+- The raw size of the block, from its header (dst must have room for it)
+Returns:
+- 0 on success, -1 if the body is malformed
+*/
+int words_decompress(BlockCoder* coder, const uint8_t* body, size_t body_size, uint8_t* dst, size_t raw_size);
+
+# endif